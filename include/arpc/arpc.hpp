@@ -19,7 +19,11 @@
 #define _ARPC_HPP_
 
 #include <arpc/execution_pool_mpi.hpp>
+#include <arpc/future.hpp>
 #include <arpc/remote_function.hpp>
+#include <arpc/task_graph.hpp>
+#include <arpc/remote_object.hpp>
+#include <arpc/distributed_map.hpp>
 
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef _ARPC_FUNCTION_ID_HPP_
+#define _ARPC_FUNCTION_ID_HPP_
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**/
+
+#include <cstdint>
+#include <string>
+
+
+namespace arpc {
+
+
+namespace internal{
+
+constexpr std::uint32_t fnv1a_offset_basis = 2166136261u;
+constexpr std::uint32_t fnv1a_prime = 16777619u;
+
+constexpr std::uint32_t fnv1a_hash(const char* str, std::uint32_t value = fnv1a_offset_basis){
+    return (*str == '\0') ? value : fnv1a_hash(str +1, (value ^ std::uint32_t(static_cast<unsigned char>(*str))) * fnv1a_prime);
+}
+
+// hashed ids always have the bit 30 set and never collide
+// with the sequential ids of anonymous registrations
+constexpr std::uint32_t function_id_hashed_flag = 0x40000000u;
+constexpr std::uint32_t function_id_hashed_mask = 0x3fffffffu;
+
+} // internal
+
+
+///
+/// \brief compute the function identifier associated to a function name
+///
+/// The identifier only depends on the name: every node computes the same one
+/// without any communication. Usable at compile time.
+///
+constexpr int function_id(const char* function_name){
+    return int((internal::fnv1a_hash(function_name) & internal::function_id_hashed_mask) | internal::function_id_hashed_flag);
+}
+
+inline int function_id(const std::string & function_name){
+    return function_id(function_name.c_str());
+}
+
+
+} // arpc
+
+#endif
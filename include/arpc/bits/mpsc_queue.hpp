@@ -0,0 +1,109 @@
+#ifndef _ARPC_MPSC_QUEUE_HPP_
+#define _ARPC_MPSC_QUEUE_HPP_
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**/
+
+#include <atomic>
+
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief intrusive node of an mpsc_queue
+///
+template<typename T>
+struct mpsc_node{
+    mpsc_node() : next(nullptr) {}
+
+    std::atomic<T*> next;
+};
+
+
+///
+/// \brief lock free intrusive multiple producers, single consumer queue
+///
+/// push() is wait free and can be called from any thread, pop() from a single
+/// consumer thread only. The queue does not own the nodes: a node has to stay
+/// alive until it is popped. T derives from mpsc_node<T> and is default constructible
+///
+template<typename T>
+class mpsc_queue{
+public:
+    mpsc_queue() : _head(&_stub), _tail(&_stub), _stub() {}
+
+    void push(T* node){
+        node->next.store(nullptr, std::memory_order_relaxed);
+        T* prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    ///
+    /// \return the oldest node, nullptr if the queue is empty
+    /// or if the last push is not complete yet
+    ///
+    T* pop(){
+        T* tail = _tail;
+        T* next = tail->next.load(std::memory_order_acquire);
+
+        if(tail == &_stub){
+            if(next == nullptr){
+                return nullptr;
+            }
+            _tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if(next != nullptr){
+            _tail = next;
+            return tail;
+        }
+
+        if(tail != _head.load(std::memory_order_acquire)){
+            return nullptr;
+        }
+
+        // tail is the last node: put the stub behind it to release it
+        push(&_stub);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if(next != nullptr){
+            _tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    mpsc_queue(const mpsc_queue &) = delete;
+
+    std::atomic<T*> _head;
+    T* _tail;
+    T _stub;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
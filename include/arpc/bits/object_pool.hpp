@@ -0,0 +1,233 @@
+#ifndef _ARPC_OBJECT_POOL_HPP_
+#define _ARPC_OBJECT_POOL_HPP_
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**/
+
+#include <atomic>
+#include <new>
+#include <cstddef>
+
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief recycle the allocations of the objects of type Derived
+///
+/// Derived inherits its operators new and delete. Each block belongs to the thread
+/// which allocated it first: a block deleted by its owner goes to the free list of
+/// the owner, a block deleted by an other thread is pushed on a lock free return stack
+/// of the owner, taken back by the owner once its free list is empty. A request handler
+/// allocated by the caller and deleted by an executor is reused by the caller.
+///
+/// the free list keeps at most max_cached blocks, the returned blocks are always
+/// kept: they are bounded by the blocks allocated by the owner. The blocks of an
+/// exited thread go back to the heap
+///
+template<typename Derived, std::size_t max_cached = 256>
+class pooled_allocation{
+public:
+    static void* operator new(std::size_t size){
+        if(size != sizeof(Derived)){
+            return ::operator new(size);
+        }
+
+        pool_owner* owner = local_owner();
+        if(owner != nullptr){
+            if(owner->head == nullptr){
+                owner->take_returned();
+            }
+            if(owner->head != nullptr){
+                block* b = owner->head;
+                owner->head = b->next;
+                owner->count -= 1;
+                return payload(b);
+            }
+        }
+
+        block* b = static_cast<block*>(::operator new(header_size + sizeof(Derived)));
+        b->owner = owner;
+        b->next = nullptr;
+        if(owner != nullptr){
+            owner->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return payload(b);
+    }
+
+    static void operator delete(void* ptr, std::size_t size){
+        if(ptr == nullptr){
+            return;
+        }
+        if(size != sizeof(Derived)){
+            ::operator delete(ptr);
+            return;
+        }
+
+        block* b = reinterpret_cast<block*>(static_cast<char*>(ptr) - header_size);
+        pool_owner* owner = b->owner;
+        if(owner == nullptr){
+            ::operator delete(b);
+        }else if(owner == pool_state().current){
+            if(owner->count < max_cached){
+                b->next = owner->head;
+                owner->head = b;
+                owner->count += 1;
+            }else{
+                release_block(b);
+            }
+        }else{
+            owner->give_back(b);
+        }
+    }
+
+private:
+    struct pool_owner;
+
+    // header in front of each pooled object
+    struct block{
+        pool_owner* owner;
+        block* next;
+    };
+
+    static constexpr std::size_t header_size =
+            (sizeof(block) + alignof(std::max_align_t) -1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    static inline void* payload(block* b){
+        return reinterpret_cast<char*>(b) + header_size;
+    }
+
+    // the blocks of a thread, lives until the thread exited and all its blocks are freed
+    struct pool_owner{
+        pool_owner() : head(nullptr), count(0), returned(nullptr), closed(false), refs(1) {}
+
+        // free list, owner thread only
+        block* head;
+        std::size_t count;
+
+        // blocks deleted by the other threads
+        std::atomic<block*> returned;
+        std::atomic<bool> closed;
+        // one for the thread, one per block allocated from the heap
+        std::atomic<std::size_t> refs;
+
+        void take_returned(){
+            if(returned.load(std::memory_order_relaxed) == nullptr){
+                return;
+            }
+            head = returned.exchange(nullptr, std::memory_order_acquire);
+            for(block* b = head; b != nullptr; b = b->next){
+                count += 1;
+            }
+        }
+
+        void give_back(block* b){
+            // keep the owner alive, an exiting owner can free b right after the push
+            refs.fetch_add(1, std::memory_order_relaxed);
+
+            block* top = returned.load(std::memory_order_relaxed);
+            do{
+                b->next = top;
+            }while(returned.compare_exchange_weak(top, b, std::memory_order_seq_cst, std::memory_order_relaxed) == false);
+
+            // the owner exited: nobody takes the stack back anymore
+            if(closed.load(std::memory_order_seq_cst)){
+                drain_returned();
+            }
+            unref();
+        }
+
+        void drain_returned(){
+            block* b = returned.exchange(nullptr, std::memory_order_seq_cst);
+            while(b != nullptr){
+                block* next = b->next;
+                release_block(b);
+                b = next;
+            }
+        }
+
+        void unref(){
+            if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+                delete this;
+            }
+        }
+    };
+
+    static void release_block(block* b){
+        pool_owner* owner = b->owner;
+        ::operator delete(b);
+        owner->unref();
+    }
+
+    // trivially destructible, still valid while the thread local objects are destroyed
+    struct state{
+        pool_owner* current;
+        bool exited;
+    };
+
+    static state & pool_state(){
+        static thread_local state s = { nullptr, false };
+        return s;
+    }
+
+    // close the owner of the thread at its exit
+    struct owner_guard{
+        ~owner_guard(){
+            state & s = pool_state();
+            pool_owner* owner = s.current;
+            s.current = nullptr;
+            s.exited = true;
+            if(owner == nullptr){
+                return;
+            }
+
+            owner->closed.store(true, std::memory_order_seq_cst);
+            while(owner->head != nullptr){
+                block* next = owner->head->next;
+                release_block(owner->head);
+                owner->head = next;
+            }
+            owner->drain_returned();
+            owner->unref();
+        }
+    };
+
+    // the objects allocated while the thread exits are not pooled
+    static pool_owner* local_owner(){
+        state & s = pool_state();
+        if(s.current == nullptr && s.exited == false){
+            static thread_local owner_guard guard;
+            (void) guard;
+            s.current = new pool_owner();
+        }
+        return s.current;
+    }
+};
+
+
+template<typename Derived, std::size_t max_cached>
+constexpr std::size_t pooled_allocation<Derived, max_cached>::header_size;
+
+
+} // internal
+
+} // arpc
+
+#endif
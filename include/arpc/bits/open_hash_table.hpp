@@ -0,0 +1,171 @@
+#ifndef _ARPC_OPEN_HASH_TABLE_HPP_
+#define _ARPC_OPEN_HASH_TABLE_HPP_
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**/
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief finalizer of a hash value, spread the entropy of all the bits of h
+///
+inline std::uint64_t mix_hash(std::uint64_t h){
+    h ^= h >> 30;
+    h *= UINT64_C(0xbf58476d1ce4e5b9);
+    h ^= h >> 27;
+    h *= UINT64_C(0x94d049bb133111eb);
+    h ^= h >> 31;
+    return h;
+}
+
+
+///
+/// \brief hash table with open addressing and linear probing
+///
+/// a probe scans an array of one byte tags, 7 bits of the hash of each entry:
+/// the keys are only compared on a tag match and the entries only touched then.
+/// There is no removal, the references to the values are invalidated by an insertion.
+/// K and V are default constructible
+///
+template<typename K, typename V, typename Hash = std::hash<K> >
+class open_hash_table{
+public:
+    open_hash_table() : _tags(), _entries(), _size(0), _hash() {}
+
+    inline std::size_t size() const{
+        return _size;
+    }
+
+    inline std::size_t capacity() const{
+        return _tags.size();
+    }
+
+    ///
+    /// \return the value of key, nullptr if absent
+    ///
+    V* find(const K & key){
+        if(_size == 0){
+            return nullptr;
+        }
+
+        const std::uint64_t h = mix_hash(std::uint64_t(_hash(key)));
+        const std::uint8_t tag = make_tag(h);
+        const std::size_t mask = _tags.size() -1;
+
+        for(std::size_t i = std::size_t(h) & mask; ; i = (i +1) & mask){
+            if(_tags[i] == empty_tag){
+                return nullptr;
+            }
+            if(_tags[i] == tag && _entries[i].first == key){
+                return &_entries[i].second;
+            }
+        }
+    }
+
+    ///
+    /// \return the value of key, value initialized if key is inserted, and true if key was absent
+    ///
+    std::pair<V*, bool> insert(const K & key){
+        if((_size +1) * 4 > _tags.size() * 3){
+            grow();
+        }
+
+        const std::uint64_t h = mix_hash(std::uint64_t(_hash(key)));
+        const std::uint8_t tag = make_tag(h);
+        const std::size_t mask = _tags.size() -1;
+
+        for(std::size_t i = std::size_t(h) & mask; ; i = (i +1) & mask){
+            if(_tags[i] == empty_tag){
+                _tags[i] = tag;
+                _entries[i].first = key;
+                _entries[i].second = V();
+                _size += 1;
+                return std::make_pair(&_entries[i].second, true);
+            }
+            if(_tags[i] == tag && _entries[i].first == key){
+                return std::make_pair(&_entries[i].second, false);
+            }
+        }
+    }
+
+    void clear(){
+        _tags.clear();
+        _entries.clear();
+        _size = 0;
+    }
+
+private:
+    static constexpr std::uint8_t empty_tag = 0;
+    static constexpr std::size_t min_capacity = 16;
+
+    // high bits: the low ones select the slot
+    static inline std::uint8_t make_tag(std::uint64_t h){
+        return std::uint8_t(0x80 | (h >> 57));
+    }
+
+    void grow(){
+        std::vector<std::uint8_t> tags(std::max(min_capacity, _tags.size() * 2), empty_tag);
+        std::vector<std::pair<K, V> > entries(tags.size());
+        const std::size_t mask = tags.size() -1;
+
+        for(std::size_t j = 0; j < _tags.size(); ++j){
+            if(_tags[j] == empty_tag){
+                continue;
+            }
+            const std::uint64_t h = mix_hash(std::uint64_t(_hash(_entries[j].first)));
+            std::size_t i = std::size_t(h) & mask;
+            while(tags[i] != empty_tag){
+                i = (i +1) & mask;
+            }
+            tags[i] = _tags[j];
+            entries[i] = std::move(_entries[j]);
+        }
+
+        _tags.swap(tags);
+        _entries.swap(entries);
+    }
+
+    std::vector<std::uint8_t> _tags;
+    std::vector<std::pair<K, V> > _entries;
+    std::size_t _size;
+    Hash _hash;
+};
+
+template<typename K, typename V, typename Hash>
+constexpr std::uint8_t open_hash_table<K, V, Hash>::empty_tag;
+
+template<typename K, typename V, typename Hash>
+constexpr std::size_t open_hash_table<K, V, Hash>::min_capacity;
+
+
+} // internal
+
+} // arpc
+
+#endif
@@ -22,19 +22,37 @@
 #include <tuple>
 #include <functional>
 #include <algorithm>
+#include <iterator>
 #include <type_traits>
 #include <vector>
 #include <future>
-#include <sstream>
+#include <memory>
+#include <mutex>
+#include <istream>
+#include <ostream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
 
 #include <cstdint>
 
 #include "serializers.hpp"
+#include "../compression.hpp"
+#include "../result_cache.hpp"
 
 
 namespace arpc {
 
 
+///
+/// \brief exception reported by a remote node while executing a request
+///
+class remote_error : public std::runtime_error{
+public:
+    explicit remote_error(const std::string & msg) : std::runtime_error(msg) {}
+};
+
+
 namespace internal{
 
 namespace {
@@ -55,7 +73,7 @@ class list_args<void>{
 template <typename F, typename Ret, typename Tuple, bool Done, int Total, int... N>
 struct call_impl
 {
-  static Ret call(F f, Tuple && t)
+  static Ret call(F & f, Tuple && t)
   {
       return call_impl<F, Ret, Tuple, Total == 1 + sizeof...(N), Total, N..., sizeof...(N)>::call(f, std::forward<Tuple>(t));
   }
@@ -64,22 +82,152 @@ struct call_impl
 template <typename F, typename Ret, typename Tuple, int Total, int... N>
 struct call_impl<F, Ret, Tuple, true, Total, N...>
 {
-  static Ret call(F f, Tuple && t)
+  static Ret call(F & f, Tuple && t)
   {
       return f(std::get<N>(std::forward<Tuple>(t))...);
   }
 };
 
+// the elements of an rvalue tuple are moved to the arguments of f
 template <typename Ret, typename F, typename Tuple>
-Ret invoke_function(F f, Tuple && t)
+Ret invoke_function(F && f, Tuple && t)
 {
   typedef typename std::decay<Tuple>::type ttype;
-  return call_impl<F, Ret, Tuple, 0 == std::tuple_size<ttype>::value, std::tuple_size<ttype>::value>::call(f, std::forward<Tuple>(t));
+  typedef typename std::remove_reference<F>::type ftype;
+  return call_impl<ftype, Ret, Tuple, 0 == std::tuple_size<ttype>::value, std::tuple_size<ttype>::value>::call(f, std::forward<Tuple>(t));
+}
+
+
+// archive each value in place, in the format of a tuple of the values
+template <typename Archive>
+inline void archive_values(Archive &){}
+
+template <typename Archive, typename T, typename... Others>
+inline void archive_values(Archive & archiver, const T & value, const Others &... others){
+    archiver(value);
+    archive_values(archiver, others...);
+}
+
+
+// load the only argument of a callable from a serialized result
+template <typename Tuple, std::size_t Size = std::tuple_size<Tuple>::value>
+struct single_argument{
+    template<typename Archive>
+    static void load(Archive &, Tuple &){
+        throw std::logic_error("a forwarded result can only be the argument of a function with one argument");
+    }
+};
+
+template <typename Tuple>
+struct single_argument<Tuple, 1>{
+    template<typename Archive>
+    static void load(Archive & archiver, Tuple & t){
+        archiver(std::get<0>(t));
+    }
+};
+
+
+// load each argument of a callable from its own serialized value
+template <typename Tuple, std::size_t Index = 0, bool Done = (Index == std::tuple_size<Tuple>::value)>
+struct separate_arguments{
+    static void load(const std::vector<std::vector<char> > & values, Tuple & t){
+        memory_istreambuf buffer(values[Index].data(), values[Index].size());
+        std::istream is(&buffer);
+        serializer::input_archiver archiver(is);
+        archiver(std::get<Index>(t));
+
+        separate_arguments<Tuple, Index +1>::load(values, t);
+    }
+};
+
+template <typename Tuple, std::size_t Index>
+struct separate_arguments<Tuple, Index, true>{
+    static void load(const std::vector<std::vector<char> > &, Tuple &){}
+};
+
+
 }
 
 
+///
+/// \brief serialize a single value, in the format of the results of the callables
+///
+template<typename T>
+inline std::vector<char> serialize_value(const T & value){
+    std::vector<char> res;
+    vector_ostreambuf buffer(res);
+    std::ostream os(&buffer);
+    {
+        serializer::output_archiver archiver(os);
+        archiver(value);
+    }
+    return res;
 }
 
+template<typename T>
+inline T deserialize_value(const std::vector<char> & data){
+    T value;
+    memory_istreambuf buffer(data.data(), data.size());
+    std::istream is(&buffer);
+
+    serializer::input_archiver archiver(is);
+    archiver(value);
+    return value;
+}
+
+
+///
+/// \brief durations of the steps of a server side call, in nanoseconds
+///
+struct call_timing{
+    call_timing() : deserialization(0), execution(0), serialization(0) {}
+
+    std::uint64_t deserialization;
+    std::uint64_t execution;
+    std::uint64_t serialization;
+};
+
+
+inline std::uint64_t steady_time_ns(){
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+///
+/// \brief client side information given by a remote_function with each request
+///
+struct request_context{
+    request_context() : serialization_begin(0), serialization_end(0), batch(false) {}
+
+    // timestamps of the argument serialization, steady clock in nanoseconds
+    std::uint64_t serialization_begin;
+    std::uint64_t serialization_end;
+
+    // the arguments are a sequence of calls, see callable_object::serialize_sequence
+    bool batch;
+};
+
+
+///
+/// \brief one call of a chain of forwarded calls
+///
+struct forward_stage{
+    int rank;
+    int callable_id;
+};
+
+
+///
+/// \brief calls where each result is the argument of the next call, sent from node to node
+///
+/// arguments are the serialized arguments of the first call
+///
+struct forward_chain{
+    std::vector<forward_stage> stages;
+    std::vector<char> arguments;
+};
+
 
 ///
 /// @brief interface to any remote callable object
@@ -89,36 +237,138 @@ public:
 
 
 
-    inline callable_object(){};
+    inline callable_object() : _compression(), _has_compression(false), _cache(), _deduplication(false), _deferred_deserialization(false) {};
     virtual ~callable_object(){};
 
     ///
-    /// function argument serializer
+    /// set compression options specific to this callable,
+    /// to do before any call
     ///
-    template<typename... Args>
-    inline std::vector<char> serialize(Args&&... args){
-        typedef typename std::tuple<Args...> type_tuple;
+    inline void set_compression(const compression_options & options){
+        _compression = options;
+        _has_compression = true;
+    }
 
+    ///
+    /// \return compression options of this callable, nullptr if it follows the service ones
+    ///
+    inline const compression_options* get_compression() const{
+        return _has_compression ? &_compression : nullptr;
+    }
+
+    ///
+    /// mark the callable as pure: its results only depend on its arguments
+    /// and are memoized on the local node
+    ///
+    inline void set_pure(const cache_options & options){
+        _cache.configure(options);
+    }
+
+    inline bool is_pure() const{
+        return _cache.enabled();
+    }
+
+    ///
+    /// \return results of the pure callable, indexed by the serialized arguments
+    ///
+    inline result_cache & get_cache(){
+        return _cache;
+    }
+
+    ///
+    /// identical calls in flight to the same node share their request,
+    /// to set before any call
+    ///
+    inline void set_deduplication(bool enable){
+        _deduplication = enable;
+    }
+
+    inline bool deduplicates() const{
+        return _deduplication;
+    }
+
+    ///
+    /// the futures of the calls keep the answer serialized,
+    /// decoded by the thread taking the result
+    ///
+    inline void set_deferred_deserialization(bool enable){
+        _deferred_deserialization = enable;
+    }
+
+    inline bool defers_deserialization() const{
+        return _deferred_deserialization;
+    }
+
+    ///
+    /// function argument serializer, the arguments are archived in place
+    ///
+    template<typename... Args>
+    inline std::vector<char> serialize(const Args &... args){
         using namespace serializer;
 
         std::vector<char> result;
+        vector_ostreambuf buffer(result);
+        std::ostream os(&buffer);
+        {
+            output_archiver archiver(os);
+            archive_values(archiver, args...);
+        }
+        return result;
+    }
 
-        std::ostringstream oss;
-
-        type_tuple func_arg(args...);
 
-        output_archiver archiver(oss);
 
-        archiver(func_arg);
+    ///
+    /// serializer of a sequence of calls, each element is the tuple of the arguments of a call
+    ///
+    template<typename Iterator>
+    inline std::vector<char> serialize_sequence(Iterator first, Iterator last){
+        using namespace serializer;
 
-        std::string res = oss.str();
-        return std::vector<char>(res.begin(), res.end());
+        std::vector<char> result;
+        vector_ostreambuf buffer(result);
+        std::ostream os(&buffer);
+        {
+            // in the format of a vector of the tuples
+            output_archiver archiver(os);
+            archiver(cereal::make_size_tag(static_cast<std::uint64_t>(std::distance(first, last))));
+            for(; first != last; ++first){
+                archiver(*first);
+            }
+        }
+        return result;
     }
 
+    ///
+    /// deserialize the arguments, execute the callable and serialize the result,
+    /// timing is filled if not null
+    ///
+    virtual std::vector<char> deserialize_and_call(const std::vector<char> & arguments, call_timing* timing = nullptr) = 0;
 
+    ///
+    /// same as deserialize_and_call for a sequence of calls serialized with serialize_sequence(),
+    /// the result is the vector of the results
+    ///
+    virtual std::vector<char> deserialize_batch_and_call(const std::vector<char> & arguments, call_timing* timing = nullptr) = 0;
 
-    virtual std::vector<char> deserialize_and_call(const std::vector<char> & arguments) = 0;
+    ///
+    /// same as deserialize_and_call, the only argument of the callable is given
+    /// as the serialized result of an other callable
+    ///
+    virtual std::vector<char> deserialize_result_and_call(const std::vector<char> & argument) = 0;
 
+    ///
+    /// same as deserialize_and_call, each argument is serialized on its own
+    /// with serialize_value(), as a result of an other callable
+    ///
+    virtual std::vector<char> deserialize_values_and_call(const std::vector<std::vector<char> > & arguments) = 0;
+
+private:
+    compression_options _compression;
+    bool _has_compression;
+    result_cache _cache;
+    bool _deduplication;
+    bool _deferred_deserialization;
 };
 
 
@@ -138,38 +388,110 @@ public:
 
     virtual ~remote_callable(){};
 
-    std::vector<char> serialize_result(result_type arg){
+    std::vector<char> serialize_result(const result_type & arg){
         using namespace serializer;
 
-        std::ostringstream oss;
-        output_archiver archiver(oss);
+        std::vector<char> res;
+        vector_ostreambuf buffer(res);
+        std::ostream os(&buffer);
+        {
+            output_archiver archiver(os);
+            archiver(arg);
+        }
+        return res;
+    }
+
+
+
+    virtual std::vector<char> deserialize_and_call(const std::vector<char> & arguments, call_timing* timing = nullptr){
+
+        using namespace serializer;
+
+        const std::uint64_t t_begin = (timing != nullptr) ? steady_time_ns() : 0;
+
+        memory_istreambuf buffer(arguments.data(), arguments.size());
+        std::istream is(&buffer);
+
+        type_tuple_no_ref func_arg;
+
+        input_archiver archiver(is);
+
+        archiver(func_arg);
+
+        const std::uint64_t t_call = (timing != nullptr) ? steady_time_ns() : 0;
 
-        archiver(arg);
+        result_type res_val = call_from_tuple(std::move(func_arg));
+
+        if(timing == nullptr){
+            return serialize_result(res_val);
+        }
 
-        std::string res = oss.str();
+        const std::uint64_t t_result = steady_time_ns();
+        std::vector<char> res = serialize_result(res_val);
 
-        return std::vector<char>(res.begin(), res.end());
+        timing->deserialization = t_call - t_begin;
+        timing->execution = t_result - t_call;
+        timing->serialization = steady_time_ns() - t_result;
+        return res;
     }
 
+    virtual std::vector<char> deserialize_batch_and_call(const std::vector<char> & arguments, call_timing* timing = nullptr){
+        using namespace serializer;
+
+        const std::uint64_t t_begin = (timing != nullptr) ? steady_time_ns() : 0;
+
+        memory_istreambuf buffer(arguments.data(), arguments.size());
+        std::istream is(&buffer);
+
+        std::vector<type_tuple_no_ref> calls;
+        {
+            input_archiver archiver(is);
+            archiver(calls);
+        }
+
+        const std::uint64_t t_call = (timing != nullptr) ? steady_time_ns() : 0;
 
+        std::vector<result_type> results;
+        results.reserve(calls.size());
+        for(auto & call : calls){
+            results.push_back(call_from_tuple(std::move(call)));
+        }
 
-    virtual std::vector<char> deserialize_and_call(const std::vector<char> & arguments){
+        const std::uint64_t t_result = (timing != nullptr) ? steady_time_ns() : 0;
+        std::vector<char> res = serialize_value(results);
 
+        if(timing != nullptr){
+            timing->deserialization = t_call - t_begin;
+            timing->execution = t_result - t_call;
+            timing->serialization = steady_time_ns() - t_result;
+        }
+        return res;
+    }
+
+    virtual std::vector<char> deserialize_result_and_call(const std::vector<char> & argument){
         using namespace serializer;
 
-        std::string input_buffer(arguments.data(), arguments.size());
-        std::istringstream iss(input_buffer);
+        memory_istreambuf buffer(argument.data(), argument.size());
+        std::istream is(&buffer);
 
         type_tuple_no_ref func_arg;
 
-        input_archiver archiver(iss);
+        input_archiver archiver(is);
 
-        archiver(func_arg);
+        single_argument<type_tuple_no_ref>::load(archiver, func_arg);
 
+        return serialize_result(call_from_tuple(std::move(func_arg)));
+    }
 
-        result_type res_val = call_from_tuple(std::move(func_arg));
+    virtual std::vector<char> deserialize_values_and_call(const std::vector<std::vector<char> > & arguments){
+        if(arguments.size() != std::tuple_size<type_tuple_no_ref>::value){
+            throw std::logic_error("invalid number of arguments");
+        }
 
-        return serialize_result(res_val);
+        type_tuple_no_ref func_arg;
+        separate_arguments<type_tuple_no_ref>::load(arguments, func_arg);
+
+        return serialize_result(call_from_tuple(std::move(func_arg)));
     }
 
     inline result_type call_from_tuple(type_tuple_no_ref && func_arg){
@@ -180,11 +502,10 @@ public:
         using namespace serializer;
 
         result_type result;
-        std::string buffer(result_data.data(), result_data.size());
-
-        std::istringstream iss(buffer);
+        memory_istreambuf buffer(result_data.data(), result_data.size());
+        std::istream is(&buffer);
 
-        input_archiver archiver(iss);
+        input_archiver archiver(is);
 
         archiver(result);
 
@@ -206,6 +527,164 @@ public:
     virtual ~result_object() {}
     virtual bool add_result(const std::vector<char> & result) =0;
 
+    ///
+    /// same as add_result, the handler can keep the buffer of result
+    ///
+    virtual bool take_result(std::vector<char> && result){
+        return add_result(result);
+    }
+
+    ///
+    /// report the failure of the request on a remote node,
+    /// return true when the request is completed
+    ///
+    virtual bool add_exception(const std::string & error_msg) =0;
+
+};
+
+
+///
+/// \brief handler of a request whose result is a value serialized with serialize_value()
+///
+template<typename T>
+class value_result : public result_object{
+public:
+    value_result() : _prom() {}
+
+    bool add_result(const std::vector<char> & result) override{
+        _prom.set_value(deserialize_value<T>(result));
+        return true;
+    }
+
+    bool add_exception(const std::string & error_msg) override{
+        _prom.set_exception(std::make_exception_ptr(remote_error(error_msg)));
+        return true;
+    }
+
+    std::future<T> get_future(){
+        return _prom.get_future();
+    }
+
+private:
+    std::promise<T> _prom;
+};
+
+// the result of a void call is empty
+template<>
+class value_result<void> : public result_object{
+public:
+    value_result() : _prom() {}
+
+    bool add_result(const std::vector<char> &) override{
+        _prom.set_value();
+        return true;
+    }
+
+    bool add_exception(const std::string & error_msg) override{
+        _prom.set_exception(std::make_exception_ptr(remote_error(error_msg)));
+        return true;
+    }
+
+    std::future<void> get_future(){
+        return _prom.get_future();
+    }
+
+private:
+    std::promise<void> _prom;
+};
+
+
+///
+/// \brief result of a batched operation, completed by one part per destination
+///
+template<typename Result>
+class batch_state{
+public:
+    batch_state(std::size_t parts, Result && initial) :
+        _lock(),
+        _remaining(parts),
+        _error(),
+        _value(std::move(initial)),
+        _prom() {}
+
+    std::future<Result> get_future(){
+        return _prom.get_future();
+    }
+
+    /// merge the result of a part, merge is called with the lock held
+    template<typename Merge>
+    void complete(Merge && merge){
+        std::lock_guard<std::mutex> l(_lock);
+        merge(_value);
+        complete_one();
+    }
+
+    void fail(const std::string & error_msg){
+        std::lock_guard<std::mutex> l(_lock);
+        // the first error is reported once every part is completed
+        if(_error.empty()){
+            _error = error_msg;
+        }
+        complete_one();
+    }
+
+private:
+    void complete_one(){
+        _remaining -= 1;
+        if(_remaining == 0){
+            if(_error.empty()){
+                _prom.set_value(std::move(_value));
+            }else{
+                _prom.set_exception(std::make_exception_ptr(remote_error(_error)));
+            }
+        }
+    }
+
+    std::mutex _lock;
+    std::size_t _remaining;
+    std::string _error;
+    Result _value;
+    std::promise<Result> _prom;
+};
+
+
+///
+/// \brief handler of the request of one destination of a batched operation
+///
+template<typename Ret, typename Result>
+class batch_part : public result_object{
+public:
+    typedef std::function<Ret (const std::vector<char> &)> decode_function;
+    typedef std::function<void (Ret &&, Result &)> merge_function;
+
+    batch_part(const std::shared_ptr<batch_state<Result> > & state, const decode_function & decode, const merge_function & merge) :
+        _state(state),
+        _decode(decode),
+        _merge(merge) {}
+
+    bool add_result(const std::vector<char> & result) override{
+        Ret res;
+        try{
+            res = _decode(result);
+        }catch(std::exception & e){
+            _state->fail(e.what());
+            return true;
+        }
+        _state->complete([&](Result & value){
+            _merge(std::move(res), value);
+        });
+        return true;
+    }
+
+    bool add_exception(const std::string & error_msg) override{
+        _state->fail(error_msg);
+        return true;
+    }
+
+private:
+    std::shared_ptr<batch_state<Result> > _state;
+    decode_function _decode;
+    merge_function _merge;
 };
 
 
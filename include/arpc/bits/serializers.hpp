@@ -19,6 +19,10 @@
 **/
 
 
+#include <streambuf>
+#include <vector>
+#include <cstddef>
+
 #include <cereal/archives/portable_binary.hpp>
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
@@ -44,6 +48,46 @@ namespace serializer{
 }
 
 
+///
+/// \brief output stream buffer appending to a vector
+///
+/// the archives write directly in the message, without the copies of a std::ostringstream
+///
+class vector_ostreambuf : public std::streambuf{
+public:
+    explicit vector_ostreambuf(std::vector<char> & output) : _output(output) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override{
+        _output.insert(_output.end(), s, s + n);
+        return n;
+    }
+
+    int_type overflow(int_type c) override{
+        if(!traits_type::eq_int_type(c, traits_type::eof())){
+            _output.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+private:
+    std::vector<char> & _output;
+};
+
+
+///
+/// \brief input stream buffer reading a message in place
+///
+class memory_istreambuf : public std::streambuf{
+public:
+    memory_istreambuf(const char* data, std::size_t size){
+        // never written, get area only
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+
 
 } // internal
 
@@ -0,0 +1,86 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_COMPRESSION_HPP_
+#define _ARPC_COMPRESSION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace arpc {
+
+///
+/// \brief payload compression codecs
+///
+/// the availability of lz4 and zlib is detected at configure time
+///
+enum class compression_codec : std::uint8_t {
+    none = 0x00,
+    lz4 = 0x01,
+    zlib = 0x02,
+    /// fastest codec available in this build
+    best_available = 0xff
+};
+
+
+///
+/// \brief compression configuration of a service or of a remote_function
+///
+/// payloads smaller than threshold bytes are always sent uncompressed
+///
+struct compression_options{
+    static constexpr std::size_t default_threshold = 4096;
+
+    inline compression_options(compression_codec my_codec = compression_codec::none,
+                               std::size_t my_threshold = default_threshold) :
+        codec(my_codec),
+        threshold(my_threshold) {}
+
+    compression_codec codec;
+    std::size_t threshold;
+};
+
+
+///
+/// \return true if codec is supported by this build of arpc
+///
+bool is_codec_available(compression_codec codec);
+
+
+namespace internal{
+
+///
+/// \brief compress data with the codec selected by options
+///
+/// \return codec effectively used: none if data is under the threshold, if the codec is not available
+/// or if the compression does not reduce the payload size. In this case output is left untouched
+///
+compression_codec compress(const compression_options & options, const std::vector<char> & data, std::vector<char> & output);
+
+///
+/// \brief decompress a payload produced by compress() with codec
+///
+/// throw std::runtime_error on corrupted payload or unsupported codec
+///
+std::vector<char> decompress(compression_codec codec, const std::vector<char> & data);
+
+} // internal
+
+} // arpc
+
+#endif
@@ -0,0 +1,342 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_DISTRIBUTED_MAP_HPP_
+#define _ARPC_DISTRIBUTED_MAP_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "bits/open_hash_table.hpp"
+#include "bits/remote_callable.hpp"
+#include "execution_pool_mpi.hpp"
+#include "remote_function.hpp"
+
+namespace arpc {
+
+
+///
+/// \brief hash map partitioned over the nodes of an execution service
+///
+/// each key belongs to one node, chosen from its hash. An operation takes a batch
+/// of keys, groups them by node and sends a single message to each node; the keys
+/// of the local node are served directly. Each node stores its keys in an open
+/// addressing table.
+///
+/// the map is registered under name: every node has to create it, with the same
+/// name and update function, before receiving operations on it
+///
+/// \code
+///  distributed_map<std::string, int> counts(service, "word_counts");
+///  service.barrier();
+///  counts.update(words, std::vector<int>(words.size(), 1)).get();
+///  std::vector<int> values = counts.get(words).get();
+/// \endcode
+///
+template<typename K, typename V, typename Hash = std::hash<K> >
+class distributed_map{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+
+    /// combine an existing value with the one given to update()
+    typedef std::function<void (V & value, const V & delta)> update_function;
+
+    distributed_map(exec_service_mpi & service, const std::string & name,
+                    const update_function & update = [](V & value, const V & delta){ value += delta; }) :
+        _service(&service),
+        _shard(std::make_shared<shard>(update)),
+        _get(make_get(_shard)),
+        _put(make_put(_shard)),
+        _update(make_update(_shard)){
+        service.register_function(name + "::get", _get);
+        service.register_function(name + "::put", _put);
+        service.register_function(name + "::update", _update);
+    }
+
+    ///
+    /// \brief values of keys, missing for the absent ones
+    ///
+    std::future<std::vector<V> > get(const std::vector<K> & keys, const V & missing = V()){
+        std::vector<std::vector<std::size_t> > positions = partition(keys);
+
+        std::shared_ptr<internal::batch_state<std::vector<V> > > state =
+                std::make_shared<internal::batch_state<std::vector<V> > >(count_parts(positions), std::vector<V>(keys.size()));
+        std::future<std::vector<V> > res = state->get_future();
+
+        for_each_part(keys, positions, [&](int rank, std::vector<K> && part_keys, const std::vector<std::size_t> & part_positions){
+            auto merge = [part_positions](std::vector<V> && values, std::vector<V> & result){
+                for(std::size_t i = 0; i < part_positions.size() && i < values.size(); ++i){
+                    result[part_positions[i]] = std::move(values[i]);
+                }
+            };
+
+            if(rank == _service->rank()){
+                run_local(state, merge, [&](){ return _shard->get(part_keys, missing); });
+                return;
+            }
+
+            send_part(_get, rank, state, merge, part_keys, missing);
+        });
+
+        return res;
+    }
+
+    ///
+    /// \brief set the value of each key, the last one wins for duplicated keys
+    ///
+    /// \return number of keys inserted
+    ///
+    std::future<std::size_t> put(const std::vector<K> & keys, const std::vector<V> & values){
+        return modify(_put, &shard::put, keys, values);
+    }
+
+    ///
+    /// \brief combine deltas with the value of each key with the update function,
+    /// an absent key starts from a value initialized V
+    ///
+    /// \return number of keys inserted
+    ///
+    std::future<std::size_t> update(const std::vector<K> & keys, const std::vector<V> & deltas){
+        return modify(_update, &shard::update, keys, deltas);
+    }
+
+    /// node owning key
+    int owner(const K & key) const{
+        // high bits, the table of the owner uses the low ones
+        return int((internal::mix_hash(std::uint64_t(Hash()(key))) >> 32) % std::uint64_t(_service->size()));
+    }
+
+    /// number of keys stored on the local node
+    std::size_t local_size() const{
+        return _shard->size();
+    }
+
+private:
+    typedef remote_function<std::vector<V>, std::vector<K>, V> get_function;
+    typedef remote_function<std::size_t, std::vector<K>, std::vector<V> > modify_function;
+
+    distributed_map(const distributed_map &) = delete;
+
+    // keys of the local node, shared with the registered functions
+    class shard{
+    public:
+        explicit shard(const update_function & update) : _lock(), _table(), _update(update) {}
+
+        std::vector<V> get(const std::vector<K> & keys, const V & missing){
+            std::vector<V> res;
+            res.reserve(keys.size());
+
+            std::lock_guard<std::mutex> l(_lock);
+            for(const K & key : keys){
+                const V* value = _table.find(key);
+                res.push_back(value != nullptr ? *value : missing);
+            }
+            return res;
+        }
+
+        std::size_t put(const std::vector<K> & keys, const std::vector<V> & values){
+            check_sizes(keys, values);
+
+            std::size_t inserted = 0;
+            std::lock_guard<std::mutex> l(_lock);
+            for(std::size_t i = 0; i < keys.size(); ++i){
+                std::pair<V*, bool> entry = _table.insert(keys[i]);
+                *entry.first = values[i];
+                inserted += entry.second ? 1 : 0;
+            }
+            return inserted;
+        }
+
+        std::size_t update(const std::vector<K> & keys, const std::vector<V> & deltas){
+            check_sizes(keys, deltas);
+
+            std::size_t inserted = 0;
+            std::lock_guard<std::mutex> l(_lock);
+            for(std::size_t i = 0; i < keys.size(); ++i){
+                std::pair<V*, bool> entry = _table.insert(keys[i]);
+                _update(*entry.first, deltas[i]);
+                inserted += entry.second ? 1 : 0;
+            }
+            return inserted;
+        }
+
+        std::size_t size(){
+            std::lock_guard<std::mutex> l(_lock);
+            return _table.size();
+        }
+
+    private:
+        static void check_sizes(const std::vector<K> & keys, const std::vector<V> & values){
+            if(keys.size() != values.size()){
+                throw std::invalid_argument("distributed_map: different number of keys and values");
+            }
+        }
+
+        std::mutex _lock;
+        internal::open_hash_table<K, V, Hash> _table;
+        update_function _update;
+    };
+
+    static std::function<std::vector<V> (std::vector<K>, V)> make_get(const std::shared_ptr<shard> & s){
+        return ([s](std::vector<K> keys, V missing){
+            return s->get(keys, missing);
+        });
+    }
+
+    static std::function<std::size_t (std::vector<K>, std::vector<V>)> make_put(const std::shared_ptr<shard> & s){
+        return ([s](std::vector<K> keys, std::vector<V> values){
+            return s->put(keys, values);
+        });
+    }
+
+    static std::function<std::size_t (std::vector<K>, std::vector<V>)> make_update(const std::shared_ptr<shard> & s){
+        return ([s](std::vector<K> keys, std::vector<V> deltas){
+            return s->update(keys, deltas);
+        });
+    }
+
+    std::future<std::size_t> modify(modify_function & fun, std::size_t (shard::*local)(const std::vector<K> &, const std::vector<V> &),
+                                    const std::vector<K> & keys, const std::vector<V> & values){
+        if(keys.size() != values.size()){
+            throw std::invalid_argument("distributed_map: different number of keys and values");
+        }
+
+        std::vector<std::vector<std::size_t> > positions = partition(keys);
+
+        std::shared_ptr<internal::batch_state<std::size_t> > state =
+                std::make_shared<internal::batch_state<std::size_t> >(count_parts(positions), std::size_t(0));
+        std::future<std::size_t> res = state->get_future();
+
+        auto merge = [](std::size_t && inserted, std::size_t & result){
+            result += inserted;
+        };
+
+        for_each_part(keys, positions, [&](int rank, std::vector<K> && part_keys, const std::vector<std::size_t> & part_positions){
+            std::vector<V> part_values;
+            part_values.reserve(part_positions.size());
+            for(std::size_t pos : part_positions){
+                part_values.push_back(values[pos]);
+            }
+
+            if(rank == _service->rank()){
+                run_local(state, merge, [&](){ return ((*_shard).*local)(part_keys, part_values); });
+                return;
+            }
+
+            send_part(fun, rank, state, merge, part_keys, part_values);
+        });
+
+        return res;
+    }
+
+    // positions of the keys of each node, in the order of keys
+    std::vector<std::vector<std::size_t> > partition(const std::vector<K> & keys) const{
+        std::vector<std::vector<std::size_t> > positions(std::size_t(_service->size()));
+        for(std::size_t i = 0; i < keys.size(); ++i){
+            positions[std::size_t(owner(keys[i]))].push_back(i);
+        }
+        return positions;
+    }
+
+    static std::size_t count_parts(const std::vector<std::vector<std::size_t> > & positions){
+        std::size_t parts = 0;
+        for(const auto & p : positions){
+            parts += p.empty() ? 0 : 1;
+        }
+        // an empty batch completes immediately
+        return std::max<std::size_t>(parts, 1);
+    }
+
+    // the remote nodes first, the local part is run while they work
+    template<typename Fun>
+    void for_each_part(const std::vector<K> & keys, const std::vector<std::vector<std::size_t> > & positions, Fun && fun){
+        const int local_rank = _service->rank();
+        bool empty = true;
+
+        for(int i = 1; i <= int(positions.size()); ++i){
+            const int rank = (local_rank + i) % int(positions.size());
+            const std::vector<std::size_t> & part_positions = positions[std::size_t(rank)];
+            if(part_positions.empty()){
+                continue;
+            }
+            empty = false;
+
+            std::vector<K> part_keys;
+            part_keys.reserve(part_positions.size());
+            for(std::size_t pos : part_positions){
+                part_keys.push_back(keys[pos]);
+            }
+            fun(rank, std::move(part_keys), part_positions);
+        }
+
+        if(empty){
+            fun(local_rank, std::vector<K>(), std::vector<std::size_t>());
+        }
+    }
+
+    template<typename Result, typename Merge, typename Local>
+    static void run_local(const std::shared_ptr<internal::batch_state<Result> > & state, Merge && merge, Local && local){
+        try{
+            auto res = local();
+            state->complete([&](Result & value){
+                merge(std::move(res), value);
+            });
+        }catch(std::exception & e){
+            state->fail(e.what());
+        }
+    }
+
+    template<typename Ret, typename... Args, typename Result, typename Merge, typename... Params>
+    void send_part(remote_function<Ret, Args...> & fun, int rank, const std::shared_ptr<internal::batch_state<Result> > & state,
+                   Merge && merge, Params &&... params){
+        typename remote_function<Ret, Args...>::callable_type* callable = fun._callable.get();
+
+        std::unique_ptr<internal::result_object> handler(new internal::batch_part<Ret, Result>(state,
+            [callable](const std::vector<char> & result){
+                return callable->deserialize_result(result);
+            },
+            std::forward<Merge>(merge)));
+
+        internal::request_context context;
+        context.serialization_begin = internal::steady_time_ns();
+        std::vector<char> args_serialized = callable->serialize(std::forward<Params>(params)...);
+        context.serialization_end = internal::steady_time_ns();
+
+        _service->send_request(rank, fun._callable_id, args_serialized, std::move(handler), context);
+    }
+
+    exec_service_mpi* _service;
+    std::shared_ptr<shard> _shard;
+    get_function _get;
+    modify_function _put;
+    modify_function _update;
+};
+
+
+} // arpc
+
+#endif
@@ -23,13 +23,43 @@
 #include <functional>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
 #include <mpi.h>
 
 #include "bits/remote_callable.hpp"
+#include "bits/function_id.hpp"
+#include "compression.hpp"
+#include "flow_control.hpp"
+#include "load_balancing.hpp"
+#include "progress.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
 
 namespace arpc {
 
+namespace internal{
+struct graph_description;
+class object_factory;
+class object_method;
+}
+
+
+///
+/// \brief use of MPI by an execution service
+///
+enum class threading_mode {
+    /// multiple if MPI provides MPI_THREAD_MULTIPLE, funneled otherwise
+    automatic,
+    /// every thread of the service calls MPI, requires MPI_THREAD_MULTIPLE
+    multiple,
+    /// only the progress thread of the service calls MPI, the other threads submit
+    /// their sends and collectives to it. Requires MPI_THREAD_SERIALIZED: the progress
+    /// thread is not the one initializing MPI, and the construction and the destruction
+    /// of the service call MPI from the calling thread
+    funneled
+};
+
 
 ///
 /// \brief The exec_service_mpi class
@@ -39,12 +69,35 @@ namespace arpc {
 class exec_service_mpi{
     class pimpl;
 public:
+    /// operations on a remote object, see remote_object
+    enum class object_operation : std::uint8_t {
+        create = 0,
+        call = 1,
+        destroy = 2
+    };
+
     ///
     /// \brief construct an execution service for arpc with the MPI backend
     /// \param argc
     /// \param argv
+    /// \param mode
+    ///
+    exec_service_mpi(int* argc, char*** argv, threading_mode mode = threading_mode::automatic);
+
+    ///
+    /// \brief construct an execution service for arpc on an existing communicator
+    ///
+    /// MPI has to be already initialized by the application, with MPI_THREAD_MULTIPLE
+    /// or with MPI_THREAD_SERIALIZED for the funneled mode. In funneled mode, the application
+    /// must not call MPI while the service runs, see barrier().
+    /// The communicator is duplicated: the arpc traffic is isolated from the application one
+    /// and several services can run concurrently in the same process, each one with its own
+    /// progress engine. This call is collective over comm
     ///
-    exec_service_mpi(int* argc, char*** argv);
+    /// \param comm
+    /// \param mode
+    ///
+    explicit exec_service_mpi(MPI_Comm comm, threading_mode mode = threading_mode::automatic);
 
     ///
     /// \brief ~exec_service_mpi
@@ -64,21 +117,165 @@ public:
         fun._pool = this;
     }
 
+    ///
+    /// \brief register a new remote_function in this execution service under a name
+    ///
+    /// The function identifier is derived from the name with arpc::function_id():
+    /// registration is local, does not involve any collective and can be done in any order.
+    /// A function has to be registered on a node before this node receives calls to it.
+    ///
+    template < typename Fun>
+    inline void register_function(const std::string & function_name, Fun & fun){
+        fun._callable_id =  register_function_internal(function_name, fun._callable);
+        fun._pool = this;
+    }
+
+    ///
+    /// \param function_name
+    /// \return identifier of a function registered under function_name
+    ///
+    /// throw std::out_of_range if no function is registered with this name
+    ///
+    int resolve_function(const std::string & function_name);
+
+    ///
+    /// \brief barrier over the service communicator, served by the service in funneled mode
+    ///
+    void barrier();
+
+    ///
+    /// \return true if only the progress thread of the service calls MPI
+    ///
+    bool is_funneled() const;
+
     ///
     /// \param node_id
     /// return true if node_id is the one of the local node
     ///
     bool is_local(int node_id);
 
+    ///
+    /// \brief set the default payload compression of this service
+    ///
+    /// apply to every request and answer of the functions without their own
+    /// compression options. Disabled by default. Can be changed while the service
+    /// runs, the messages already being compressed keep the previous options
+    ///
+    void set_compression(const compression_options & options);
+
+    ///
+    /// \brief enable the credit based flow control of the requests
+    ///
+    /// each node advertises options.window, the number of outstanding requests it
+    /// accepts from each client. A client without credit for a destination applies
+    /// options.policy. Disabled by default.
+    ///
+    /// with backpressure_policy::block, a remote function calling an other remote
+    /// function can wait for a credit in an executor, which then serves no request
+    /// until the credit comes back. If the windows are not large enough for the
+    /// nested calls, the nodes can wait for each other forever: prefer the
+    /// would_block or queue policies for nested calls. Collective over the service communicator,
+    /// to call when no request is in flight
+    ///
+    void set_flow_control(const flow_control_options & options);
+
+    ///
+    /// \brief set the strategy of the progress thread between two incoming messages
+    ///
+    /// local to the node, can be changed at any time. progress_mode::busy_spin by default.
+    /// The parking modes add up to park_time to the latency of a request reaching an idle node
+    ///
+    void set_progress(const progress_options & options);
+
+    ///
+    /// \brief set the policy choosing the destination of the calls to any node of a set
+    ///
+    /// local to the node, balancing_policy::power_of_two by default
+    ///
+    void set_load_balancing(balancing_policy policy);
+
+    ///
+    /// \return the least loaded node of candidates according to the load balancing policy
+    ///
+    /// throw std::invalid_argument if candidates is empty or contains an invalid rank
+    ///
+    int select_node(const std::vector<int> & candidates);
+
+    ///
+    /// \return rank of the local node in the service communicator
+    ///
+    int rank() const;
+
+    ///
+    /// \return number of nodes in the service communicator
+    ///
+    int size() const;
+
+    ///
+    /// \brief snapshot of the metrics of this service on the local node
+    ///
+    /// merge the per thread counters, can be called at any time
+    ///
+    service_metrics get_metrics();
+
+    ///
+    /// \brief write the metrics of the local node in JSON format
+    ///
+    void dump_metrics(std::ostream & os);
+
+    ///
+    /// \brief enable or disable the tracing of the requests sent by this node
+    ///
+    /// a traced request records the timestamps of each of its steps on the client
+    /// and on the server. Disabled by default
+    ///
+    void enable_tracing(bool enable);
+
+    ///
+    /// \brief merge the traces of all the nodes in a Chrome trace file
+    ///
+    /// the clock offset of each node is estimated against the node 0, which writes
+    /// the file. The output can be loaded in chrome://tracing or Perfetto.
+    /// Collective over the service communicator
+    ///
+    void write_trace(const std::string & filename);
+
     ////
     ///  internal
     void send_request(int rank, int callable_id, const std::vector<char> & args_serialized,
-                       std::unique_ptr<internal::result_object> && result_handler);
+                       std::unique_ptr<internal::result_object> && result_handler,
+                       const internal::request_context & context = internal::request_context());
 
     ////
     ///  internal
     void send_request(std::vector<int> node_list, int callable_id, const std::vector<char> & args_serialized,
-                       std::unique_ptr<internal::result_object> && result_handler);
+                       std::unique_ptr<internal::result_object> && result_handler,
+                       const internal::request_context & context = internal::request_context());
+
+    ////
+    ///  internal, register the constructor of a remote class, return its identifier
+    int register_object_factory(const std::string & class_name, std::shared_ptr<internal::object_factory> factory);
+
+    ////
+    ///  internal, register a method of a remote class, return its identifier
+    int register_object_method(const std::string & method_name, std::shared_ptr<internal::object_method> method);
+
+    ////
+    ///  internal, identifier of a new object unique over all the nodes
+    std::uint64_t new_object_id();
+
+    ////
+    ///  internal, operation sequence of the object object_id, id is the one of the class or of the method
+    void send_object_operation(int rank, std::uint64_t object_id, std::uint64_t sequence, object_operation operation, int id,
+                               const std::vector<char> & arguments, std::unique_ptr<internal::result_object> && result_handler);
+
+    ////
+    ///  internal, outputs has one entry per call, null if its result is not requested
+    void send_graph(const internal::graph_description & graph, std::vector<std::unique_ptr<internal::result_object> > & outputs);
+
+    ////
+    ///  internal
+    void send_forward(const internal::forward_chain & chain, std::unique_ptr<internal::result_object> && result_handler);
 
 private:
     std::unique_ptr<pimpl> d_ptr;
@@ -87,6 +284,8 @@ private:
 
     int register_function_internal(std::shared_ptr<internal::callable_object>  callable);
 
+    int register_function_internal(const std::string & function_name, std::shared_ptr<internal::callable_object>  callable);
+
     std::shared_ptr<internal::callable_object> resolve_function_internal(const std::string & function_name);
 };
 
@@ -0,0 +1,149 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_FLOW_CONTROL_HPP_
+#define _ARPC_FLOW_CONTROL_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+namespace arpc {
+
+
+///
+/// \brief behaviour of a client without credit for a destination
+///
+enum class backpressure_policy {
+    /// the calling thread waits for a credit. A remote function calling an other
+    /// remote function waits in an executor: with windows too small for the nested
+    /// calls, the executors of every node can be blocked and the service deadlocks
+    block,
+    /// the call throws arpc::would_block
+    would_block,
+    /// the request is kept locally and sent when a credit comes back
+    queue
+};
+
+
+///
+/// \brief credit based flow control configuration of a service
+///
+/// window is the number of outstanding requests the local node accepts from each
+/// client, 0 for no limit. The windows are exchanged between the nodes: a client
+/// uses the window advertised by each destination. Each answer gives its credit back.
+///
+/// max_queued bounds the number of requests kept locally per destination with the
+/// queue policy, a request beyond it throws arpc::would_block
+///
+struct flow_control_options{
+    static constexpr std::size_t default_window = 256;
+    static constexpr std::size_t default_max_queued = 65536;
+
+    inline flow_control_options(std::size_t my_window = default_window,
+                                backpressure_policy my_policy = backpressure_policy::block,
+                                std::size_t my_max_queued = default_max_queued) :
+        window(my_window),
+        policy(my_policy),
+        max_queued(my_max_queued) {}
+
+    std::size_t window;
+    backpressure_policy policy;
+    std::size_t max_queued;
+};
+
+
+///
+/// \brief thrown by a call when the destination has no credit left
+/// and the policy is backpressure_policy::would_block
+///
+class would_block : public std::runtime_error{
+public:
+    inline explicit would_block(const std::string & msg) : std::runtime_error(msg) {}
+};
+
+
+namespace internal{
+
+
+///
+/// \brief client side credits, one window per destination
+///
+class credit_window{
+public:
+    typedef std::function<void ()> deferred_send;
+
+    credit_window();
+
+    inline bool enabled() const{
+        return _enabled.load(std::memory_order_acquire);
+    }
+
+    ///
+    /// \brief install policy and the windows advertised by every destination
+    ///
+    void configure(const flow_control_options & options, const std::vector<std::size_t> & windows);
+
+    ///
+    /// \brief take one credit for each destination of node_list
+    ///
+    /// \return the destinations the request can be sent to now. For the others
+    /// the send produced by make_deferred(destination) is queued with the queue policy
+    ///
+    /// with the block policy, wait until every destination has a credit then take
+    /// them all: no credit is held while waiting
+    ///
+    /// throw would_block with the would_block policy, nothing is taken in this case
+    ///
+    std::vector<int> acquire(const std::vector<int> & node_list, const std::function<deferred_send (int)> & make_deferred);
+
+    ///
+    /// \brief an answer came back from destination
+    ///
+    /// \return a queued send which inherits the credit, empty if none
+    ///
+    deferred_send release(int destination);
+
+    /// number of requests waiting for a credit
+    std::size_t queued();
+
+private:
+    // to call with _lock held
+    bool has_credit(int destination) const;
+
+    std::atomic<bool> _enabled;
+    std::mutex _lock;
+    std::condition_variable _cond;
+    flow_control_options _options;
+    std::vector<std::size_t> _windows;
+    std::vector<std::size_t> _in_flight;
+    std::vector<std::deque<deferred_send> > _pending;
+    std::size_t _n_pending;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
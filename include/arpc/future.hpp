@@ -0,0 +1,471 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_FUTURE_HPP_
+#define _ARPC_FUTURE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "bits/object_pool.hpp"
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief block while word is equal to expected, can wake up spuriously
+///
+void futex_wait(std::atomic<std::uint32_t> & word, std::uint32_t expected);
+
+///
+/// \brief same as futex_wait, return after timeout at the latest
+///
+void futex_wait_for(std::atomic<std::uint32_t> & word, std::uint32_t expected, std::chrono::nanoseconds timeout);
+
+///
+/// \brief wake up all the threads waiting on word
+///
+void futex_wake_all(std::atomic<std::uint32_t> & word);
+
+
+///
+/// \brief shared state of an arpc::future, allocated from a pool
+///
+/// the value is stored in the state itself. The completion is a single atomic
+/// transition of the status word, the waiters sleep on it with a futex and
+/// are only woken up if they exist. Reference counted by the future and the promise
+///
+/// the result can also be kept serialized, it is then decoded by the thread taking it
+///
+template<typename T>
+class future_state : public pooled_allocation<future_state<T> >{
+public:
+    typedef T (*decoder_type)(const std::vector<char> &);
+
+    future_state() : _refs(1), _status(status_pending), _storage(), _serialized(), _decode(nullptr), _error(), _continuation() {}
+
+    ~future_state(){
+        if((_status.load(std::memory_order_relaxed) & status_mask) == status_value){
+            value_ptr()->~T();
+        }
+    }
+
+    inline void add_ref(){
+        _refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void release(){
+        if(_refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            delete this;
+        }
+    }
+
+    template<typename Value>
+    void set_value(Value && value){
+        new (&_storage) T(std::forward<Value>(value));
+        complete(status_value);
+    }
+
+    /// keep the serialized result, decode() is called on take()
+    void set_serialized(std::vector<char> && data, decoder_type decode){
+        _serialized = std::move(data);
+        _decode = decode;
+        complete(status_serialized);
+    }
+
+    void set_exception(std::exception_ptr error){
+        _error = error;
+        complete(status_error);
+    }
+
+    inline bool ready() const{
+        return (_status.load(std::memory_order_acquire) & status_mask) != status_pending;
+    }
+
+    void wait(){
+        for(int i = 0; i < spin_budget; ++i){
+            if(ready()){
+                return;
+            }
+        }
+
+        std::uint32_t status = _status.load(std::memory_order_acquire);
+        while((status & status_mask) == status_pending){
+            if((status & flag_waiters) == 0
+                && _status.compare_exchange_weak(status, status | flag_waiters, std::memory_order_acq_rel) == false){
+                continue;
+            }
+            futex_wait(_status, status | flag_waiters);
+            status = _status.load(std::memory_order_acquire);
+        }
+    }
+
+    /// return true if the state is ready
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> & duration){
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + duration;
+
+        std::uint32_t status = _status.load(std::memory_order_acquire);
+        while((status & status_mask) == status_pending){
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if(now >= deadline){
+                return false;
+            }
+            if((status & flag_waiters) == 0
+                && _status.compare_exchange_weak(status, status | flag_waiters, std::memory_order_acq_rel) == false){
+                continue;
+            }
+            futex_wait_for(_status, status | flag_waiters, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now));
+            status = _status.load(std::memory_order_acquire);
+        }
+        return true;
+    }
+
+    /// wait for the result and move it out, rethrow the error
+    T take(){
+        wait();
+        const std::uint32_t status = _status.load(std::memory_order_acquire) & status_mask;
+        if(status == status_error){
+            std::rethrow_exception(_error);
+        }
+        if(status == status_serialized){
+            return _decode(_serialized);
+        }
+        return std::move(*value_ptr());
+    }
+
+    /// wait for the result and move out its serialized form, rethrow the error
+    std::vector<char> take_serialized(){
+        wait();
+        const std::uint32_t status = _status.load(std::memory_order_acquire) & status_mask;
+        if(status == status_error){
+            std::rethrow_exception(_error);
+        }
+        if(status != status_serialized){
+            throw std::logic_error("the result of this future is not kept serialized");
+        }
+        return std::move(_serialized);
+    }
+
+    ///
+    /// \brief run fun once the state is ready, immediately if it is already
+    ///
+    /// fun is run by the thread completing the state and can release it.
+    /// To call at most once
+    ///
+    void on_completion(std::function<void ()> && fun){
+        _continuation = std::move(fun);
+
+        std::uint32_t status = _status.load(std::memory_order_acquire);
+        while((status & status_mask) == status_pending){
+            if(_status.compare_exchange_weak(status, status | flag_continuation, std::memory_order_acq_rel)){
+                return;
+            }
+        }
+
+        std::function<void ()> continuation = std::move(_continuation);
+        continuation();
+    }
+
+private:
+    future_state(const future_state &) = delete;
+
+    static constexpr std::uint32_t status_pending = 0;
+    static constexpr std::uint32_t status_value = 1;
+    static constexpr std::uint32_t status_error = 2;
+    static constexpr std::uint32_t status_serialized = 3;
+    static constexpr std::uint32_t status_mask = 3;
+    static constexpr std::uint32_t flag_waiters = 4;
+    static constexpr std::uint32_t flag_continuation = 8;
+
+    // most answers arrive within a few microseconds
+    static constexpr int spin_budget = 128;
+
+    inline T* value_ptr(){
+        return reinterpret_cast<T*>(&_storage);
+    }
+
+    void complete(std::uint32_t result){
+        const std::uint32_t previous = _status.fetch_or(result, std::memory_order_acq_rel);
+        if((previous & status_mask) != status_pending){
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        }
+
+        if(previous & flag_waiters){
+            futex_wake_all(_status);
+        }
+        // last, the continuation can release the state
+        if(previous & flag_continuation){
+            std::function<void ()> continuation = std::move(_continuation);
+            continuation();
+        }
+    }
+
+    std::atomic<std::uint32_t> _refs;
+    std::atomic<std::uint32_t> _status;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+    std::vector<char> _serialized;
+    decoder_type _decode;
+    std::exception_ptr _error;
+    std::function<void ()> _continuation;
+};
+
+
+template<typename T>
+class promise;
+
+
+} // internal
+
+
+///
+/// \brief result of an asynchronous call
+///
+/// same usage as std::future: move only, get() can be called once. The shared
+/// state comes from a pool and holds the value inline, a get() on a ready result
+/// neither locks nor allocates. Implicitly convertible to std::future, the
+/// conversion consumes the arpc::future
+///
+template<typename T>
+class future{
+public:
+    future() : _state(nullptr) {}
+
+    future(future && other) : _state(other._state){
+        other._state = nullptr;
+    }
+
+    future & operator=(future && other){
+        if(this != &other){
+            reset();
+            _state = other._state;
+            other._state = nullptr;
+        }
+        return *this;
+    }
+
+    ~future(){
+        reset();
+    }
+
+    inline bool valid() const{
+        return _state != nullptr;
+    }
+
+    /// true if the result is available, get() does not block
+    inline bool ready() const{
+        check_valid();
+        return _state->ready();
+    }
+
+    void wait() const{
+        check_valid();
+        _state->wait();
+    }
+
+    template<typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period> & duration) const{
+        check_valid();
+        return _state->wait_for(duration) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    ///
+    /// \brief wait for the result and return it, rethrow the error of the call
+    ///
+    /// the future is not valid anymore after get()
+    ///
+    T get(){
+        check_valid();
+        state_guard guard(_state);
+        _state = nullptr;
+        return guard.state->take();
+    }
+
+    ///
+    /// \brief wait for the result and return it serialized, as sent by the remote node
+    ///
+    /// for the calls of a function with deferred deserialization, see
+    /// remote_function::set_deferred_deserialization, throw std::logic_error otherwise.
+    /// The bytes can be forwarded as they are, no decoding is done. The future is not valid anymore after get_raw()
+    ///
+    std::vector<char> get_raw(){
+        check_valid();
+        state_guard guard(_state);
+        _state = nullptr;
+        return guard.state->take_serialized();
+    }
+
+    ///
+    /// a deferred result is decoded by the thread completing the future
+    ///
+    operator std::future<T>(){
+        check_valid();
+        std::shared_ptr<std::promise<T> > prom = std::make_shared<std::promise<T> >();
+        std::future<T> res = prom->get_future();
+
+        internal::future_state<T>* state = _state;
+        _state = nullptr;
+        state->on_completion([state, prom](){
+            try{
+                prom->set_value(state->take());
+            }catch(...){
+                prom->set_exception(std::current_exception());
+            }
+            state->release();
+        });
+        return res;
+    }
+
+private:
+    future(const future &) = delete;
+    future & operator=(const future &) = delete;
+
+    explicit future(internal::future_state<T>* state) : _state(state) {}
+
+    struct state_guard{
+        explicit state_guard(internal::future_state<T>* s) : state(s) {}
+        ~state_guard(){
+            state->release();
+        }
+        internal::future_state<T>* state;
+    };
+
+    inline void check_valid() const{
+        if(_state == nullptr){
+            throw std::future_error(std::future_errc::no_state);
+        }
+    }
+
+    void reset(){
+        if(_state != nullptr){
+            _state->release();
+            _state = nullptr;
+        }
+    }
+
+    internal::future_state<T>* _state;
+
+    friend class internal::promise<T>;
+};
+
+
+namespace internal{
+
+
+///
+/// \brief producer side of an arpc::future
+///
+/// a promise destroyed without result breaks its future, as std::promise
+///
+template<typename T>
+class promise{
+public:
+    promise() : _state(new future_state<T>()), _retrieved(false), _satisfied(false) {}
+
+    promise(promise && other) : _state(other._state), _retrieved(other._retrieved), _satisfied(other._satisfied){
+        other._state = nullptr;
+    }
+
+    ~promise(){
+        if(_state != nullptr){
+            if(_satisfied == false){
+                _state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            _state->release();
+        }
+    }
+
+    future<T> get_future(){
+        if(_retrieved){
+            throw std::future_error(std::future_errc::future_already_retrieved);
+        }
+        _retrieved = true;
+        _state->add_ref();
+        return future<T>(_state);
+    }
+
+    template<typename Value>
+    void set_value(Value && value){
+        check_unsatisfied();
+        _state->set_value(std::forward<Value>(value));
+        _satisfied = true;
+    }
+
+    void set_serialized(std::vector<char> && data, typename future_state<T>::decoder_type decode){
+        check_unsatisfied();
+        _state->set_serialized(std::move(data), decode);
+        _satisfied = true;
+    }
+
+    void set_exception(std::exception_ptr error){
+        check_unsatisfied();
+        _state->set_exception(error);
+        _satisfied = true;
+    }
+
+private:
+    promise(const promise &) = delete;
+
+    inline void check_unsatisfied() const{
+        if(_satisfied){
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        }
+    }
+    promise & operator=(const promise &) = delete;
+
+    future_state<T>* _state;
+    bool _retrieved;
+    bool _satisfied;
+};
+
+
+template<typename T>
+constexpr std::uint32_t future_state<T>::status_pending;
+template<typename T>
+constexpr std::uint32_t future_state<T>::status_value;
+template<typename T>
+constexpr std::uint32_t future_state<T>::status_error;
+template<typename T>
+constexpr std::uint32_t future_state<T>::status_serialized;
+template<typename T>
+constexpr std::uint32_t future_state<T>::status_mask;
+template<typename T>
+constexpr std::uint32_t future_state<T>::flag_waiters;
+template<typename T>
+constexpr std::uint32_t future_state<T>::flag_continuation;
+template<typename T>
+constexpr int future_state<T>::spin_budget;
+
+
+} // internal
+
+} // arpc
+
+#endif
@@ -0,0 +1,98 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_LOAD_BALANCING_HPP_
+#define _ARPC_LOAD_BALANCING_HPP_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace arpc {
+
+
+///
+/// \brief choice of the destination of a call to any node of a set
+///
+/// the load of a node is estimated by the client: number of requests sent to it
+/// still waiting for an answer, plus the number of requests waiting for an executor
+/// it reported in its last answer
+///
+enum class balancing_policy {
+    /// least loaded of two nodes picked at random, cheap and robust to stale loads
+    power_of_two,
+    /// least loaded node of the set, ties broken at random
+    least_loaded
+};
+
+
+namespace internal{
+
+
+///
+/// \brief client side load estimation of every node of a service, thread safe
+///
+class load_tracker{
+public:
+    explicit load_tracker(std::size_t n_nodes);
+
+    /// a request is sent to node
+    inline void on_send(int node){
+        _nodes[std::size_t(node)].outstanding.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// an answer of node reported queue_depth waiting requests
+    inline void on_answer(int node, std::uint32_t queue_depth){
+        load_state & state = _nodes[std::size_t(node)];
+        state.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        state.queue_depth.store(queue_depth, std::memory_order_relaxed);
+    }
+
+    /// the load of node is known without message, for the local node
+    inline void set_queue_depth(int node, std::uint32_t queue_depth){
+        _nodes[std::size_t(node)].queue_depth.store(queue_depth, std::memory_order_relaxed);
+    }
+
+    std::uint64_t load(int node) const;
+
+    ///
+    /// \return the destination chosen in candidates with policy
+    ///
+    /// throw std::invalid_argument if candidates is empty or contains an unknown node
+    ///
+    int select(const std::vector<int> & candidates, balancing_policy policy) const;
+
+private:
+    struct load_state{
+        load_state() : outstanding(0), queue_depth(0) {}
+
+        std::atomic<std::int64_t> outstanding;
+        std::atomic<std::uint32_t> queue_depth;
+    };
+
+    std::unique_ptr<load_state[]> _nodes;
+    std::size_t _n_nodes;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
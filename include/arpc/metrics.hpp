@@ -0,0 +1,231 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_METRICS_HPP_
+#define _ARPC_METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+namespace arpc {
+
+
+///
+/// \brief latency histogram with power of two buckets, in nanoseconds
+///
+/// bucket i counts the values in [2^i, 2^(i+1))
+///
+struct latency_histogram{
+    static constexpr std::size_t n_buckets = 48;
+
+    latency_histogram();
+
+    void add(std::uint64_t value_ns);
+
+    void merge(const latency_histogram & other);
+
+    /// average value in nanoseconds, 0 if empty
+    double mean() const;
+
+    /// approximation by upper bucket bound of the quantile q in [0, 1], in nanoseconds
+    std::uint64_t percentile(double q) const;
+
+    std::array<std::uint64_t, n_buckets> buckets;
+    std::uint64_t count;
+    std::uint64_t sum;
+    std::uint64_t max;
+};
+
+
+///
+/// \brief counters of one remote function, on the local node
+///
+/// client side: calls_sent, calls_deduplicated, serialization, latency (end to end, from the request to the answer)
+/// server side: calls_received, queue_wait (from the reception to an executor), execution
+///
+struct function_metrics{
+    function_metrics();
+
+    void merge(const function_metrics & other);
+
+    std::uint64_t calls_sent;
+    /// calls merged with an identical call in flight, not sent
+    std::uint64_t calls_deduplicated;
+    std::uint64_t calls_received;
+    std::uint64_t errors;
+    std::uint64_t bytes_sent;
+    std::uint64_t bytes_received;
+    /// result cache of a pure function, client and server side
+    std::uint64_t cache_hits;
+    std::uint64_t cache_misses;
+
+    latency_histogram serialization;
+    latency_histogram queue_wait;
+    latency_histogram execution;
+    latency_histogram latency;
+};
+
+
+///
+/// \brief snapshot of the metrics of an execution service on the local node
+///
+struct service_metrics{
+    service_metrics();
+
+    int rank;
+    /// number of received requests waiting for an executor
+    std::size_t queue_depth;
+    /// number of requests sent by this node still waiting for an answer
+    std::size_t outstanding_requests;
+    /// number of requests kept locally waiting for a credit, see flow_control_options
+    std::size_t queued_requests;
+
+    /// per function id
+    std::map<int, function_metrics> functions;
+
+    ///
+    /// \brief write the snapshot in JSON format
+    ///
+    void to_json(std::ostream & os) const;
+};
+
+
+
+namespace internal{
+
+
+/// bucket of value_ns in a latency_histogram
+std::size_t latency_bucket(std::uint64_t value_ns);
+
+
+///
+/// \brief counter written by a single thread and read by any thread
+///
+class relaxed_counter{
+public:
+    inline relaxed_counter() : _value(0) {}
+
+    inline relaxed_counter & operator+=(std::uint64_t v){
+        // single writer: a plain load and store, no read-modify-write
+        _value.store(_value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        return *this;
+    }
+
+    inline void store_max(std::uint64_t v){
+        if(v > _value.load(std::memory_order_relaxed)){
+            _value.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    inline std::uint64_t load() const{
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+    relaxed_counter(const relaxed_counter &) = delete;
+
+    std::atomic<std::uint64_t> _value;
+};
+
+
+///
+/// \brief latency_histogram updated by a single thread
+///
+struct histogram_counters{
+    void add(std::uint64_t value_ns);
+
+    void merge_into(latency_histogram & res) const;
+
+    std::array<relaxed_counter, latency_histogram::n_buckets> buckets;
+    relaxed_counter count;
+    relaxed_counter sum;
+    relaxed_counter max;
+};
+
+
+///
+/// \brief function_metrics updated by a single thread, the cache statistics
+/// are taken from the cache itself
+///
+struct function_counters{
+    void merge_into(function_metrics & res) const;
+
+    relaxed_counter calls_sent;
+    relaxed_counter calls_deduplicated;
+    relaxed_counter calls_received;
+    relaxed_counter errors;
+    relaxed_counter bytes_sent;
+    relaxed_counter bytes_received;
+
+    histogram_counters serialization;
+    histogram_counters queue_wait;
+    histogram_counters execution;
+    histogram_counters latency;
+};
+
+
+///
+/// \brief thread local metrics storage of an execution service
+///
+/// each thread updates its own block without lock, blocks are only merged on snapshot
+///
+class metrics_registry{
+public:
+    struct thread_block{
+        /// counters of function_id, to call by the owner thread only
+        function_counters & counters(int function_id);
+
+        /// held to insert a function and to read the map from an other thread
+        std::mutex lock;
+        std::map<int, function_counters> functions;
+    };
+
+    metrics_registry();
+    ~metrics_registry();
+
+    /// block of the calling thread
+    thread_block & local();
+
+    /// merge all thread blocks
+    std::map<int, function_metrics> aggregate();
+
+    template<typename Fun>
+    inline void update(int function_id, Fun && fun){
+        fun(local().counters(function_id));
+    }
+
+private:
+    metrics_registry(const metrics_registry &) = delete;
+
+    const std::uint64_t uid;
+    std::mutex blocks_lock;
+    std::vector<std::shared_ptr<thread_block> > blocks;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
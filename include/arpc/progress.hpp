@@ -0,0 +1,144 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_PROGRESS_HPP_
+#define _ARPC_PROGRESS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace arpc {
+
+
+///
+/// \brief strategy of the progress thread of a service between two incoming messages
+///
+enum class progress_mode {
+    /// probe continuously, lowest latency, one core always busy
+    busy_spin,
+    /// probe spin_budget times then yield the core between the probes
+    spin_yield,
+    /// probe spin_budget times then sleep up to park_time between the probes.
+    /// Only the local calls wake a parked thread: a message from an other node
+    /// waits up to park_time more before being picked up
+    spin_park,
+    /// block in MPI_Probe. The CPU usage depends on the MPI implementation
+    blocking,
+    /// spin while messages arrive at a sustained rate, then yield, then park with
+    /// a backoff growing with the idle time up to park_time. Same added latency
+    /// as spin_park once parked
+    adaptive
+};
+
+
+///
+/// \brief progress configuration of a service, can be changed at any time
+///
+/// a parked progress thread is woken up by any request sent by the local node,
+/// the answer is expected soon
+///
+struct progress_options{
+    static constexpr std::uint32_t default_spin_budget = 2000;
+    /// the first message after an idle phase is picked up within about 50us
+    static constexpr std::chrono::microseconds::rep default_park_us = 50;
+    /// longer parks are reduced to this value
+    static constexpr std::chrono::microseconds::rep max_park_us = 1000;
+
+    inline progress_options(progress_mode my_mode = progress_mode::busy_spin,
+                            std::uint32_t my_spin_budget = default_spin_budget,
+                            std::chrono::microseconds my_park_time = std::chrono::microseconds(default_park_us)) :
+        mode(my_mode),
+        spin_budget(my_spin_budget),
+        park_time(my_park_time) {}
+
+    progress_mode mode;
+    /// number of empty probes before yielding or parking
+    std::uint32_t spin_budget;
+    /// maximum duration of a park, latency added to the incoming messages of an idle node.
+    /// Capped to max_park_us
+    std::chrono::microseconds park_time;
+};
+
+
+namespace internal{
+
+
+///
+/// \brief idle strategy of a progress thread
+///
+/// on_message() and on_idle() are called by the progress thread only,
+/// set_options() and notify() from any thread
+///
+class progress_waiter{
+public:
+    progress_waiter();
+
+    void set_options(const progress_options & options);
+
+    inline progress_mode mode() const{
+        return progress_mode(_mode.load(std::memory_order_relaxed));
+    }
+
+    /// a message has been received
+    void on_message();
+
+    /// the last probe was empty: spin, yield or park according to the mode
+    void on_idle();
+
+    /// local activity, wake up a parked progress thread
+    inline void notify(){
+        _activity.store(true);
+        if(_parked.load()){
+            std::lock_guard<std::mutex> l(_lock);
+            _cond.notify_one();
+        }
+    }
+
+    /// average interval between two messages, in nanoseconds
+    inline std::uint64_t mean_interval() const{
+        return _mean_interval;
+    }
+
+private:
+    void park(std::uint64_t duration_ns);
+
+    std::atomic<int> _mode;
+    std::atomic<std::uint32_t> _spin_budget;
+    std::atomic<std::uint64_t> _park_ns;
+
+    std::atomic<bool> _activity;
+    std::atomic<bool> _parked;
+    std::mutex _lock;
+    std::condition_variable _cond;
+
+    // progress thread state
+    std::uint32_t _idle_rounds;
+    std::uint64_t _idle_since;
+    std::uint64_t _last_message;
+    std::uint64_t _mean_interval;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
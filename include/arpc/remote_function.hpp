@@ -21,8 +21,19 @@
 #include <functional>
 #include <memory>
 #include <future>
-
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bits/object_pool.hpp"
 #include "bits/remote_callable.hpp"
+#include "future.hpp"
 
 
 struct arpc_unit_tests;
@@ -31,6 +42,39 @@ struct arpc_unit_tests;
 namespace arpc{
 
 class exec_service_mpi; 
+class task_graph;
+
+template<typename Ret, typename... Args>
+class remote_function;
+
+template<typename K, typename V, typename Hash>
+class distributed_map;
+
+
+///
+/// \brief result of a remote call, to forward as the argument of an other remote call
+///
+/// created by remote_function::remote(). Nothing is sent until the remote_result is
+/// given to a call: the first node then sends its result directly to the node of the
+/// next call, only the final result comes back to the caller
+///
+template<typename T>
+class remote_result{
+public:
+    typedef T value_type;
+
+private:
+    remote_result(const std::shared_ptr<const internal::forward_chain> & chain, exec_service_mpi* pool) :
+        _chain(chain),
+        _pool(pool) {}
+
+    std::shared_ptr<const internal::forward_chain> _chain;
+    exec_service_mpi* _pool;
+
+    template<typename R, typename... A>
+    friend class remote_function;
+};
+
 
 ///
 /// \brief remote_function
@@ -44,6 +88,8 @@ public:
 
     typedef Ret result_type;
     typedef internal::remote_callable<Ret, Args...> callable_type;
+    /// arguments of one call of batch()
+    typedef std::tuple<typename std::decay<Args>::type...> argument_tuple;
 
     remote_function(const std::function<Ret(Args...)> & function_object) :
         _callable(std::make_shared<internal::remote_callable<Ret, Args... > >(function_object)),
@@ -58,18 +104,274 @@ public:
     /// aynschronous call to the remote function in node node_id
     ///
     ///
-    std::future<result_type> operator()(int node_id, Args... args){
+    future<result_type> operator()(int node_id, const Args &... args){
         check_service_association();
-        return _execute_async(node_id, std::forward<Args>(args)...);
+        return _execute_async(node_id, args...);
     }
 
     ////
     /// asynchonous call of the remote function in the list of node
     /// node_list
     ///
-    std::future<std::vector<result_type>> operator()(const std::vector<int> & node_id, Args... args){
+    std::future<std::vector<result_type>> operator()(const std::vector<int> & node_id, const Args &... args){
         check_service_association();
-        return _execute_async_bulk(node_id, std::forward<Args>(args)...);
+        return _execute_async_bulk(node_id, args...);
+    }
+
+    ///
+    /// \brief describe a call of the remote function in node node_id, without sending it
+    ///
+    /// the result can be forwarded to an other call, see remote_result
+    ///
+    remote_result<result_type> remote(int node_id, const Args &... args){
+        check_service_association();
+        std::shared_ptr<internal::forward_chain> chain = std::make_shared<internal::forward_chain>();
+        chain->stages.push_back(internal::forward_stage{ node_id, _callable_id });
+        chain->arguments = _callable->serialize(args...);
+        return remote_result<result_type>(chain, _pool);
+    }
+
+    ///
+    /// \brief describe a call of the remote function in node node_id on the result of
+    /// an other call, without sending it
+    ///
+    /// the function must have a single argument of type Input
+    ///
+    template<typename Input>
+    remote_result<result_type> remote(int node_id, const remote_result<Input> & input){
+        return remote_result<result_type>(chain_with(node_id, input), _pool);
+    }
+
+    ///
+    /// \brief asynchronous call of the remote function in node node_id on the result of an
+    /// other call
+    ///
+    /// the calls of input are executed first, each node sending its result directly to the
+    /// next one. The function must have a single argument of type Input
+    ///
+    template<typename Input>
+    future<result_type> operator()(int node_id, const remote_result<Input> & input){
+        std::shared_ptr<internal::forward_chain> chain = chain_with(node_id, input);
+
+        std::unique_ptr<internal::result_object> result_handler(new class result_handler(_callable.get()));
+        auto future_result = static_cast<class result_handler*>(result_handler.get())->get_future();
+
+        _pool->send_forward(*chain, std::move(result_handler));
+        return future_result;
+    }
+
+    ///
+    /// asynchronous call of the remote function on one node of node_set,
+    /// chosen from the load of the nodes, see exec_service_mpi::set_load_balancing
+    ///
+    future<result_type> call_any(const std::vector<int> & node_set, const Args &... args){
+        check_service_association();
+        return _execute_async(_pool->select_node(node_set), args...);
+    }
+
+    ///
+    /// \brief asynchronous execution of a sequence of calls in node node_id
+    ///
+    /// the argument tuples of calls are sent in parts messages, each one executed by
+    /// an executor of the node: parts > 1 runs the calls in parallel. One answer per
+    /// part holds the results of its calls. The result has one entry per call, in the
+    /// order of calls, an error in a call fails the whole batch.
+    /// Batches are neither cached nor deduplicated
+    ///
+    std::future<std::vector<result_type>> batch(int node_id, const std::vector<argument_tuple> & calls, std::size_t parts = 1){
+        check_service_association();
+        if(parts == 0){
+            throw std::invalid_argument("batch() in 0 parts");
+        }
+
+        if(calls.empty()){
+            return std::async(std::launch::deferred, [](){
+                return std::vector<result_type>();
+            });
+        }
+
+        const std::size_t part_size = (calls.size() + parts -1) / parts;
+        const std::size_t n_parts = (calls.size() + part_size -1) / part_size;
+
+        typedef internal::batch_state<std::vector<result_type> > state_type;
+        std::shared_ptr<state_type> state = std::make_shared<state_type>(n_parts, std::vector<result_type>(calls.size()));
+        std::future<std::vector<result_type> > res = state->get_future();
+
+        callable_type* callable = _callable.get();
+        for(std::size_t offset = 0; offset < calls.size(); offset += part_size){
+            const std::size_t end = std::min(offset + part_size, calls.size());
+
+            if(_pool->is_local(node_id)){
+                try{
+                    std::vector<result_type> results;
+                    results.reserve(end - offset);
+                    for(std::size_t i = offset; i < end; ++i){
+                        results.push_back(callable->call_from_tuple(typename callable_type::type_tuple_no_ref(calls[i])));
+                    }
+                    state->complete([&](std::vector<result_type> & all){
+                        std::move(results.begin(), results.end(), all.begin() + std::ptrdiff_t(offset));
+                    });
+                }catch(std::exception & e){
+                    state->fail(e.what());
+                }
+            }else{
+                internal::request_context context;
+                context.batch = true;
+                context.serialization_begin = internal::steady_time_ns();
+                std::vector<char> args_serialized = callable->serialize_sequence(calls.begin() + std::ptrdiff_t(offset),
+                                                                                 calls.begin() + std::ptrdiff_t(end));
+                context.serialization_end = internal::steady_time_ns();
+
+                std::unique_ptr<internal::result_object> result_handler(new internal::batch_part<std::vector<result_type>, std::vector<result_type> >(state,
+                    [](const std::vector<char> & result){
+                        return internal::deserialize_value<std::vector<result_type> >(result);
+                    },
+                    [offset](std::vector<result_type> && results, std::vector<result_type> & all){
+                        std::move(results.begin(), results.end(), all.begin() + std::ptrdiff_t(offset));
+                    }));
+
+                _pool->send_request(node_id, _callable_id, args_serialized, std::move(result_handler), context);
+            }
+        }
+
+        return res;
+    }
+
+    ///
+    /// \brief scatter input in chunks over the nodes of node_list and gather the result of each chunk
+    ///
+    /// input is split in chunks of chunk_size elements, the last one can be smaller. Each chunk
+    /// is the argument of one call, the chunks are given to the nodes of node_list in turn and
+    /// all sent without waiting: the chunks of a node are pipelined. The chunks of the local node
+    /// run on the calling thread once the others are sent.
+    ///
+    /// the function must have a single argument, constructible from two iterators of input.
+    /// The result has one entry per chunk, in the order of input
+    ///
+    template<typename Range>
+    std::future<std::vector<result_type>> map(const std::vector<int> & node_list, const Range & input, std::size_t chunk_size){
+        static_assert(sizeof...(Args) == 1, "map() needs a function with a single argument");
+        typedef typename std::decay<typename std::tuple_element<0, std::tuple<Args..., void> >::type>::type chunk_type;
+        typedef decltype(std::begin(input)) iterator;
+
+        check_service_association();
+        if(chunk_size == 0){
+            throw std::invalid_argument("map() with a chunk size of 0");
+        }
+        if(node_list.empty()){
+            throw std::invalid_argument("map() on an empty list of nodes");
+        }
+
+        iterator it = std::begin(input);
+        const std::size_t n_elems = std::size_t(std::distance(it, std::end(input)));
+        const std::size_t n_chunks = (n_elems + chunk_size -1) / chunk_size;
+
+        typedef internal::batch_state<std::vector<result_type> > state_type;
+        std::shared_ptr<state_type> state = std::make_shared<state_type>(std::max<std::size_t>(n_chunks, 1), std::vector<result_type>(n_chunks));
+        std::future<std::vector<result_type> > res = state->get_future();
+        if(n_chunks == 0){
+            state->complete([](std::vector<result_type> &){});
+            return res;
+        }
+
+        callable_type* callable = _callable.get();
+        std::vector<std::pair<std::size_t, std::pair<iterator, iterator> > > local_chunks;
+
+        for(std::size_t i = 0; i < n_chunks; ++i){
+            iterator chunk_end = it;
+            std::advance(chunk_end, std::min(chunk_size, n_elems - i * chunk_size));
+
+            const int rank = node_list[i % node_list.size()];
+            if(_pool->is_local(rank)){
+                local_chunks.push_back(std::make_pair(i, std::make_pair(it, chunk_end)));
+            }else{
+                internal::request_context context;
+                context.serialization_begin = internal::steady_time_ns();
+                std::vector<char> args_serialized = callable->serialize(chunk_type(it, chunk_end));
+                context.serialization_end = internal::steady_time_ns();
+
+                std::unique_ptr<internal::result_object> result_handler(new internal::batch_part<result_type, std::vector<result_type> >(state,
+                    [callable](const std::vector<char> & result){
+                        return callable->deserialize_result(result);
+                    },
+                    [i](result_type && value, std::vector<result_type> & results){
+                        results[i] = std::move(value);
+                    }));
+
+                _pool->send_request(rank, _callable_id, args_serialized, std::move(result_handler), context);
+            }
+            it = chunk_end;
+        }
+
+        for(auto & chunk : local_chunks){
+            try{
+                result_type value = callable->call_from_tuple(typename callable_type::type_tuple_no_ref(chunk_type(chunk.second.first, chunk.second.second)));
+                state->complete([&](std::vector<result_type> & results){
+                    results[chunk.first] = std::move(value);
+                });
+            }catch(std::exception & e){
+                state->fail(e.what());
+            }
+        }
+
+        return res;
+    }
+
+    ///
+    /// \brief compress the arguments and the results of this function
+    ///
+    /// override the compression options of the service, to set before the first call.
+    /// The codec is recorded in each message, nodes do not need identical options
+    ///
+    void set_compression(const compression_options & options){
+        _callable->set_compression(options);
+    }
+
+    ///
+    /// \brief mark this function as pure: its result only depends on its arguments
+    ///
+    /// the results are memoized on the local node, by the client and by the server.
+    /// A call to a single node with arguments already seen is answered from the cache,
+    /// without any message. Bulk calls are always sent but served from the cache of
+    /// each destination. To set before the first call, a new call drops the cache
+    ///
+    void set_pure(const cache_options & options = cache_options()){
+        _callable->set_pure(options);
+    }
+
+    ///
+    /// \return hits and misses of the result cache of this function on the local node
+    ///
+    cache_stats get_cache_stats(){
+        return _callable->get_cache().stats();
+    }
+
+    /// drop the results memoized on the local node
+    void clear_cache(){
+        _callable->get_cache().clear();
+    }
+
+    ///
+    /// \brief merge the identical calls in flight
+    ///
+    /// a call to a node with the same arguments as a call still waiting for its
+    /// answer is not sent: it waits for the answer of the first one. Local and
+    /// bulk calls are not merged. To set before the first call
+    ///
+    void set_deduplication(bool enable = true){
+        _callable->set_deduplication(enable);
+    }
+
+    ///
+    /// \brief keep the answers serialized until their result is read
+    ///
+    /// the executor receiving an answer only moves its buffer in the future, the
+    /// result is decoded by the thread calling get(), or never if it is not read.
+    /// future::get_raw() gives the serialized answer. Only the single node calls
+    /// are concerned, to set before the first call
+    ///
+    void set_deferred_deserialization(bool enable = true){
+        _callable->set_deferred_deserialization(enable);
     }
 
 private:
@@ -81,24 +383,55 @@ private:
         }
     }
 
-    std::future<result_type> _execute_async(int rank, Args&&... args){
+    template<typename Input>
+    std::shared_ptr<internal::forward_chain> chain_with(int node_id, const remote_result<Input> & input){
+        static_assert(sizeof...(Args) == 1, "a forwarded result can only be the argument of a function with one argument");
+        static_assert(std::is_same<typename std::decay<Input>::type,
+                                   typename std::decay<typename std::tuple_element<0, std::tuple<Args..., void> >::type>::type>::value,
+                      "the forwarded result type differs from the argument type");
+
+        check_service_association();
+        if(input._pool != _pool){
+            throw std::runtime_error("a forwarded result has to come from the same service");
+        }
+
+        std::shared_ptr<internal::forward_chain> chain = std::make_shared<internal::forward_chain>(*input._chain);
+        chain->stages.push_back(internal::forward_stage{ node_id, _callable_id });
+        return chain;
+    }
+
+    // the arguments are archived in place, never copied
+    future<result_type> _execute_async(int rank, const Args &... args){
 
         // if request is local to node, execute directly
         if(_pool->is_local(rank)){
-            return _execute_async_local_serialize(std::forward<Args>(args)...);
+            return _execute_async_local_serialize(args...);
         }else{
+            internal::request_context context;
+            context.serialization_begin = internal::steady_time_ns();
             std::vector<char> args_serialized = _callable->serialize(args...);
+            context.serialization_end = internal::steady_time_ns();
+
+            const bool pure = _callable->is_pure();
+            std::vector<char> cached_result;
+            if(pure && _callable->get_cache().find(args_serialized, cached_result)){
+                return make_ready_future(std::move(cached_result));
+            }
+
             std::unique_ptr<internal::result_object> result_handler(new class result_handler(_callable.get()));
+            if(pure){
+                static_cast<class result_handler*>(result_handler.get())->set_cache_key(args_serialized);
+            }
 
             auto future_result = static_cast<class result_handler*>(result_handler.get())->get_future();
 
 
-            _pool->send_request(rank, _callable_id, args_serialized,  std::move(result_handler) );
+            _pool->send_request(rank, _callable_id, args_serialized,  std::move(result_handler), context);
             return future_result;
         }
     }
 
-    std::future<std::vector<result_type>> _execute_async_bulk(const std::vector<int> & node_list, Args&&... args){
+    std::future<std::vector<result_type>> _execute_async_bulk(const std::vector<int> & node_list, const Args &... args){
 
         // if request in empty return future with empty vector
         if(node_list.size() ==0){
@@ -107,12 +440,16 @@ private:
             });
         }
 
+        internal::request_context context;
+        context.serialization_begin = internal::steady_time_ns();
         std::vector<char> args_serialized = _callable->serialize(args...);
+        context.serialization_end = internal::steady_time_ns();
+
         std::unique_ptr<internal::result_object> result_handler(new class multi_result_handler(node_list.size(), _callable.get()));
 
         auto future_result = static_cast<class multi_result_handler*>(result_handler.get())->get_future();
 
-        _pool->send_request(node_list, _callable_id, args_serialized,  std::move(result_handler) );
+        _pool->send_request(node_list, _callable_id, args_serialized,  std::move(result_handler), context);
         return future_result;
 
     }
@@ -131,40 +468,108 @@ private:
         });
     }
 
-    inline std::future<result_type> _execute_async_local_serialize(Args... args){
+    inline future<result_type> _execute_async_local_serialize(const Args &... args){
+
+        internal::promise<result_type> prom;
+        future<result_type> fut = prom.get_future();
+
+        try{
+            std::vector<char> args_serialized = _callable->serialize(args... );
+            std::vector<char> res_serialized;
+            const bool pure = _callable->is_pure();
+            if(pure == false || _callable->get_cache().find(args_serialized, res_serialized) == false){
+                res_serialized = _callable->deserialize_and_call(args_serialized);
+                if(pure){
+                    _callable->get_cache().insert(args_serialized, res_serialized);
+                }
+            }
+            set_result(prom, std::move(res_serialized));
+        }catch(...){
+            prom.set_exception(std::current_exception());
+        }
+        return fut;
+    }
+
+    inline future<result_type> make_ready_future(std::vector<char> && res_serialized){
+        internal::promise<result_type> prom;
+        future<result_type> fut = prom.get_future();
 
-        std::vector<char> args_serialized = _callable->serialize(args... );
-        std::vector<char> res_serialized = _callable->deserialize_and_call(args_serialized);
+        try{
+            set_result(prom, std::move(res_serialized));
+        }catch(...){
+            prom.set_exception(std::current_exception());
+        }
+        return fut;
+    }
 
-        std::promise<result_type> prom;
-        std::future<result_type> fut = prom.get_future();
-        prom.set_value(_callable->deserialize_result(res_serialized));
-        return fut;;
+
+    static result_type decode_result(const std::vector<char> & res_serialized){
+        return internal::deserialize_value<result_type>(res_serialized);
     }
 
+    // decoded now, or by the consumer of the future with the deferred deserialization
+    void set_result(internal::promise<result_type> & prom, std::vector<char> && res_serialized){
+        if(_callable->defers_deserialization()){
+            prom.set_serialized(std::move(res_serialized), &decode_result);
+        }else{
+            prom.set_value(_callable->deserialize_result(res_serialized));
+        }
+    }
 
-    class result_handler : public internal::result_object{
+    // allocated from a pool, as the shared state of its future
+    class result_handler : public internal::result_object, public internal::pooled_allocation<result_handler>{
       public:
           result_handler(callable_type* callable) :
               _prom(),
-              _callable(callable) {}
-
+              _callable(callable),
+              _cached(false),
+              _cache_key() {}
+
+          /// memoize the result under key
+          void set_cache_key(const std::vector<char> & key){
+              _cached = true;
+              _cache_key = key;
+          }
 
           bool add_result(const std::vector<char> & result) override{
+              if(_callable->defers_deserialization()){
+                  return take_result(std::vector<char>(result));
+              }
               result_type res = _callable->deserialize_result(result);
+              if(_cached){
+                  _callable->get_cache().insert(_cache_key, result);
+              }
               _prom.set_value(std::move(res));
               return true;
           }
 
-          std::future<result_type> get_future(){
+          bool take_result(std::vector<char> && result) override{
+              if(_callable->defers_deserialization() == false){
+                  return add_result(result);
+              }
+              if(_cached){
+                  _callable->get_cache().insert(_cache_key, result);
+              }
+              _prom.set_serialized(std::move(result), &decode_result);
+              return true;
+          }
+
+          bool add_exception(const std::string & error_msg) override{
+              _prom.set_exception(std::make_exception_ptr(remote_error(error_msg)));
+              return true;
+          }
+
+          future<result_type> get_future(){
               return _prom.get_future();
           }
 
 
 
       private:
-          std::promise<result_type> _prom;
+          internal::promise<result_type> _prom;
           callable_type* _callable;
+          bool _cached;
+          std::vector<char> _cache_key;
       };
 
     class multi_result_handler : public internal::result_object{
@@ -173,6 +578,7 @@ private:
             _actors(actors),
             _res_mut(),
             _res(),
+            _error(),
             _prom(),
             _callable(callable) {}
 
@@ -181,22 +587,41 @@ private:
             {
                 std::unique_lock<std::mutex> _l(_res_mut);
                 _res.emplace_back(std::move(res));
-                _actors -=1;
-                if(_actors == 0){
-                    _prom.set_value(std::move(_res));
-                    return true;
-                }
-                return false;
+                return complete_one();
             }
         }
 
+        bool add_exception(const std::string & error_msg) override{
+            std::unique_lock<std::mutex> _l(_res_mut);
+            // the first error is reported once every node answered
+            if(_error.empty()){
+                _error = error_msg;
+            }
+            return complete_one();
+        }
+
         std::future<std::vector<result_type>> get_future(){
             return _prom.get_future();
         }
     private:
+        // to call with _res_mut held
+        bool complete_one(){
+            _actors -=1;
+            if(_actors == 0){
+                if(_error.empty()){
+                    _prom.set_value(std::move(_res));
+                }else{
+                    _prom.set_exception(std::make_exception_ptr(remote_error(_error)));
+                }
+                return true;
+            }
+            return false;
+        }
+
         std::size_t _actors;
         mutable std::mutex _res_mut;
         std::vector<result_type> _res;
+        std::string _error;
         std::promise<std::vector<result_type>> _prom;
         callable_type* _callable;
     };
@@ -207,6 +632,9 @@ private:
     exec_service_mpi* _pool;
 
     friend class exec_service_mpi;
+    friend class task_graph;
+    template<typename K, typename V, typename Hash>
+    friend class distributed_map;
     friend struct ::arpc_unit_tests;
 
 
@@ -0,0 +1,334 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_REMOTE_OBJECT_HPP_
+#define _ARPC_REMOTE_OBJECT_HPP_
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <cstdint>
+
+#include "bits/remote_callable.hpp"
+#include "execution_pool_mpi.hpp"
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief type erased constructor of the instances of a remote class
+///
+class object_factory{
+public:
+    virtual ~object_factory(){}
+
+    virtual std::shared_ptr<void> create(const std::vector<char> & arguments) = 0;
+};
+
+
+///
+/// \brief type erased member function of a remote class
+///
+class object_method{
+public:
+    virtual ~object_method(){}
+
+    /// deserialize the arguments, call the method on instance and serialize its result
+    virtual std::vector<char> call(void* instance, const std::vector<char> & arguments) = 0;
+};
+
+
+template<typename T, typename... CtorArgs>
+class typed_object_factory : public object_factory{
+public:
+    typedef std::tuple<typename std::decay<CtorArgs>::type...> type_tuple;
+
+    std::shared_ptr<void> create(const std::vector<char> & arguments) override{
+        type_tuple args = deserialize_value<type_tuple>(arguments);
+        return invoke_function<std::shared_ptr<T> >([](CtorArgs... ctor_args){
+            return std::make_shared<T>(ctor_args...);
+        }, std::move(args));
+    }
+};
+
+
+template<typename T, typename Ret, typename... Args>
+class typed_object_method : public object_method{
+public:
+    typedef std::tuple<typename std::decay<Args>::type...> type_tuple;
+
+    explicit typed_object_method(const std::function<Ret (T &, Args...)> & method) : _method(method) {}
+
+    std::vector<char> call(void* instance, const std::vector<char> & arguments) override{
+        return serialize_value(invoke(instance, arguments));
+    }
+
+private:
+    Ret invoke(void* instance, const std::vector<char> & arguments){
+        T & object = *static_cast<T*>(instance);
+        const std::function<Ret (T &, Args...)> & method = _method;
+        return invoke_function<Ret>([&object, &method](Args... args){
+            return method(object, args...);
+        }, deserialize_value<type_tuple>(arguments));
+    }
+
+    std::function<Ret (T &, Args...)> _method;
+};
+
+// a void method answers with an empty result
+template<typename T, typename... Args>
+class typed_object_method<T, void, Args...> : public object_method{
+public:
+    typedef std::tuple<typename std::decay<Args>::type...> type_tuple;
+
+    explicit typed_object_method(const std::function<void (T &, Args...)> & method) : _method(method) {}
+
+    std::vector<char> call(void* instance, const std::vector<char> & arguments) override{
+        T & object = *static_cast<T*>(instance);
+        const std::function<void (T &, Args...)> & method = _method;
+        invoke_function<void>([&object, &method](Args... args){
+            method(object, args...);
+        }, deserialize_value<type_tuple>(arguments));
+        return std::vector<char>();
+    }
+
+private:
+    std::function<void (T &, Args...)> _method;
+};
+
+
+///
+/// \brief client side state of a remote object, shared by the copies of its handle
+///
+struct object_handle_state{
+    object_handle_state(exec_service_mpi* my_service, int my_rank, std::uint64_t my_id) :
+        service(my_service),
+        rank(my_rank),
+        id(my_id),
+        lock(),
+        sequence(0),
+        destroyed(false),
+        created() {}
+
+    exec_service_mpi* service;
+    int rank;
+    std::uint64_t id;
+    // no operation can be numbered after the destruction
+    std::mutex lock;
+    // order of the operations on the object, 0 is the construction
+    std::uint64_t sequence;
+    bool destroyed;
+    std::shared_future<void> created;
+};
+
+
+} // internal
+
+
+template<typename T>
+class remote_object;
+
+template<typename T, typename... CtorArgs>
+class remote_class;
+
+
+///
+/// \brief member function of a remote class, see remote_class::method()
+///
+template<typename T, typename Ret, typename... Args>
+class remote_method{
+public:
+    remote_method() : _id(0) {}
+
+    inline int id() const{
+        return _id;
+    }
+
+private:
+    explicit remote_method(int my_id) : _id(my_id) {}
+
+    int _id;
+
+    template<typename U, typename... CtorArgs>
+    friend class remote_class;
+};
+
+
+///
+/// \brief handle on an instance of T living on a remote node
+///
+/// the operations on an object run in their submission order, one at a time:
+/// T does not need any synchronization. The handle can be copied, it is only
+/// valid on the node which created the object. The object lives until destroy()
+/// or the end of the service
+///
+template<typename T>
+class remote_object{
+public:
+    remote_object() : _state() {}
+
+    inline bool valid() const{
+        return _state != nullptr;
+    }
+
+    /// node of the object
+    inline int rank() const{
+        check_valid();
+        return _state->rank;
+    }
+
+    /// ready when the object is constructed, holds the error of the construction
+    inline std::shared_future<void> created() const{
+        check_valid();
+        return _state->created;
+    }
+
+    ///
+    /// \brief asynchronous call of method on the object
+    ///
+    template<typename Ret, typename... Args, typename... Params>
+    std::future<Ret> call(const remote_method<T, Ret, Args...> & method, Params&&... params){
+        static_assert(sizeof...(Args) == sizeof...(Params), "invalid number of arguments");
+
+        std::tuple<typename std::decay<Args>::type...> arguments(std::forward<Params>(params)...);
+        std::unique_ptr<internal::value_result<Ret> > handler(new internal::value_result<Ret>());
+        std::future<Ret> res = handler->get_future();
+        send(object_operation::call, method.id(), internal::serialize_value(arguments), std::move(handler));
+        return res;
+    }
+
+    ///
+    /// \brief destroy the object after the operations already submitted
+    ///
+    std::future<void> destroy(){
+        std::unique_ptr<internal::value_result<void> > handler(new internal::value_result<void>());
+        std::future<void> res = handler->get_future();
+        send(object_operation::destroy, 0, std::vector<char>(), std::move(handler));
+        return res;
+    }
+
+private:
+    typedef exec_service_mpi::object_operation object_operation;
+
+    explicit remote_object(const std::shared_ptr<internal::object_handle_state> & state) : _state(state) {}
+
+    inline void check_valid() const{
+        if(_state == nullptr){
+            throw std::logic_error("invalid remote_object handle");
+        }
+    }
+
+    void send(object_operation operation, int id, const std::vector<char> & arguments, std::unique_ptr<internal::result_object> && handler){
+        check_valid();
+        std::uint64_t sequence = 0;
+        {
+            std::lock_guard<std::mutex> lock(_state->lock);
+            if(_state->destroyed){
+                throw std::logic_error("the remote object is destroyed");
+            }
+            sequence = _state->sequence++;
+            _state->destroyed = (operation == object_operation::destroy);
+        }
+        _state->service->send_object_operation(_state->rank, _state->id, sequence,
+                                               operation, id, arguments, std::move(handler));
+    }
+
+    std::shared_ptr<internal::object_handle_state> _state;
+
+    template<typename U, typename... CtorArgs>
+    friend class remote_class;
+};
+
+
+///
+/// \brief a class T whose instances can be created and used on the other nodes
+///
+/// the class and its methods are registered by name: every node has to declare
+/// the same remote_class and methods, in any order, before receiving calls to them
+///
+/// \code
+///  remote_class<counter, int> counter_class(service, "counter");
+///  auto add = counter_class.method("add", &counter::add);
+///  remote_object<counter> c = counter_class.create(1, 10);
+///  std::future<int> value = c.call(add, 5);
+/// \endcode
+///
+template<typename T, typename... CtorArgs>
+class remote_class{
+public:
+    remote_class(exec_service_mpi & service, const std::string & name) :
+        _service(&service),
+        _name(name),
+        _id(service.register_object_factory(name, std::make_shared<internal::typed_object_factory<T, CtorArgs...> >())) {}
+
+    ///
+    /// \brief register the member function method under name, in the scope of the class
+    ///
+    template<typename Ret, typename... Args>
+    remote_method<T, Ret, Args...> method(const std::string & name, Ret (T::*method)(Args...)){
+        return register_method<Ret, Args...>(name, std::function<Ret (T &, Args...)>(std::mem_fn(method)));
+    }
+
+    template<typename Ret, typename... Args>
+    remote_method<T, Ret, Args...> method(const std::string & name, Ret (T::*method)(Args...) const){
+        return register_method<Ret, Args...>(name, std::function<Ret (T &, Args...)>(std::mem_fn(method)));
+    }
+
+    ///
+    /// \brief create an instance of T on node rank
+    ///
+    /// the construction is asynchronous, the calls can be submitted immediately
+    ///
+    remote_object<T> create(int rank, const CtorArgs &... args){
+        std::shared_ptr<internal::object_handle_state> state =
+                std::make_shared<internal::object_handle_state>(_service, rank, _service->new_object_id());
+
+        std::tuple<const typename std::decay<CtorArgs>::type &...> arguments(args...);
+        std::unique_ptr<internal::value_result<void> > handler(new internal::value_result<void>());
+        state->created = handler->get_future().share();
+
+        remote_object<T> res(state);
+        res.send(exec_service_mpi::object_operation::create, _id, internal::serialize_value(arguments), std::move(handler));
+        return res;
+    }
+
+private:
+    template<typename Ret, typename... Args>
+    remote_method<T, Ret, Args...> register_method(const std::string & name, const std::function<Ret (T &, Args...)> & method){
+        const int id = _service->register_object_method(_name + "::" + name,
+                                                        std::make_shared<internal::typed_object_method<T, Ret, Args...> >(method));
+        return remote_method<T, Ret, Args...>(id);
+    }
+
+    exec_service_mpi* _service;
+    std::string _name;
+    int _id;
+};
+
+
+} // arpc
+
+#endif
@@ -0,0 +1,125 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_RESULT_CACHE_HPP_
+#define _ARPC_RESULT_CACHE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace arpc {
+
+
+///
+/// \brief memoization of the results of a pure remote function
+///
+/// at most capacity results are kept, the least recently used is evicted first.
+/// A result older than ttl is not used anymore, a zero ttl keeps the results
+/// until their eviction
+///
+struct cache_options{
+    static constexpr std::size_t default_capacity = 1024;
+
+    inline cache_options(std::size_t my_capacity = default_capacity,
+                         std::chrono::milliseconds my_ttl = std::chrono::milliseconds(0)) :
+        capacity(my_capacity),
+        ttl(my_ttl) {}
+
+    std::size_t capacity;
+    std::chrono::milliseconds ttl;
+};
+
+
+///
+/// \brief counters of a result cache on the local node
+///
+struct cache_stats{
+    cache_stats() : hits(0), misses(0), evictions(0), size(0) {}
+
+    std::uint64_t hits;
+    std::uint64_t misses;
+    /// entries removed because of the capacity or of the ttl
+    std::uint64_t evictions;
+    std::size_t size;
+};
+
+
+namespace internal{
+
+
+///
+/// \brief LRU map serialized arguments -> serialized result
+///
+/// the entries are indexed by a hash of the arguments, the arguments are
+/// compared on lookup. Thread safe
+///
+class result_cache{
+public:
+    result_cache();
+
+    inline bool enabled() const{
+        return _enabled.load(std::memory_order_acquire);
+    }
+
+    /// enable the cache, drop the current entries
+    void configure(const cache_options & options);
+
+    /// \return true and fill result if arguments have a valid entry
+    bool find(const std::vector<char> & arguments, std::vector<char> & result);
+
+    void insert(const std::vector<char> & arguments, const std::vector<char> & result);
+
+    void clear();
+
+    cache_stats stats();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct entry{
+        std::uint64_t hash;
+        std::vector<char> arguments;
+        std::vector<char> result;
+        clock::time_point expiry;
+    };
+
+    typedef std::list<entry> entry_list;
+
+    // to call with _lock held
+    void erase(entry_list::iterator it);
+
+    std::atomic<bool> _enabled;
+    std::mutex _lock;
+    cache_options _options;
+    // most recently used first
+    entry_list _entries;
+    std::unordered_map<std::uint64_t, entry_list::iterator> _index;
+    cache_stats _stats;
+};
+
+
+} // internal
+
+} // arpc
+
+#endif
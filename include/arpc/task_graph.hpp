@@ -0,0 +1,214 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_TASK_GRAPH_HPP_
+#define _ARPC_TASK_GRAPH_HPP_
+
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+#include "bits/remote_callable.hpp"
+#include "execution_pool_mpi.hpp"
+#include "remote_function.hpp"
+
+namespace arpc {
+
+
+namespace internal{
+
+
+///
+/// \brief argument of a call of a task graph: a serialized value or the result of an other call
+///
+struct graph_argument{
+    bool dependency;
+    std::size_t source;
+    std::vector<char> value;
+};
+
+struct graph_node{
+    int rank;
+    int callable_id;
+    std::vector<graph_argument> arguments;
+};
+
+///
+/// \brief calls of a task graph, a call only depends on the calls added before it
+///
+struct graph_description{
+    std::vector<graph_node> nodes;
+};
+
+
+} // internal
+
+
+class task_graph;
+
+
+///
+/// \brief handle on a call of a task_graph, usable as argument of the following calls
+///
+template<typename T>
+class task{
+public:
+    typedef T value_type;
+
+    inline std::size_t index() const{
+        return _index;
+    }
+
+private:
+    task(std::size_t my_index, const task_graph* my_graph) : _index(my_index), _graph(my_graph) {}
+
+    std::size_t _index;
+    const task_graph* _graph;
+
+    friend class task_graph;
+};
+
+
+///
+/// \brief graph of dependent remote calls, submitted at once
+///
+/// each call runs on its node as soon as its inputs are there. The results are
+/// sent directly from node to node: only the outputs requested with output()
+/// come back to the submitting node.
+///
+/// \code
+///  task_graph graph(service);
+///  task<int> a = graph.add(square, 1, 3);
+///  task<int> b = graph.add(square, 2, 4);
+///  std::future<int> sum = graph.output(graph.add(add, 3, a, b));
+///  graph.submit();
+/// \endcode
+///
+class task_graph{
+public:
+    explicit task_graph(exec_service_mpi & service) :
+        _service(&service),
+        _description(),
+        _outputs(),
+        _submitted(false) {}
+
+    ///
+    /// \brief add a call of fun on node rank
+    ///
+    /// each input is either a value of the matching argument type or a task
+    /// of this graph whose result has this type
+    ///
+    template<typename Ret, typename... Args, typename... Inputs>
+    task<Ret> add(remote_function<Ret, Args...> & fun, int rank, Inputs&&... inputs){
+        static_assert(sizeof...(Args) == sizeof...(Inputs), "invalid number of arguments");
+        check_not_submitted();
+
+        if(fun._pool != _service){
+            throw std::runtime_error("the remote_function is not registered in the service of this graph");
+        }
+
+        internal::graph_node node;
+        node.rank = rank;
+        node.callable_id = fun._callable_id;
+        node.arguments = { make_argument<typename std::decay<Args>::type>(std::forward<Inputs>(inputs))... };
+
+        _description.nodes.emplace_back(std::move(node));
+        _outputs.emplace_back();
+        return task<Ret>(_description.nodes.size() -1, this);
+    }
+
+    ///
+    /// \brief request the result of a call on the submitting node
+    ///
+    template<typename T>
+    std::future<T> output(const task<T> & t){
+        check_not_submitted();
+        check_task(t);
+
+        if(_outputs[t._index]){
+            throw std::logic_error("the output of this task is already requested");
+        }
+
+        std::unique_ptr<internal::value_result<T> > handler(new internal::value_result<T>());
+        std::future<T> res = handler->get_future();
+        _outputs[t._index] = std::move(handler);
+        return res;
+    }
+
+    ///
+    /// \brief send the graph to the nodes, a graph can be submitted once
+    ///
+    void submit(){
+        check_not_submitted();
+        _submitted = true;
+        _service->send_graph(_description, _outputs);
+    }
+
+    /// number of calls of the graph
+    inline std::size_t size() const{
+        return _description.nodes.size();
+    }
+
+private:
+    task_graph(const task_graph &) = delete;
+
+    template<typename T>
+    struct is_task : std::false_type {};
+
+    template<typename T>
+    struct is_task<task<T> > : std::true_type {};
+
+    template<typename Arg, typename T>
+    internal::graph_argument make_argument(const task<T> & t){
+        static_assert(std::is_same<Arg, typename std::decay<T>::type>::value, "the task result type differs from the argument type");
+        check_task(t);
+        return internal::graph_argument{ true, t._index, std::vector<char>() };
+    }
+
+    template<typename Arg, typename Value, typename = typename std::enable_if<!is_task<typename std::decay<Value>::type>::value>::type>
+    internal::graph_argument make_argument(Value && value){
+        return internal::graph_argument{ false, 0, internal::serialize_value(Arg(std::forward<Value>(value))) };
+    }
+
+    template<typename T>
+    void check_task(const task<T> & t) const{
+        if(t._graph != this || t._index >= _description.nodes.size()){
+            throw std::invalid_argument("the task does not belong to this graph");
+        }
+    }
+
+    inline void check_not_submitted() const{
+        if(_submitted){
+            throw std::logic_error("the task graph is already submitted");
+        }
+    }
+
+    exec_service_mpi* _service;
+    internal::graph_description _description;
+    // per call, null if the result is not requested
+    std::vector<std::unique_ptr<internal::result_object> > _outputs;
+    bool _submitted;
+};
+
+
+} // arpc
+
+#endif
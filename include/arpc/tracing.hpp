@@ -0,0 +1,118 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef _ARPC_TRACING_HPP_
+#define _ARPC_TRACING_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+namespace arpc {
+
+
+///
+/// \brief steps of a remote call recorded by the request tracing
+///
+enum class trace_stage : std::uint8_t {
+    // client side
+    serialize = 0,
+    send_header = 1,
+    send_data = 2,
+    // server side
+    probe = 3,
+    queue = 4,
+    recv_data = 5,
+    deserialize = 6,
+    execute = 7,
+    reply = 8,
+    // client side, reception of the answer
+    fulfil = 9
+};
+
+const char* trace_stage_name(trace_stage stage);
+
+
+///
+/// \brief one timed step of a traced request, timestamps in nanoseconds of the local steady clock
+///
+struct trace_event{
+    std::uint64_t trace_id;
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::int32_t callable_id;
+    std::int32_t thread;
+    std::uint8_t stage;
+};
+
+
+namespace internal{
+
+
+///
+/// \brief per node storage of the trace events of a service
+///
+class trace_buffer{
+public:
+    static constexpr std::size_t default_max_events = 1 << 20;
+
+    trace_buffer();
+
+    inline bool enabled() const{
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    void set_enabled(bool value);
+
+    /// new identifier, unique over all the nodes
+    std::uint64_t new_trace_id(int rank);
+
+    void record(std::uint64_t trace_id, trace_stage stage, int callable_id, std::uint64_t begin, std::uint64_t end);
+
+    /// copy of the recorded events
+    std::vector<trace_event> events();
+
+    /// number of events dropped because the buffer was full
+    std::size_t dropped();
+
+private:
+    std::atomic<bool> _enabled;
+    std::atomic<std::uint64_t> _counter;
+    std::mutex _lock;
+    std::vector<trace_event> _events;
+    std::size_t _dropped;
+};
+
+
+///
+/// \brief write the events of every node in the Chrome trace event format,
+/// readable by chrome://tracing and Perfetto
+///
+/// events_per_rank[i] contains the events of the node i, already corrected
+/// to a common clock
+///
+void write_chrome_trace(std::ostream & os, const std::vector<std::vector<trace_event> > & events_per_rank);
+
+
+} // internal
+
+} // arpc
+
+#endif
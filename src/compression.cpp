@@ -0,0 +1,211 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <limits>
+
+#ifdef ARPC_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef ARPC_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include <arpc/compression.hpp>
+
+namespace arpc {
+
+
+namespace {
+
+// compressed payload: [ uint64 uncompressed size ][ compressed data ]
+constexpr std::size_t prefix_size = sizeof(std::uint64_t);
+
+compression_codec resolve_codec(compression_codec codec){
+    if(codec == compression_codec::best_available){
+#if defined(ARPC_WITH_LZ4)
+        return compression_codec::lz4;
+#elif defined(ARPC_WITH_ZLIB)
+        return compression_codec::zlib;
+#else
+        return compression_codec::none;
+#endif
+    }
+    return is_codec_available(codec) ? codec : compression_codec::none;
+}
+
+
+// largest uncompressed size / compressed size the codec can produce, bound the
+// allocation of a decompression whose size prefix is corrupted or hostile
+std::uint64_t max_expansion(compression_codec codec){
+    switch(codec){
+#ifdef ARPC_WITH_LZ4
+        // a match token of one byte extends a match by 255 bytes at most
+        case compression_codec::lz4:
+            return 255;
+#endif
+#ifdef ARPC_WITH_ZLIB
+        // deflate limit
+        case compression_codec::zlib:
+            return 1032;
+#endif
+        default:
+            throw std::runtime_error(std::string("arpc: unsupported compression codec ") + std::to_string(int(codec)));
+    }
+}
+
+
+// return the compressed size, 0 on failure
+std::size_t compress_raw(compression_codec codec, const std::vector<char> & data, std::vector<char> & output){
+    switch(codec){
+#ifdef ARPC_WITH_LZ4
+        case compression_codec::lz4:{
+            if(data.size() > std::size_t(LZ4_MAX_INPUT_SIZE)){
+                return 0;
+            }
+            output.resize(prefix_size + LZ4_compressBound(int(data.size())));
+            const int res = LZ4_compress_default(data.data(), output.data() + prefix_size,
+                                                 int(data.size()), int(output.size() - prefix_size));
+            return (res > 0) ? std::size_t(res) : 0;
+        }
+#endif
+#ifdef ARPC_WITH_ZLIB
+        case compression_codec::zlib:{
+            uLongf out_size = compressBound(uLong(data.size()));
+            output.resize(prefix_size + out_size);
+            const int res = compress2(reinterpret_cast<Bytef*>(output.data() + prefix_size), &out_size,
+                                      reinterpret_cast<const Bytef*>(data.data()), uLong(data.size()), Z_BEST_SPEED);
+            return (res == Z_OK) ? std::size_t(out_size) : 0;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+}
+
+
+bool is_codec_available(compression_codec codec){
+    switch(codec){
+        case compression_codec::none:
+            return true;
+#ifdef ARPC_WITH_LZ4
+        case compression_codec::lz4:
+            return true;
+#endif
+#ifdef ARPC_WITH_ZLIB
+        case compression_codec::zlib:
+            return true;
+#endif
+        case compression_codec::best_available:
+            return resolve_codec(codec) != compression_codec::none;
+        default:
+            return false;
+    }
+}
+
+
+namespace internal{
+
+
+compression_codec compress(const compression_options & options, const std::vector<char> & data, std::vector<char> & output){
+    const compression_codec codec = resolve_codec(options.codec);
+
+    if(codec == compression_codec::none || data.size() < options.threshold){
+        return compression_codec::none;
+    }
+
+    std::vector<char> buffer;
+    const std::size_t compressed_size = compress_raw(codec, data, buffer);
+
+    // not worth it
+    if(compressed_size == 0 || compressed_size + prefix_size >= data.size()){
+        return compression_codec::none;
+    }
+
+    const std::uint64_t raw_size = data.size();
+    std::memcpy(buffer.data(), &raw_size, prefix_size);
+    buffer.resize(prefix_size + compressed_size);
+
+    output = std::move(buffer);
+    return codec;
+}
+
+
+std::vector<char> decompress(compression_codec codec, const std::vector<char> & data){
+    if(codec == compression_codec::none){
+        return data;
+    }
+
+    if(data.size() < prefix_size){
+        throw std::runtime_error("arpc: invalid compressed payload, too small");
+    }
+
+    std::uint64_t raw_size;
+    std::memcpy(&raw_size, data.data(), prefix_size);
+
+    const char* compressed = data.data() + prefix_size;
+    const std::size_t compressed_size = data.size() - prefix_size;
+
+    // checked before the allocation
+    const std::uint64_t max_raw_size = std::uint64_t(compressed_size) * max_expansion(codec) + 64;
+    if(raw_size > max_raw_size || raw_size > std::uint64_t(std::numeric_limits<std::ptrdiff_t>::max())){
+        throw std::runtime_error("arpc: invalid compressed payload, size " + std::to_string(raw_size)
+                                 + " impossible for " + std::to_string(compressed_size) + " compressed bytes");
+    }
+
+    std::vector<char> res(raw_size);
+
+    switch(codec){
+#ifdef ARPC_WITH_LZ4
+        case compression_codec::lz4:{
+            if(raw_size > std::uint64_t(std::numeric_limits<int>::max())){
+                throw std::runtime_error("arpc: invalid lz4 payload size");
+            }
+            const int res_size = LZ4_decompress_safe(compressed, res.data(), int(compressed_size), int(raw_size));
+            if(res_size < 0 || std::uint64_t(res_size) != raw_size){
+                throw std::runtime_error("arpc: corrupted lz4 payload");
+            }
+            return res;
+        }
+#endif
+#ifdef ARPC_WITH_ZLIB
+        case compression_codec::zlib:{
+            uLongf res_size = uLongf(raw_size);
+            const int status = uncompress(reinterpret_cast<Bytef*>(res.data()), &res_size,
+                                          reinterpret_cast<const Bytef*>(compressed), uLong(compressed_size));
+            if(status != Z_OK || std::uint64_t(res_size) != raw_size){
+                throw std::runtime_error("arpc: corrupted zlib payload");
+            }
+            return res;
+        }
+#endif
+        default:
+            throw std::runtime_error(std::string("arpc: unsupported compression codec ") + std::to_string(int(codec)));
+    }
+}
+
+
+} // internal
+
+} // arpc
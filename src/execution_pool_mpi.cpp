@@ -17,18 +17,31 @@
 */
 
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <tuple>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <exception>
 #include <chrono>
 #include <functional>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <limits>
 
 #include <mpi-cpp/mpi.hpp>
 
 #include <arpc/execution_pool_mpi.hpp>
+#include <arpc/task_graph.hpp>
+#include <arpc/remote_object.hpp>
+#include <arpc/bits/mpsc_queue.hpp>
 
 namespace arpc {
 
@@ -38,6 +51,24 @@ namespace {
 const std::uint8_t message_type_request = 0x01;
 const std::uint8_t message_type_answer = 0x02;
 const std::uint8_t message_type_exception = 0x03;
+// sent by a node to itself to get its progress thread out of a blocking probe
+const std::uint8_t message_type_wakeup = 0x04;
+// call of a chain of forwarded calls, see forward_envelope
+const std::uint8_t message_type_forward = 0x05;
+// calls of a task graph executed by the receiving node
+const std::uint8_t message_type_graph_calls = 0x06;
+// result of a call of a task graph, input of a call of the receiving node
+const std::uint8_t message_type_graph_input = 0x07;
+// construction, method call or destruction of a remote object
+const std::uint8_t message_type_object = 0x08;
+
+// the data follows the header in the same message
+const std::uint8_t header_flag_inline = 0x01;
+// answer or exception at the end of a chain of forwarded calls,
+// not sent by the node the request was sent to
+const std::uint8_t header_flag_forwarded = 0x02;
+// request of a sequence of calls of the same function, see remote_function::batch
+const std::uint8_t header_flag_batch = 0x04;
 
 
 struct message_header{
@@ -45,14 +76,34 @@ struct message_header{
         request_id(0),
         identifier_token(0),
         message_type(0),
-        source(-1){}
+        codec(0),
+        flags(0),
+        trace_id(0),
+        load(0),
+        source(-1),
+        probe_time(0),
+        reception_time(0),
+        dequeue_time(0),
+        data_time(0){}
 
     std::uint64_t request_id;
     std::uint32_t identifier_token;
     std::uint8_t message_type;
+    // compression codec of the data message
+    std::uint8_t codec;
+    std::uint8_t flags;
+    // 0 if the request is not traced
+    std::uint64_t trace_id;
+    // answers: number of requests waiting for an executor on the server
+    std::uint32_t load;
 
     // source is not transmitted, but added by the MPI layer
     int source;
+    // not transmitted, local timestamps of the reception steps
+    std::uint64_t probe_time;
+    std::uint64_t reception_time;
+    std::uint64_t dequeue_time;
+    std::uint64_t data_time;
 
     std::vector<char> serialize(){
         std::vector<char> res;
@@ -63,6 +114,14 @@ struct message_header{
         *((decltype(identifier_token)*) pbuffer) = identifier_token;
         pbuffer += sizeof(identifier_token);
         *((decltype(message_type)*) pbuffer) = message_type;
+        pbuffer += sizeof(message_type);
+        *((decltype(codec)*) pbuffer) = codec;
+        pbuffer += sizeof(codec);
+        *((decltype(flags)*) pbuffer) = flags;
+        pbuffer += sizeof(flags);
+        std::memcpy(pbuffer, &trace_id, sizeof(trace_id));
+        pbuffer += sizeof(trace_id);
+        std::memcpy(pbuffer, &load, sizeof(load));
         return res;
     }
 
@@ -70,35 +129,94 @@ struct message_header{
         if(vec.size() != serialized_data_size){
             throw std::logic_error("Invalid header message, length inconsistency");
         }
+        deserialize(vec.data(), vec.size());
+    }
+
+    // buffer can contain inline data after the header
+    void deserialize(const char* buffer, std::size_t size){
+        if(size < serialized_data_size){
+            throw std::logic_error("Invalid header message, length inconsistency");
+        }
 
-        char * pbuffer = const_cast<char*>(vec.data());
+        char * pbuffer = const_cast<char*>(buffer);
         request_id = *((decltype(request_id)*) pbuffer);
         pbuffer+= sizeof(request_id);
         identifier_token = *((decltype(identifier_token)*) pbuffer);
         pbuffer += sizeof(identifier_token);
         message_type = *((decltype(message_type)*) pbuffer);
+        pbuffer += sizeof(message_type);
+        codec = *((decltype(codec)*) pbuffer);
+        pbuffer += sizeof(codec);
+        flags = *((decltype(flags)*) pbuffer);
+        pbuffer += sizeof(flags);
+        std::memcpy(&trace_id, pbuffer, sizeof(trace_id));
+        pbuffer += sizeof(trace_id);
+        std::memcpy(&load, pbuffer, sizeof(load));
     }
 
-    static constexpr std::size_t serialized_data_size =
+    // header message followed by the data, in one eager message
+    static std::vector<char> serialize_inline(const std::vector<char> & header_data, const std::vector<char> & data){
+        std::vector<char> res;
+        res.reserve(header_data.size() + data.size());
+        res.insert(res.end(), header_data.begin(), header_data.end());
+        res[flags_offset] = char(res[flags_offset] | header_flag_inline);
+        res.insert(res.end(), data.begin(), data.end());
+        return res;
+    }
+
+    static constexpr std::size_t flags_offset =
             sizeof(decltype(request_id)) + sizeof(decltype(identifier_token))
-            + sizeof(decltype(message_type));
+            + sizeof(decltype(message_type)) + sizeof(decltype(codec));
+
+    static constexpr std::size_t serialized_data_size =
+            flags_offset + sizeof(decltype(flags)) + sizeof(decltype(trace_id)) + sizeof(decltype(load));
 
 };
 
+// tag of the clock synchronization messages, outside of the request traffic (tags 1 and 2)
+constexpr int tag_clock_sync = 3;
+
+// pre-posted receives of the header messages (tag 1). Data up to eager_max_data
+// bytes is sent inline with its header, bigger data is probed and received on tag 2
+constexpr std::size_t eager_ring_size = 64;
+constexpr std::size_t eager_buffer_size = 8192;
+constexpr std::size_t eager_max_data = eager_buffer_size - message_header::serialized_data_size;
+// payload buffers of the inline messages kept for reuse
+constexpr std::size_t max_spare_buffers = 2 * eager_ring_size;
+// ids of destroyed remote objects remembered by a node
+constexpr std::size_t max_destroyed_objects = 1024;
+
 constexpr int tag_range1_begin = 2;
 constexpr int tag_range1_end = tag_range1_begin+ std::numeric_limits<int>::max()/4;
 constexpr int tag_range2_begin = tag_range1_end;
 constexpr int tag_range2_end = tag_range1_end + std::numeric_limits<int>::max()/4;
 
 
+///
+/// \brief client side information on a request in flight
+///
+struct request_info{
+    request_info() : callable_id(0), start_time(0), answers(1) {}
+    request_info(int my_callable_id, std::uint64_t my_start_time, std::size_t my_answers = 1) :
+        callable_id(my_callable_id), start_time(my_start_time), answers(my_answers) {}
+
+    int callable_id;
+    std::uint64_t start_time;
+    /// answers still expected, one per destination
+    std::size_t answers;
+};
+
+
 template<typename ResultHandler>
 class request_stack{
 public:
 
-    int register_req(std::unique_ptr<ResultHandler> && req){
+    int register_req(std::unique_ptr<ResultHandler> && req, const request_info & info = request_info()){
         std::lock_guard<std::mutex> lock(mutex_request);
 
         requests.emplace_back(std::move(req));
+        infos.emplace_back(info);
+        n_outstanding += 1;
         return tag_range2_begin + requests.size() -1;
     }
 
@@ -112,6 +230,32 @@ public:
         return *requests[offset];
     }
 
+    ///
+    /// \brief an answer of request id came back, before its handler is called
+    ///
+    /// the request is not outstanding anymore from its last answer: the count is
+    /// exact once the handler completes the future
+    ///
+    ResultHandler& take_answer(int id){
+        assert(id >= tag_range2_begin);
+
+        std::lock_guard<std::mutex> lock(mutex_request);
+        const size_t offset = id - tag_range2_begin;
+        assert((offset)  < requests.size());
+        assert(requests[offset] != nullptr);
+        settle(offset, 1);
+        return *requests[offset];
+    }
+
+    request_info get_info_from_id(int id){
+        assert(id >= tag_range2_begin);
+
+        std::lock_guard<std::mutex> lock(mutex_request);
+        const size_t offset = id - tag_range2_begin;
+        assert((offset)  < infos.size());
+        return infos[offset];
+    }
+
     void pop_request(int id){
         assert(id >= tag_range2_begin);
 
@@ -120,298 +264,2227 @@ public:
         const size_t offset = id - tag_range2_begin;
         assert((offset)  < requests.size());
 
-        // invalidate the request
+        // invalidate the request, failed requests have not all their answers
+        settle(offset, infos[offset].answers);
         requests[offset].reset();
 
         // pop every last invalid request in stack mode
         while(requests.size() > 0 && requests.back().get() == nullptr){
             requests.pop_back();
+            infos.pop_back();
         }
 
     }
 
+    std::size_t outstanding(){
+        std::lock_guard<std::mutex> lock(mutex_request);
+        return n_outstanding;
+    }
+
 private:
+    // to call with mutex_request held
+    void settle(std::size_t offset, std::size_t n_answers){
+        std::size_t & answers = infos[offset].answers;
+        if(answers == 0){
+            return;
+        }
+        answers -= std::min(answers, n_answers);
+        if(answers == 0){
+            n_outstanding -= 1;
+        }
+    }
+
     std::vector<typename std::unique_ptr<ResultHandler>> requests;
+    std::vector<request_info> infos;
+    std::size_t n_outstanding = 0;
     std::mutex mutex_request;
 };
 
 
-}
+///
+/// \brief data of a forwarded call
+///
+/// the node of the request, the calls following this one and the arguments of this one:
+/// the serialized arguments for the first call of the chain, the serialized result of
+/// the previous call for the others
+///
+struct forward_envelope{
+    forward_envelope() : origin(-1), chained(0), stages(), arguments() {}
+
+    std::int32_t origin;
+    std::uint8_t chained;
+    std::vector<internal::forward_stage> stages;
+    std::vector<char> arguments;
+
+    std::vector<char> serialize() const{
+        const std::uint32_t n_stages = std::uint32_t(stages.size());
+        std::vector<char> res(fixed_size + n_stages * stage_size + arguments.size());
+
+        char* pbuffer = res.data();
+        std::memcpy(pbuffer, &origin, sizeof(origin));
+        pbuffer += sizeof(origin);
+        std::memcpy(pbuffer, &chained, sizeof(chained));
+        pbuffer += sizeof(chained);
+        std::memcpy(pbuffer, &n_stages, sizeof(n_stages));
+        pbuffer += sizeof(n_stages);
+        for(const internal::forward_stage & stage : stages){
+            const std::int32_t values[2] = { std::int32_t(stage.rank), std::int32_t(stage.callable_id) };
+            std::memcpy(pbuffer, values, stage_size);
+            pbuffer += stage_size;
+        }
+        std::copy(arguments.begin(), arguments.end(), pbuffer);
+        return res;
+    }
 
+    void deserialize(const std::vector<char> & vec){
+        if(vec.size() < fixed_size){
+            throw std::logic_error("Invalid forwarded call, length inconsistency");
+        }
 
-class service_io{
-public:
-    using vector_req_status = std::vector<mpi::mpi_future<std::vector<char>> >;
-    using req_status = mpi::mpi_future<std::vector<char>>;
+        const char* pbuffer = vec.data();
+        std::uint32_t n_stages = 0;
+        std::memcpy(&origin, pbuffer, sizeof(origin));
+        pbuffer += sizeof(origin);
+        std::memcpy(&chained, pbuffer, sizeof(chained));
+        pbuffer += sizeof(chained);
+        std::memcpy(&n_stages, pbuffer, sizeof(n_stages));
+        pbuffer += sizeof(n_stages);
+
+        if(vec.size() < fixed_size + std::size_t(n_stages) * stage_size){
+            throw std::logic_error("Invalid forwarded call, length inconsistency");
+        }
 
-    service_io(MPI_Comm my_comm, const std::function<void (int, message_header &, const std::vector<char> & )> & my_recv_task) :
-        poll_thread(),
-        executers(),
-        recv_task(my_recv_task),
-        finished(false),
-        comm()
-    {
-        (void) my_comm;
-        comm.barrier();
+        stages.resize(n_stages);
+        for(internal::forward_stage & stage : stages){
+            std::int32_t values[2];
+            std::memcpy(values, pbuffer, stage_size);
+            pbuffer += stage_size;
+            stage.rank = values[0];
+            stage.callable_id = values[1];
+        }
+        arguments.assign(pbuffer, vec.data() + vec.size());
+    }
 
-        const std::size_t n_thread = std::thread::hardware_concurrency();
+    static constexpr std::size_t fixed_size = sizeof(std::int32_t) + sizeof(std::uint8_t) + sizeof(std::uint32_t);
+    static constexpr std::size_t stage_size = 2 * sizeof(std::int32_t);
+};
 
-        poll_thread = std::thread([&]{
-            this->poll();
-        });
 
-        for(std::size_t i =0; i < n_thread; ++i){
-            executers.emplace_back(std::thread([&](){
-                this->run();
-            }));
-        }
+///
+/// \brief raw encoding of the task graph messages
+///
+class byte_writer{
+public:
+    template<typename T>
+    inline void put(T value){
+        const std::size_t pos = buffer.size();
+        buffer.resize(pos + sizeof(T));
+        std::memcpy(&buffer[pos], &value, sizeof(T));
     }
 
-    ~service_io(){
-        comm.barrier();
-        finished = true;
+    inline void put_bytes(const std::vector<char> & data){
+        put<std::uint32_t>(std::uint32_t(data.size()));
+        buffer.insert(buffer.end(), data.begin(), data.end());
+    }
 
-        poll_thread.join();
+    std::vector<char> buffer;
+};
 
-        for(auto & t : executers){
-            t.join();
-        }
 
+class byte_reader{
+public:
+    explicit byte_reader(const std::vector<char> & data) : buffer(data), pos(0) {}
+
+    template<typename T>
+    inline T get(){
+        check(sizeof(T));
+        T value;
+        std::memcpy(&value, &buffer[pos], sizeof(T));
+        pos += sizeof(T);
+        return value;
     }
 
-    inline void send(int rank, int tag, const std::vector<char> & data){
-        return comm.send(data, rank, tag);
+    inline std::vector<char> get_bytes(){
+        const std::size_t size = get<std::uint32_t>();
+        check(size);
+        std::vector<char> res(buffer.begin() + pos, buffer.begin() + pos + size);
+        pos += size;
+        return res;
     }
 
-    inline req_status send_async(int rank, int tag, const std::vector<char> & data){
-        return comm.send_async(data, rank, tag);
+private:
+    inline void check(std::size_t size) const{
+        if(pos + size > buffer.size()){
+            throw std::logic_error("Invalid task graph message, length inconsistency");
+        }
     }
 
+    const std::vector<char> & buffer;
+    std::size_t pos;
+};
 
-    inline vector_req_status send_bulk(const std::vector<int> & node_list, int tag, const std::vector<char> & data){
-        vector_req_status futures;
-        futures.reserve(node_list.size());
 
-        for(auto & node : node_list){
-            futures.emplace_back(std::move(comm.send_async(data, node, tag)));
-        }
+// a call of a task graph waiting for its inputs: submitting node, graph, call index
+typedef std::tuple<std::int32_t, std::uint32_t, std::uint32_t> graph_call_key;
 
-        return futures;
-    }
+struct graph_consumer{
+    std::int32_t rank;
+    std::uint32_t call;
+    std::uint32_t slot;
+};
 
-    inline void barrier(){
-        comm.barrier();
+///
+/// \brief server side state of a call of a task graph
+///
+/// the inputs can arrive before the description of the call, from any node
+///
+struct pending_graph_call{
+    pending_graph_call() :
+        described(false),
+        callable_id(0),
+        output_token(-1),
+        n_arguments(0),
+        received(0),
+        arguments(),
+        consumers(),
+        error() {}
+
+    inline bool ready() const{
+        return described && received == n_arguments;
     }
 
-    inline int get_rank() const{
-        return comm.rank();
+    inline void set_argument(std::size_t slot, std::vector<char> && value){
+        if(arguments.size() <= slot){
+            arguments.resize(slot +1);
+        }
+        arguments[slot] = std::move(value);
+        received += 1;
     }
 
-    inline ::mpi::mpi_comm & get_comm(){
-        return comm;
-    }
+    bool described;
+    int callable_id;
+    // request of the submitting node waiting for the result, -1 if none
+    std::int32_t output_token;
+    std::size_t n_arguments;
+    std::size_t received;
+    std::vector<std::vector<char> > arguments;
+    std::vector<graph_consumer> consumers;
+    // first error of the inputs, the call is not executed
+    std::string error;
+};
 
-private:
-    service_io(const service_io & ) = delete;
 
-    void run(){
-        while(!finished){
-            message_header handle;
+///
+/// \brief operation on a remote object waiting for its turn
+///
+struct object_operation_request{
+    int rank;
+    std::uint32_t token;
+    exec_service_mpi::object_operation operation;
+    int id;
+    std::vector<char> arguments;
+};
 
-            {
-                std::lock_guard<std::mutex> lock(task_mutex);
-                if( handles.size() > 0){
-                    handle = std::move(handles.back());
-                    handles.pop_back();
-                }
-            }
 
-            if(handle.identifier_token != 0){
-                ::mpi::mpi_comm::message_handle data_handle = comm.probe(handle.source, 2);
-                if(data_handle.is_valid()){
-                    ::mpi::mpi_future<std::vector<char> > data = comm.recv_async< std::vector<char> >(data_handle);
-                    recv_task(data_handle.rank(), handle, data.get());
-                }
-                continue;
-            }
+///
+/// \brief server side state of a remote object
+///
+/// the operations are run by sequence number, by one executor at a time.
+/// Once destroyed, the operations left are answered with an error in any order
+///
+/// a client numbers no operation after destroy: the slot is then erased. Only the
+/// last max_destroyed_objects ids are remembered to answer a stray operation
+///
+struct object_slot{
+    object_slot() : lock(), instance(), error(), destroyed(false), next_sequence(0), pending(), running(false) {}
+
+    std::mutex lock;
+    // accessed by the running executor only
+    std::shared_ptr<void> instance;
+    std::string error;
+    bool destroyed;
+
+    std::uint64_t next_sequence;
+    std::map<std::uint64_t, object_operation_request> pending;
+    bool running;
+};
 
-            {
-                std::unique_lock<std::mutex> lock(task_mutex);
-                task_cond.wait_for(lock, std::chrono::microseconds(100));
-            }
-        }
-    }
 
+///
+/// \brief result handler of a request shared by identical calls
+///
+/// on completion, on_complete is called before the handlers are fulfilled:
+/// no call can attach itself anymore
+///
+class shared_result : public internal::result_object{
+public:
+    shared_result(std::unique_ptr<internal::result_object> && first, const std::function<void (const shared_result*)> & on_complete) :
+        handlers(),
+        complete(on_complete){
+        handlers.emplace_back(std::move(first));
+    }
 
-    void poll(){
-        while(!finished){
-            ::mpi::mpi_comm::message_handle handle = comm.probe(::mpi::any_source, 1, 1);
-            if(handle.is_valid()){
-                message_header headers;
-                std::vector<char> headers_data;
-                comm.recv(handle, headers_data);
-                headers.deserialize(headers_data);
-                headers.source = handle.rank();
+    // to call before the completion, under the lock of on_complete
+    void attach(std::unique_ptr<internal::result_object> && handler){
+        handlers.emplace_back(std::move(handler));
+    }
 
-                std::lock_guard<std::mutex> lock(task_mutex);
-                handles.emplace_back(std::move(headers));
-                task_cond.notify_one();
+    bool add_result(const std::vector<char> & result) override{
+        complete(this);
+        for(auto & handler : handlers){
+            try{
+                handler->add_result(result);
+            }catch(std::exception & e){
+                handler->add_exception(e.what());
             }
         }
+        return true;
     }
 
+    bool add_exception(const std::string & error_msg) override{
+        complete(this);
+        for(auto & handler : handlers){
+            handler->add_exception(error_msg);
+        }
+        return true;
+    }
 
-    std::mutex task_mutex;
-    std::condition_variable task_cond;
-    std::vector<message_header> handles;
+private:
+    std::vector<std::unique_ptr<internal::result_object> > handlers;
+    std::function<void (const shared_result*)> complete;
+};
 
 
-    std::thread poll_thread;
-    std::vector<std::thread> executers;
+// compression options of a service in one word, changed while the executors read them
+// [ 56 bits threshold ][ 8 bits codec ]
+std::uint64_t pack_compression(const compression_options & options){
+    const std::uint64_t max_threshold = (std::uint64_t(1) << 56) -1;
+    return (std::min<std::uint64_t>(options.threshold, max_threshold) << 8) | std::uint64_t(options.codec);
+}
 
-    std::function<void (int, message_header &, const std::vector<char> &)> recv_task;
+compression_options unpack_compression(std::uint64_t packed){
+    return compression_options(compression_codec(packed & 0xff), std::size_t(packed >> 8));
+}
 
-    bool finished;
 
-    ::mpi::mpi_comm comm;
-};
+// identity of a deduplicated request
+std::string make_request_key(int callable_id, int rank, const std::vector<char> & args_serialized){
+    std::string key;
+    key.reserve(sizeof(callable_id) + sizeof(rank) + args_serialized.size());
+    key.append(reinterpret_cast<const char*>(&callable_id), sizeof(callable_id));
+    key.append(reinterpret_cast<const char*>(&rank), sizeof(rank));
+    key.append(args_serialized.begin(), args_serialized.end());
+    return key;
+}
 
 
-class exec_service_mpi::pimpl {
+///
+/// \brief open addressing table function id -> callable, read without lock
+///
+/// insert only: a registration fills a free entry of the published table, the
+/// readers see the callable once its id is written. A full table is replaced by
+/// a table twice as large
+///
+class dispatch_table{
 public:
-    pimpl(int* argc, char*** argv) :
-        env(argc, argv),
-        io(MPI_COMM_WORLD, [&] (int rank, message_header& header, const std::vector<char> & data) {
-            this->recv_handler(rank, header, data);
-        }),
-        n(tag_range1_begin) {}
-
+    explicit dispatch_table(std::size_t capacity) :
+        entries(new entry[capacity]),
+        mask(capacity -1),
+        count(0){
+        for(std::size_t i = 0; i < capacity; ++i){
+            entries[i].id.store(0, std::memory_order_relaxed);
+            entries[i].callable.store(nullptr, std::memory_order_relaxed);
+        }
+    }
 
-    void recv_handler(int rank, message_header & headers, const std::vector<char> & data){
-        int callable_id = headers.request_id;
-        int request_id = headers.identifier_token;
+    inline std::size_t capacity() const{
+        return mask +1;
+    }
 
-        std::ostringstream ss;
-        /*ss << "on " <<  io.get_rank() << " " <<
-                   "dest from " << rank << " callable_id " << callable_id << " request_id " << request_id
-                  << " msg_type " << int(headers.message_type) << " size " << data.size();
-        std::cout << ss.str() << std::endl;*/
+    /// writers serialized by the caller, return false if the table is full
+    bool insert(int id, internal::callable_object* callable){
+        // load factor 1/2 at most
+        if((count +1) * 2 > capacity()){
+            return false;
+        }
 
-        if(headers.message_type == message_type_answer){ // response
-            //std::cout << "execute answer " << std::endl;
+        std::size_t pos = slot_of(id);
+        while(entries[pos].callable.load(std::memory_order_relaxed) != nullptr){
+            pos = (pos +1) & mask;
+        }
+        entries[pos].id.store(id, std::memory_order_relaxed);
+        entries[pos].callable.store(callable, std::memory_order_release);
+        count += 1;
+        return true;
+    }
 
-            internal::result_object& req = req_stack.get_request_from_id(request_id);
-            const bool completed = req.add_result(data);
-             if(completed){
-                req_stack.pop_request(request_id);
+    inline internal::callable_object* find(int id) const{
+        std::size_t pos = slot_of(id);
+        internal::callable_object* callable;
+        while((callable = entries[pos].callable.load(std::memory_order_acquire)) != nullptr){
+            if(entries[pos].id.load(std::memory_order_relaxed) == id){
+                return callable;
             }
-        }else if(headers.message_type == message_type_request){
-            try{
-               //std::cout << "execute request " <<  data.size() << " " << data.data() << std::endl;
-               std::vector<char> serialized_result = int_to_function_map[callable_id]->deserialize_and_call(data);
-
-               message_header response_headers;
-               response_headers.identifier_token = request_id;
-               response_headers.request_id = callable_id;
-               response_headers.message_type = message_type_answer;
-
-               std::vector<char> headers_data = response_headers.serialize();
-               auto f_header = io.send_async(rank, 1, headers_data);
-               auto f_data = io.send_async(rank, 2, serialized_result);
-               f_header.wait();
-               f_data.wait();
-            }catch(std::exception & e){
-                std::cerr << "<exception> on rank " << io.get_comm().rank()
-                          << " with request from rank " << rank << " " << e.what() << std::endl;
-            }
-        }else{
-            std::cerr << "Error: recv message with unknown message type" << headers.message_type << "\n";
+            pos = (pos +1) & mask;
         }
-
+        return nullptr;
     }
 
+private:
+    dispatch_table(const dispatch_table &) = delete;
 
-    std::mutex map_locker;
+    struct entry{
+        std::atomic<int> id;
+        std::atomic<internal::callable_object*> callable;
+    };
 
-    std::unordered_map<int, std::shared_ptr<internal::callable_object> > int_to_function_map;
+    inline std::size_t slot_of(int id) const{
+        // sequential ids are dense, hashed ids are already well spread
+        return std::size_t(std::uint32_t(id) * 2654435761u) & mask;
+    }
 
-    std::unordered_map<std::shared_ptr<internal::callable_object>, int > function_to_in_map;
+    std::unique_ptr<entry[]> entries;
+    std::size_t mask;
+    std::size_t count;
+};
 
 
-    request_stack<internal::result_object> req_stack;
+}
 
 
-    ::mpi::mpi_scope_env env;
-    service_io io;
-    std::size_t n;
+///
+/// \brief estimate the offset to add to the local steady clock to get the one of the node 0
+///
+/// NTP style, the sample with the smallest round trip is kept. Collective over comm
+///
+std::int64_t estimate_clock_offset(MPI_Comm comm, int rank, int size){
+    const int rounds = 16;
+    std::int64_t offset = 0;
+
+    if(rank == 0){
+        for(int peer = 1; peer < size; ++peer){
+            for(int i = 0; i < rounds; ++i){
+                std::uint64_t ping;
+                MPI_Recv(&ping, 1, MPI_UINT64_T, peer, tag_clock_sync, comm, MPI_STATUS_IGNORE);
+                std::uint64_t t_remote = internal::steady_time_ns();
+                MPI_Send(&t_remote, 1, MPI_UINT64_T, peer, tag_clock_sync, comm);
+            }
+        }
+    }else{
+        std::uint64_t best_round_trip = std::numeric_limits<std::uint64_t>::max();
+        for(int i = 0; i < rounds; ++i){
+            std::uint64_t t_send = internal::steady_time_ns(), t_remote;
+            MPI_Send(&t_send, 1, MPI_UINT64_T, 0, tag_clock_sync, comm);
+            MPI_Recv(&t_remote, 1, MPI_UINT64_T, 0, tag_clock_sync, comm, MPI_STATUS_IGNORE);
+            const std::uint64_t t_recv = internal::steady_time_ns();
+
+            if(t_recv - t_send < best_round_trip){
+                best_round_trip = t_recv - t_send;
+                offset = std::int64_t(t_remote) - std::int64_t(t_send + (t_recv - t_send) / 2);
+            }
+        }
+    }
+    return offset;
+}
+
+
+// operation executed by the progress thread on behalf of an other thread in funneled mode
+struct mpi_operation : public internal::mpsc_node<mpi_operation>{
+    mpi_operation() :
+        start(),
+        pending(0),
+        error(),
+        completed(false) {}
+
+    // post the requests the operation waits for
+    std::function<void (std::vector<MPI_Request> &)> start;
+    // requests not completed, progress thread only
+    std::size_t pending;
+    std::exception_ptr error;
+    std::atomic<bool> completed;
 };
 
 
-exec_service_mpi::exec_service_mpi(int* argc, char*** argv): d_ptr(new pimpl(argc, argv)) {}
+class service_io{
+public:
+    using vector_req_status = std::vector<mpi::mpi_future<std::vector<char>> >;
+    using req_status = mpi::mpi_future<std::vector<char>>;
+    using mpi_function = std::function<void (std::vector<MPI_Request> &)>;
+
+    ///
+    /// \brief create the io service on a private duplicate of my_comm
+    ///
+    /// the duplication is collective over my_comm and isolates the arpc traffic
+    /// from any other communication done by the application on my_comm
+    ///
+    service_io(MPI_Comm my_comm, threading_mode mode,
+               const std::function<void (int, message_header &, std::vector<char> & )> & my_recv_task) :
+        task_mutex(),
+        task_cond(),
+        send_mutex(),
+        tasks(),
+        poll_thread(),
+        executers(),
+        recv_task(my_recv_task),
+        executors_finished(false),
+        finished(false),
+        waiter(),
+        funneled(use_funneled(mode)),
+        submissions(),
+        inflight_requests(),
+        inflight_operations(),
+        completed_indices(),
+        ring_memory(),
+        ring_requests(),
+        ring_head(0),
+        spare_lock(),
+        spare_buffers(),
+        raw_comm(duplicate_comm(my_comm)),
+        comm(raw_comm),
+        my_rank(comm.rank()),
+        my_size(comm.size())
+    {
+        comm.barrier();
+        post_ring();
 
-exec_service_mpi::~exec_service_mpi() {}
+        const std::size_t n_thread = std::max<std::size_t>(1, std::thread::hardware_concurrency());
 
+        poll_thread = std::thread([&]{
+            this->poll();
+        });
 
-int exec_service_mpi::register_function_internal(std::shared_ptr<internal::callable_object> callable){
-    std::size_t id = d_ptr->n +1;
+        for(std::size_t i =0; i < n_thread; ++i){
+            executers.emplace_back(std::thread([&](){
+                this->run();
+            }));
+        }
+    }
 
-    {
-        std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+    ~service_io(){
+        barrier();
+
+        // the executors first: in funneled mode the answers of the running
+        // calls are sent by the progress thread
+        {
+            std::lock_guard<std::mutex> lock(task_mutex);
+            executors_finished = true;
+            task_cond.notify_all();
+        }
 
-        if(d_ptr->int_to_function_map.insert(std::make_pair(id, callable)).second != true){
-            throw std::runtime_error(std::string("registered function with id '") + std::to_string(id) + "'' already exist" );
+        for(auto & t : executers){
+            t.join();
         }
 
-        if(d_ptr->function_to_in_map.insert(std::make_pair(callable, id)).second != true){
-            throw std::runtime_error(std::string("registered function. ptr already registered ") + std::to_string(ptrdiff_t(callable.get())) );
+        // every node has sent the answers of its calls: they are received by the ring
+        // and not left on a communicator id an other service can reuse
+        barrier();
+        finished = true;
+
+        waiter.notify();
+        if(!funneled && waiter.mode() == progress_mode::blocking){
+            wakeup_poll();
         }
+        poll_thread.join();
 
-        d_ptr->n = id;
+        MPI_Comm_free(&raw_comm);
     }
 
-    d_ptr->io.barrier();
-    return id;
-}
+    ///
+    /// \brief execute fun with the right to call MPI and wait for the requests it posts
+    ///
+    /// in funneled mode fun is executed by the progress thread, directly otherwise.
+    /// Must not be called from the progress thread
+    ///
+    void execute_mpi(const mpi_function & fun){
+        if(!funneled){
+            std::vector<MPI_Request> requests;
+            fun(requests);
+            if(requests.size() > 0){
+                MPI_Waitall(int(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+            }
+            return;
+        }
 
+        mpi_operation op;
+        op.start = fun;
+        submissions.push(&op);
+        waiter.notify();
+
+        // spin, then yield, then sleep: the collectives can be long
+        for(std::size_t i = 0; !op.completed.load(std::memory_order_acquire); ++i){
+            if(i > 20000){
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }else if(i > 200){
+                std::this_thread::yield();
+            }
+        }
 
-bool exec_service_mpi::is_local(int rank){
-    return d_ptr->io.get_comm().rank() == rank;
-}
+        if(op.error){
+            std::rethrow_exception(op.error);
+        }
+    }
 
-void exec_service_mpi::send_request(int rank, int callable_id, const std::vector<char> & args_serialized,
-                  std::unique_ptr<internal::result_object> && result_handler){
+    ///
+    /// \brief send the header and the data of a message to rank, return when both are sent
+    ///
+    /// the receiver pairs a header with the next data message of the same source:
+    /// the two posts are done under a lock, or by the progress thread only in funneled mode,
+    /// so that concurrent senders (requests and replies) do not interleave their messages.
+    ///
+    /// t_header, if not null, receives the completion time of the header
+    ///
+    inline void send_message(int rank, const std::vector<char> & header, const std::vector<char> & data,
+                             std::uint64_t* t_header = nullptr){
+        send_messages(&rank, 1, header, data, t_header);
+    }
 
-    message_header headers;
-    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler));
-    headers.request_id = callable_id;
-    headers.message_type = message_type_request;
+    inline void send_message_bulk(const std::vector<int> & node_list, const std::vector<char> & header, const std::vector<char> & data,
+                                  std::uint64_t* t_header = nullptr){
+        send_messages(node_list.data(), node_list.size(), header, data, t_header);
+    }
 
-    auto header_data = headers.serialize();
+    inline void barrier(){
+        execute_mpi([&](std::vector<MPI_Request> & requests){
+            requests.emplace_back(MPI_REQUEST_NULL);
+            MPI_Ibarrier(raw_comm, &requests.back());
+        });
+    }
 
+    void set_progress(const progress_options & options){
+        const bool was_blocking = (waiter.mode() == progress_mode::blocking);
+        waiter.set_options(options);
+        if(!funneled && was_blocking && options.mode != progress_mode::blocking){
+            wakeup_poll();
+        }
+    }
 
-    auto future_header = d_ptr->io.send_async(rank, 1, header_data);
-    auto future_data = d_ptr->io.send_async(rank, 2, args_serialized);
+    /// local activity, an incoming message is expected soon
+    inline void notify_progress(){
+        waiter.notify();
+    }
 
-    future_header.wait();
-    future_data.wait();
-}
+    inline int get_rank() const{
+        return my_rank;
+    }
 
-void exec_service_mpi::send_request(std::vector<int> node_list, int callable_id, const std::vector<char> &args_serialized, std::unique_ptr<internal::result_object> &&result_handler){
-    message_header headers;
-    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler));
-    headers.request_id = callable_id;
-    headers.message_type = message_type_request;
+    inline int get_size() const{
+        return my_size;
+    }
 
-    auto header_data = headers.serialize();
+    inline bool is_funneled() const{
+        return funneled;
+    }
+
+    inline MPI_Comm get_raw_comm() const{
+        return raw_comm;
+    }
 
-    auto all_future_headers = d_ptr->io.send_bulk(node_list, 1, header_data);
-    auto all_futures = d_ptr->io.send_bulk(node_list, 2, args_serialized);
+    inline std::size_t queue_depth(){
+        std::lock_guard<std::mutex> lock(task_mutex);
+        return tasks.size();
+    }
+
+private:
+    service_io(const service_io & ) = delete;
+
+    struct pending_task{
+        pending_task() : header(), data(), payload(), pooled(false) {}
+
+        message_header header;
+        // data reception in progress
+        std::unique_ptr<req_status> data;
+        // data already received, inline or funneled mode
+        std::vector<char> payload;
+        // payload taken from the spare buffers, given back after the task
+        bool pooled;
+    };
+
+    // buffer able to hold an inline payload without allocation
+    std::vector<char> take_buffer(){
+        {
+            std::lock_guard<std::mutex> lock(spare_lock);
+            if(!spare_buffers.empty()){
+                std::vector<char> res = std::move(spare_buffers.back());
+                spare_buffers.pop_back();
+                return res;
+            }
+        }
+        std::vector<char> res;
+        res.reserve(eager_max_data);
+        return res;
+    }
 
-    for(auto & f : all_future_headers){
-        f.wait();
+    // the buffer can have been taken by the task, a result kept serialized for example
+    void give_back_buffer(std::vector<char> && buffer){
+        if(buffer.capacity() < eager_max_data){
+            return;
+        }
+        std::lock_guard<std::mutex> lock(spare_lock);
+        if(spare_buffers.size() < max_spare_buffers){
+            spare_buffers.emplace_back(std::move(buffer));
+        }
     }
-    for(auto & f : all_futures){
-        f.wait();
+
+    static bool use_funneled(threading_mode mode){
+        int initialized = 0;
+        MPI_Initialized(&initialized);
+        if(!initialized){
+            throw std::runtime_error("arpc: MPI needs to be initialized before the creation of an execution service");
+        }
+
+        int thread_level = MPI_THREAD_SINGLE;
+        MPI_Query_thread(&thread_level);
+
+        if(mode == threading_mode::automatic){
+            mode = (thread_level >= MPI_THREAD_MULTIPLE) ? threading_mode::multiple : threading_mode::funneled;
+        }
+
+        if(mode == threading_mode::multiple && thread_level < MPI_THREAD_MULTIPLE){
+            throw std::runtime_error("arpc: the multiple threading mode requires MPI to be initialized with MPI_THREAD_MULTIPLE");
+        }
+        // the progress thread is not the thread initializing MPI and the service also calls MPI
+        // from the constructing thread, one thread at a time: MPI_THREAD_FUNNELED is not enough
+        if(mode == threading_mode::funneled && thread_level < MPI_THREAD_SERIALIZED){
+            throw std::runtime_error("arpc: the execution service requires MPI to be initialized with at least MPI_THREAD_SERIALIZED");
+        }
+        return mode == threading_mode::funneled;
+    }
+
+    static MPI_Comm duplicate_comm(MPI_Comm origin){
+        MPI_Comm dup_comm;
+        if(MPI_Comm_dup(origin, &dup_comm) != MPI_SUCCESS){
+            throw std::runtime_error("arpc: impossible to duplicate the service communicator");
+        }
+        return dup_comm;
+    }
+
+    inline vector_req_status send_bulk(const int* nodes, std::size_t n_nodes, int tag, const std::vector<char> & data){
+        vector_req_status futures;
+        futures.reserve(n_nodes);
+
+        for(std::size_t i = 0; i < n_nodes; ++i){
+            futures.emplace_back(std::move(comm.send_async(data, nodes[i], tag)));
+        }
+
+        return futures;
+    }
+
+    void send_messages(const int* nodes, std::size_t n_nodes, const std::vector<char> & header, const std::vector<char> & data,
+                       std::uint64_t* t_header){
+        if(data.size() <= eager_max_data){
+            send_inline(nodes, n_nodes, message_header::serialize_inline(header, data), t_header);
+            return;
+        }
+
+        if(funneled){
+            execute_mpi([&](std::vector<MPI_Request> & requests){
+                for(std::size_t i = 0; i < n_nodes; ++i){
+                    requests.emplace_back(isend(header, nodes[i], 1));
+                }
+                for(std::size_t i = 0; i < n_nodes; ++i){
+                    requests.emplace_back(isend(data, nodes[i], 2));
+                }
+            });
+            if(t_header != nullptr){
+                *t_header = internal::steady_time_ns();
+            }
+            return;
+        }
+
+        std::pair<vector_req_status, vector_req_status> futures;
+        {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            futures.first = send_bulk(nodes, n_nodes, 1, header);
+            futures.second = send_bulk(nodes, n_nodes, 2, data);
+        }
+
+        for(auto & f : futures.first){
+            f.wait();
+        }
+        if(t_header != nullptr){
+            *t_header = internal::steady_time_ns();
+        }
+        for(auto & f : futures.second){
+            f.wait();
+        }
+    }
+
+    // a single message: no pairing to preserve with the other senders
+    void send_inline(const int* nodes, std::size_t n_nodes, const std::vector<char> & message, std::uint64_t* t_header){
+        if(funneled){
+            execute_mpi([&](std::vector<MPI_Request> & requests){
+                for(std::size_t i = 0; i < n_nodes; ++i){
+                    requests.emplace_back(isend(message, nodes[i], 1));
+                }
+            });
+        }else{
+            for(auto & f : send_bulk(nodes, n_nodes, 1, message)){
+                f.wait();
+            }
+        }
+
+        if(t_header != nullptr){
+            *t_header = internal::steady_time_ns();
+        }
+    }
+
+    inline MPI_Request isend(const std::vector<char> & data, int rank, int tag){
+        MPI_Request request;
+        MPI_Isend(data.data(), int(data.size()), MPI_CHAR, rank, tag, raw_comm, &request);
+        return request;
+    }
+
+    void run(){
+        while(true){
+            pending_task task;
+
+            {
+                std::unique_lock<std::mutex> lock(task_mutex);
+                task_cond.wait(lock, [this]{
+                    return executors_finished || tasks.size() > 0;
+                });
+
+                if(tasks.size() == 0){
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task.header.dequeue_time = internal::steady_time_ns();
+            std::vector<char> data = task.data ? task.data->get() : std::move(task.payload);
+            task.header.data_time = internal::steady_time_ns();
+
+            recv_task(task.header.source, task.header, data);
+
+            if(task.pooled){
+                give_back_buffer(std::move(data));
+            }
+        }
+    }
+
+
+    void wakeup_poll(){
+        message_header wakeup;
+        wakeup.message_type = message_type_wakeup;
+        const std::vector<char> header_data = wakeup.serialize(), empty;
+        send_message(get_rank(), header_data, empty);
+    }
+
+    // funneled mode: start the submitted operations and complete the posted requests,
+    // return true if there was something to do
+    bool progress_operations(){
+        bool active = false;
+
+        while(mpi_operation* op = submissions.pop()){
+            active = true;
+            const std::size_t first = inflight_requests.size();
+            try{
+                op->start(inflight_requests);
+            }catch(...){
+                op->error = std::current_exception();
+            }
+
+            op->pending = inflight_requests.size() - first;
+            if(op->pending == 0){
+                op->completed.store(true, std::memory_order_release);
+                continue;
+            }
+            inflight_operations.resize(inflight_requests.size(), op);
+        }
+
+        if(inflight_requests.size() == 0){
+            return active;
+        }
+
+        int n_completed = 0;
+        completed_indices.resize(inflight_requests.size());
+        MPI_Testsome(int(inflight_requests.size()), inflight_requests.data(), &n_completed,
+                     completed_indices.data(), MPI_STATUSES_IGNORE);
+        if(n_completed == MPI_UNDEFINED || n_completed == 0){
+            return true;
+        }
+
+        for(int i = 0; i < n_completed; ++i){
+            mpi_operation* op = inflight_operations[completed_indices[i]];
+            op->pending -= 1;
+            if(op->pending == 0){
+                // op can be destroyed by its owner from here
+                op->completed.store(true, std::memory_order_release);
+            }
+        }
+
+        // the completed requests are set to MPI_REQUEST_NULL
+        std::size_t j = 0;
+        for(std::size_t i = 0; i < inflight_requests.size(); ++i){
+            if(inflight_requests[i] != MPI_REQUEST_NULL){
+                inflight_requests[j] = inflight_requests[i];
+                inflight_operations[j] = inflight_operations[i];
+                ++j;
+            }
+        }
+        inflight_requests.resize(j);
+        inflight_operations.resize(j);
+        return true;
+    }
+
+    // post the persistent receives of the ring, before the start of the progress thread
+    void post_ring(){
+        ring_memory.resize(eager_ring_size * eager_buffer_size);
+        ring_requests.resize(eager_ring_size, MPI_REQUEST_NULL);
+        for(std::size_t i = 0; i < eager_ring_size; ++i){
+            MPI_Recv_init(&ring_memory[i * eager_buffer_size], int(eager_buffer_size), MPI_CHAR,
+                          MPI_ANY_SOURCE, 1, raw_comm, &ring_requests[i]);
+        }
+        MPI_Startall(int(eager_ring_size), ring_requests.data());
+        ring_head = 0;
+    }
+
+    // progress thread, at the end of the service
+    void free_ring(){
+        for(auto & request : ring_requests){
+            MPI_Cancel(&request);
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+            MPI_Request_free(&request);
+        }
+    }
+
+    void poll(){
+        while(!finished){
+            const bool active = funneled && progress_operations();
+
+            // the progress thread has to serve the operations in funneled mode, it never blocks
+            const bool blocking = !funneled && (waiter.mode() == progress_mode::blocking);
+
+            // all the receives of the ring match the same messages: they complete in their posting order
+            MPI_Request & request = ring_requests[ring_head];
+            MPI_Status status;
+            int completed = 0;
+            if(blocking){
+                MPI_Wait(&request, &status);
+                completed = 1;
+            }else{
+                MPI_Test(&request, &completed, &status);
+            }
+
+            if(!completed){
+                if(!active){
+                    waiter.on_idle();
+                }
+                continue;
+            }
+
+            pending_task task;
+            task.header.probe_time = internal::steady_time_ns();
+            waiter.on_message();
+
+            int size = 0;
+            MPI_Get_count(&status, MPI_CHAR, &size);
+            const char* slot = &ring_memory[ring_head * eager_buffer_size];
+            task.header.deserialize(slot, std::size_t(size));
+            task.header.source = status.MPI_SOURCE;
+            if(task.header.flags & header_flag_inline){
+                // a single copy in a recycled buffer, the slot is reposted immediately
+                task.payload = take_buffer();
+                task.payload.assign(slot + message_header::serialized_data_size, slot + size);
+                task.pooled = true;
+            }
+
+            // the slot is free again
+            MPI_Start(&request);
+            ring_head = (ring_head +1) % eager_ring_size;
+
+            if(!(task.header.flags & header_flag_inline)){
+                // headers and data are sent in the same order by each peer:
+                // match the data of this header immediately to keep the pairs consistent
+                ::mpi::mpi_comm::message_handle data_handle = comm.probe(task.header.source, 2);
+                if(funneled || task.header.message_type == message_type_wakeup){
+                    // the executors do not call MPI: receive the data here
+                    comm.recv(data_handle, task.payload);
+                }else{
+                    task.data.reset(new req_status(comm.recv_async< std::vector<char> >(data_handle)));
+                }
+            }
+
+            if(task.header.message_type == message_type_wakeup){
+                continue;
+            }
+            task.header.reception_time = internal::steady_time_ns();
+
+            std::lock_guard<std::mutex> lock(task_mutex);
+            tasks.emplace_back(std::move(task));
+            task_cond.notify_one();
+        }
+
+        free_ring();
+    }
+
+
+    std::mutex task_mutex;
+    std::condition_variable task_cond;
+    std::mutex send_mutex;
+    std::deque<pending_task> tasks;
+
+
+    std::thread poll_thread;
+    std::vector<std::thread> executers;
+
+    // the task can take the data
+    std::function<void (int, message_header &, std::vector<char> &)> recv_task;
+
+    // the executors return once the queue is empty, under task_mutex
+    bool executors_finished;
+    // stop the progress thread, after the executors
+    std::atomic<bool> finished;
+
+    internal::progress_waiter waiter;
+
+    // funneled mode: only the progress thread calls MPI
+    const bool funneled;
+    internal::mpsc_queue<mpi_operation> submissions;
+    std::vector<MPI_Request> inflight_requests;
+    std::vector<mpi_operation*> inflight_operations;
+    std::vector<int> completed_indices;
+
+    // pre-posted receives of the headers and of the inline data
+    std::vector<char> ring_memory;
+    std::vector<MPI_Request> ring_requests;
+    std::size_t ring_head;
+
+    // recycled payload buffers of the inline messages
+    std::mutex spare_lock;
+    std::vector<std::vector<char> > spare_buffers;
+
+    MPI_Comm raw_comm;
+    ::mpi::mpi_comm comm;
+    const int my_rank;
+    const int my_size;
+};
+
+
+
+class exec_service_mpi::pimpl {
+public:
+    pimpl(int* argc, char*** argv, threading_mode mode) :
+        dispatch(nullptr),
+        default_compression(pack_compression(compression_options())),
+        graph_counter(0),
+        object_counter(0),
+        env(new ::mpi::mpi_scope_env(argc, argv)),
+        io(MPI_COMM_WORLD, mode, [&] (int rank, message_header& header, std::vector<char> & data) {
+            this->recv_handler(rank, header, data);
+        }),
+        n(tag_range1_begin),
+        loads(std::size_t(io.get_size())),
+        balancing(int(balancing_policy::power_of_two)) {}
+
+    pimpl(MPI_Comm comm, threading_mode mode) :
+        dispatch(nullptr),
+        default_compression(pack_compression(compression_options())),
+        graph_counter(0),
+        object_counter(0),
+        env(),
+        io(comm, mode, [&] (int rank, message_header& header, std::vector<char> & data) {
+            this->recv_handler(rank, header, data);
+        }),
+        n(tag_range1_begin),
+        loads(std::size_t(io.get_size())),
+        balancing(int(balancing_policy::power_of_two)) {}
+
+
+    void recv_handler(int rank, message_header & headers, std::vector<char> & data){
+        int callable_id = headers.request_id;
+        int request_id = headers.identifier_token;
+
+        // an answer gives back the credit of its request, possibly to a queued one
+        internal::credit_window::deferred_send next_send;
+        // the answer of a chain of forwarded calls does not come from the node of the request
+        const bool direct_answer = (headers.message_type == message_type_answer || headers.message_type == message_type_exception)
+                && (headers.flags & header_flag_forwarded) == 0;
+
+        if(direct_answer && credits.enabled()){
+            next_send = credits.release(rank);
+        }
+
+        if(direct_answer){
+            loads.on_answer(rank, headers.load);
+        }
+
+        if(headers.message_type == message_type_answer){ // response
+            const request_info info = req_stack.get_info_from_id(request_id);
+            const std::uint64_t latency = internal::steady_time_ns() - info.start_time;
+            metrics.update(info.callable_id, [&](internal::function_counters & m){
+                m.bytes_received += data.size();
+                m.latency.add(latency);
+            });
+
+            const std::uint64_t t_fulfil = internal::steady_time_ns();
+            internal::result_object& req = req_stack.take_answer(request_id);
+            bool completed;
+            if(headers.codec != std::uint8_t(compression_codec::none)){
+                try{
+                    completed = req.take_result(internal::decompress(compression_codec(headers.codec), data));
+                }catch(std::exception & e){
+                    completed = req.add_exception(e.what());
+                }
+            }else{
+                completed = req.take_result(std::move(data));
+            }
+            if(completed){
+                req_stack.pop_request(request_id);
+            }
+
+            if(headers.trace_id != 0){
+                traces.record(headers.trace_id, trace_stage::fulfil, info.callable_id, t_fulfil, internal::steady_time_ns());
+            }
+        }else if(headers.message_type == message_type_exception){
+            const request_info info = req_stack.get_info_from_id(request_id);
+            metrics.update(info.callable_id, [&](internal::function_counters & m){
+                m.bytes_received += data.size();
+                m.errors += 1;
+            });
+
+            internal::result_object& req = req_stack.take_answer(request_id);
+            const bool completed = req.add_exception(std::string(data.begin(), data.end()));
+            if(completed){
+                req_stack.pop_request(request_id);
+            }
+        }else if(headers.message_type == message_type_request){
+            std::vector<char> serialized_result;
+            std::uint8_t response_type = message_type_answer;
+            std::uint8_t response_codec = std::uint8_t(compression_codec::none);
+            internal::call_timing timing;
+            const std::uint64_t queue_wait = headers.dequeue_time - headers.reception_time;
+            const std::uint64_t t_call = internal::steady_time_ns();
+
+            try{
+                internal::callable_object* callable = find_function(callable_id);
+                if(callable == nullptr){
+                    throw std::runtime_error(std::string("no function registered with id '") + std::to_string(callable_id) + "'");
+                }
+                std::vector<char> decompressed;
+                if(headers.codec != std::uint8_t(compression_codec::none)){
+                    decompressed = internal::decompress(compression_codec(headers.codec), data);
+                }
+                const std::vector<char> & arguments = (headers.codec != std::uint8_t(compression_codec::none)) ? decompressed : data;
+
+                if(headers.flags & header_flag_batch){
+                    // the cache holds single calls only
+                    serialized_result = callable->deserialize_batch_and_call(arguments, &timing);
+                }else if(callable->is_pure() == false){
+                    serialized_result = callable->deserialize_and_call(arguments, &timing);
+                }else if(callable->get_cache().find(arguments, serialized_result) == false){
+                    serialized_result = callable->deserialize_and_call(arguments, &timing);
+                    callable->get_cache().insert(arguments, serialized_result);
+                }
+
+                std::vector<char> compressed_result;
+                response_codec = compress_payload(callable, serialized_result, compressed_result);
+                if(response_codec != std::uint8_t(compression_codec::none)){
+                    serialized_result.swap(compressed_result);
+                }
+            }catch(std::exception & e){
+                std::ostringstream ss;
+                ss << "<exception> on rank " << io.get_rank()
+                   << " with request from rank " << rank << " " << e.what();
+                const std::string msg = ss.str();
+
+                serialized_result.assign(msg.begin(), msg.end());
+                response_type = message_type_exception;
+                response_codec = std::uint8_t(compression_codec::none);
+            }
+
+            message_header response_headers;
+            response_headers.identifier_token = request_id;
+            response_headers.request_id = callable_id;
+            response_headers.message_type = response_type;
+            response_headers.codec = response_codec;
+            response_headers.trace_id = headers.trace_id;
+            response_headers.load = std::uint32_t(io.queue_depth());
+
+            metrics.update(callable_id, [&](internal::function_counters & m){
+                m.calls_received += 1;
+                m.bytes_received += data.size();
+                m.bytes_sent += serialized_result.size();
+                m.queue_wait.add(queue_wait);
+                if(response_type == message_type_exception){
+                    m.errors += 1;
+                }else{
+                    m.execution.add(timing.execution);
+                    m.serialization.add(timing.deserialization + timing.serialization);
+                }
+            });
+
+            std::vector<char> headers_data = response_headers.serialize();
+            io.send_message(rank, headers_data, serialized_result);
+
+            if(headers.trace_id != 0){
+                const std::uint64_t t_execute = t_call + timing.deserialization;
+                const std::uint64_t t_reply = t_execute + timing.execution;
+                traces.record(headers.trace_id, trace_stage::probe, callable_id, headers.probe_time, headers.reception_time);
+                traces.record(headers.trace_id, trace_stage::queue, callable_id, headers.reception_time, headers.dequeue_time);
+                traces.record(headers.trace_id, trace_stage::recv_data, callable_id, headers.dequeue_time, headers.data_time);
+                traces.record(headers.trace_id, trace_stage::deserialize, callable_id, t_call, t_execute);
+                traces.record(headers.trace_id, trace_stage::execute, callable_id, t_execute, t_reply);
+                traces.record(headers.trace_id, trace_stage::reply, callable_id, t_reply, internal::steady_time_ns());
+            }
+        }else if(headers.message_type == message_type_forward){
+            forward_handler(headers, data);
+        }else if(headers.message_type == message_type_graph_calls){
+            graph_calls_handler(rank, data);
+        }else if(headers.message_type == message_type_graph_input){
+            graph_input_handler(data);
+        }else if(headers.message_type == message_type_object){
+            object_handler(rank, headers, data);
+        }else{
+            std::cerr << "Error: recv message with unknown message type" << headers.message_type << "\n";
+        }
+
+        if(next_send){
+            next_send();
+        }
+    }
+
+
+    // a call of a chain: its result is sent to the next call, or to the node of the request at the end
+    void forward_handler(message_header & headers, const std::vector<char> & data){
+        const int callable_id = int(headers.request_id);
+
+        forward_envelope envelope;
+        message_header next_headers;
+        next_headers.identifier_token = headers.identifier_token;
+        std::vector<char> payload;
+        int dest = -1;
+
+        try{
+            if(headers.codec != std::uint8_t(compression_codec::none)){
+                envelope.deserialize(internal::decompress(compression_codec(headers.codec), data));
+            }else{
+                envelope.deserialize(data);
+            }
+
+            internal::callable_object* callable = find_function(callable_id);
+            if(callable == nullptr){
+                throw std::runtime_error(std::string("no function registered with id '") + std::to_string(callable_id) + "'");
+            }
+
+            std::vector<char> result = envelope.chained ? callable->deserialize_result_and_call(envelope.arguments)
+                                                        : callable->deserialize_and_call(envelope.arguments);
+
+            metrics.update(callable_id, [&](internal::function_counters & m){
+                m.calls_received += 1;
+                m.bytes_received += data.size();
+            });
+
+            if(envelope.stages.empty()){
+                dest = envelope.origin;
+                next_headers.message_type = message_type_answer;
+                next_headers.request_id = callable_id;
+                next_headers.flags = header_flag_forwarded;
+                payload.swap(result);
+            }else{
+                const internal::forward_stage next = envelope.stages.front();
+                envelope.stages.erase(envelope.stages.begin());
+                envelope.chained = 1;
+                envelope.arguments.swap(result);
+
+                dest = next.rank;
+                next_headers.message_type = message_type_forward;
+                next_headers.request_id = next.callable_id;
+                callable = find_function(next.callable_id);
+                payload = envelope.serialize();
+            }
+
+            std::vector<char> compressed;
+            next_headers.codec = compress_payload(callable, payload, compressed);
+            if(next_headers.codec != std::uint8_t(compression_codec::none)){
+                payload.swap(compressed);
+            }
+        }catch(std::exception & e){
+            if(envelope.origin < 0){
+                std::cerr << "Error: invalid forwarded call " << e.what() << "\n";
+                return;
+            }
+
+            std::ostringstream ss;
+            ss << "<exception> on rank " << io.get_rank()
+               << " with forwarded request from rank " << envelope.origin << " " << e.what();
+            const std::string msg = ss.str();
+
+            dest = envelope.origin;
+            next_headers.message_type = message_type_exception;
+            next_headers.request_id = callable_id;
+            next_headers.codec = std::uint8_t(compression_codec::none);
+            next_headers.flags = header_flag_forwarded;
+            payload.assign(msg.begin(), msg.end());
+        }
+
+        io.send_message(dest, next_headers.serialize(), payload);
+    }
+
+
+    // description of calls of a task graph, the ones with all their inputs are executed
+    void graph_calls_handler(int rank, const std::vector<char> & data){
+        std::vector<std::pair<graph_call_key, pending_graph_call> > ready;
+
+        try{
+            byte_reader reader(data);
+            const std::int32_t origin = reader.get<std::int32_t>();
+            const std::uint32_t graph_id = reader.get<std::uint32_t>();
+            const std::uint32_t n_calls = reader.get<std::uint32_t>();
+
+            for(std::uint32_t i = 0; i < n_calls; ++i){
+                const graph_call_key key(origin, graph_id, reader.get<std::uint32_t>());
+                const int callable_id = reader.get<std::int32_t>();
+                const std::int32_t output_token = reader.get<std::int32_t>();
+                const std::uint32_t n_arguments = reader.get<std::uint32_t>();
+
+                std::vector<std::pair<std::size_t, std::vector<char> > > values;
+                for(std::uint32_t slot = 0; slot < n_arguments; ++slot){
+                    if(reader.get<std::uint8_t>() == 0){
+                        values.emplace_back(slot, reader.get_bytes());
+                    }
+                }
+
+                std::vector<graph_consumer> consumers(reader.get<std::uint32_t>());
+                for(graph_consumer & consumer : consumers){
+                    consumer.rank = reader.get<std::int32_t>();
+                    consumer.call = reader.get<std::uint32_t>();
+                    consumer.slot = reader.get<std::uint32_t>();
+                }
+
+                std::lock_guard<std::mutex> lock(graph_lock);
+                pending_graph_call & call = graph_calls[key];
+                call.described = true;
+                call.callable_id = callable_id;
+                call.output_token = output_token;
+                call.n_arguments = n_arguments;
+                call.consumers.swap(consumers);
+                for(auto & value : values){
+                    call.set_argument(value.first, std::move(value.second));
+                }
+
+                if(call.ready()){
+                    ready.emplace_back(key, std::move(call));
+                    graph_calls.erase(key);
+                }
+            }
+        }catch(std::exception & e){
+            std::cerr << "Error: invalid task graph from rank " << rank << " " << e.what() << "\n";
+        }
+
+        for(auto & call : ready){
+            run_graph_call(call.first, call.second);
+        }
+    }
+
+    // result of an other call of a task graph
+    void graph_input_handler(const std::vector<char> & data){
+        graph_call_key key;
+        pending_graph_call ready_call;
+
+        try{
+            byte_reader reader(data);
+            const std::int32_t origin = reader.get<std::int32_t>();
+            const std::uint32_t graph_id = reader.get<std::uint32_t>();
+            key = graph_call_key(origin, graph_id, reader.get<std::uint32_t>());
+            const std::uint32_t slot = reader.get<std::uint32_t>();
+            const bool failed = (reader.get<std::uint8_t>() != 0);
+            std::vector<char> value = reader.get_bytes();
+
+            std::lock_guard<std::mutex> lock(graph_lock);
+            pending_graph_call & call = graph_calls[key];
+            if(failed && call.error.empty()){
+                call.error.assign(value.begin(), value.end());
+            }
+            call.set_argument(slot, std::move(value));
+
+            if(call.ready() == false){
+                return;
+            }
+            ready_call = std::move(call);
+            graph_calls.erase(key);
+        }catch(std::exception & e){
+            std::cerr << "Error: invalid task graph input " << e.what() << "\n";
+            return;
+        }
+
+        run_graph_call(key, ready_call);
+    }
+
+    // execute a call of a task graph, or propagate the error of its inputs
+    void run_graph_call(const graph_call_key & key, pending_graph_call & call){
+        const std::int32_t origin = std::get<0>(key);
+
+        std::vector<char> result;
+        std::string error = call.error;
+        if(error.empty()){
+            try{
+                internal::callable_object* callable = find_function(call.callable_id);
+                if(callable == nullptr){
+                    throw std::runtime_error(std::string("no function registered with id '") + std::to_string(call.callable_id) + "'");
+                }
+                result = callable->deserialize_values_and_call(call.arguments);
+
+                metrics.update(call.callable_id, [&](internal::function_counters & m){
+                    m.calls_received += 1;
+                    m.bytes_sent += result.size();
+                });
+            }catch(std::exception & e){
+                std::ostringstream ss;
+                ss << "<exception> on rank " << io.get_rank()
+                   << " in a task graph from rank " << origin << " " << e.what();
+                error = ss.str();
+            }
+        }
+
+        const bool failed = !error.empty();
+        const std::vector<char> error_data(error.begin(), error.end());
+        const std::vector<char> & value = failed ? error_data : result;
+
+        for(const graph_consumer & consumer : call.consumers){
+            byte_writer writer;
+            writer.put<std::int32_t>(origin);
+            writer.put<std::uint32_t>(std::get<1>(key));
+            writer.put<std::uint32_t>(consumer.call);
+            writer.put<std::uint32_t>(consumer.slot);
+            writer.put<std::uint8_t>(failed ? 1 : 0);
+            writer.put_bytes(value);
+
+            message_header headers;
+            headers.message_type = message_type_graph_input;
+            io.send_message(consumer.rank, headers.serialize(), writer.buffer);
+        }
+
+        if(call.output_token >= 0){
+            message_header headers;
+            headers.identifier_token = std::uint32_t(call.output_token);
+            headers.request_id = call.callable_id;
+            headers.message_type = failed ? message_type_exception : message_type_answer;
+            headers.flags = header_flag_forwarded;
+            io.send_message(origin, headers.serialize(), value);
+        }
+    }
+
+
+    // queue an operation on a remote object, run the ones in sequence if no other executor does
+    void object_handler(int rank, message_header & headers, const std::vector<char> & data){
+        std::uint64_t object_id = 0, sequence = 0;
+        object_operation_request request;
+        request.rank = rank;
+        request.token = headers.identifier_token;
+        request.id = int(headers.request_id);
+
+        try{
+            byte_reader reader(data);
+            object_id = reader.get<std::uint64_t>();
+            sequence = reader.get<std::uint64_t>();
+            request.operation = exec_service_mpi::object_operation(reader.get<std::uint8_t>());
+            request.arguments = reader.get_bytes();
+        }catch(std::exception & e){
+            std::cerr << "Error: invalid remote object operation from rank " << rank << " " << e.what() << "\n";
+            return;
+        }
+
+        std::shared_ptr<object_slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(objects_lock);
+            if(destroyed_objects.count(object_id) == 0){
+                std::shared_ptr<object_slot> & entry = objects[object_id];
+                if(!entry){
+                    entry = std::make_shared<object_slot>();
+                }
+                slot = entry;
+            }
+        }
+
+        // destroyed object, a detached slot answers the operation with an error
+        if(!slot){
+            slot = std::make_shared<object_slot>();
+            slot->destroyed = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(slot->lock);
+            slot->pending.emplace(sequence, std::move(request));
+            if(slot->running){
+                return;
+            }
+            slot->running = true;
+        }
+
+        while(true){
+            {
+                std::lock_guard<std::mutex> lock(slot->lock);
+                auto it = slot->destroyed ? slot->pending.begin() : slot->pending.find(slot->next_sequence);
+                if(it == slot->pending.end()){
+                    slot->running = false;
+                    return;
+                }
+                request = std::move(it->second);
+                slot->pending.erase(it);
+                slot->next_sequence += 1;
+            }
+
+            run_object_operation(object_id, *slot, request);
+        }
+    }
+
+    void run_object_operation(std::uint64_t object_id, object_slot & slot, object_operation_request & request){
+        message_header headers;
+        headers.identifier_token = request.token;
+        headers.request_id = request.id;
+        headers.message_type = message_type_answer;
+        // not a request of send_request, no credit
+        headers.flags = header_flag_forwarded;
+
+        std::vector<char> result;
+        try{
+            if(slot.destroyed){
+                throw std::runtime_error("remote object destroyed");
+            }
+
+            switch(request.operation){
+                case exec_service_mpi::object_operation::create:{
+                    // the calls report the reason of the failure
+                    try{
+                        std::shared_ptr<internal::object_factory> factory = find_object_entry(object_factories, request.id);
+                        if(!factory){
+                            throw std::runtime_error(std::string("no remote class registered with id '") + std::to_string(request.id) + "'");
+                        }
+                        slot.instance = factory->create(request.arguments);
+                    }catch(std::exception & e){
+                        slot.error = e.what();
+                        throw;
+                    }
+                    break;
+                }
+                case exec_service_mpi::object_operation::call:{
+                    if(!slot.instance){
+                        throw std::runtime_error(std::string("remote object not constructed ") + slot.error);
+                    }
+                    std::shared_ptr<internal::object_method> method = find_object_entry(object_methods, request.id);
+                    if(!method){
+                        throw std::runtime_error(std::string("no remote method registered with id '") + std::to_string(request.id) + "'");
+                    }
+                    result = method->call(slot.instance.get(), request.arguments);
+                    metrics.update(request.id, [&](internal::function_counters & m){
+                        m.calls_received += 1;
+                        m.bytes_received += request.arguments.size();
+                        m.bytes_sent += result.size();
+                    });
+                    break;
+                }
+                case exec_service_mpi::object_operation::destroy:{
+                    slot.instance.reset();
+                    {
+                        std::lock_guard<std::mutex> lock(slot.lock);
+                        slot.destroyed = true;
+                    }
+                    std::lock_guard<std::mutex> lock(objects_lock);
+                    objects.erase(object_id);
+                    // bounded: a stray operation on a recent id is answered instead of waiting forever
+                    destroyed_objects.insert(object_id);
+                    destroyed_order.push_back(object_id);
+                    if(destroyed_order.size() > max_destroyed_objects){
+                        destroyed_objects.erase(destroyed_order.front());
+                        destroyed_order.pop_front();
+                    }
+                    break;
+                }
+                default:
+                    throw std::runtime_error("invalid remote object operation");
+            }
+        }catch(std::exception & e){
+            std::ostringstream ss;
+            ss << "<exception> on rank " << io.get_rank()
+               << " with remote object operation from rank " << request.rank << " " << e.what();
+            const std::string msg = ss.str();
+
+            headers.message_type = message_type_exception;
+            result.assign(msg.begin(), msg.end());
+        }
+
+        io.send_message(request.rank, headers.serialize(), result);
+    }
+
+    template<typename Entry>
+    std::shared_ptr<Entry> find_object_entry(const std::unordered_map<int, std::shared_ptr<Entry> > & entries, int id){
+        std::lock_guard<std::mutex> lock(objects_lock);
+        auto it = entries.find(id);
+        return (it != entries.end()) ? it->second : std::shared_ptr<Entry>();
+    }
+
+
+    // take the credits of the request token for node_list, return the destinations
+    // to send to now. The queued sends keep their own copy of the message
+    std::vector<int> acquire_credits(const std::vector<int> & node_list, int token,
+                                     const std::vector<char> & header_data, const std::vector<char> & payload){
+        std::shared_ptr<std::vector<char> > shared_header, shared_payload;
+
+        try{
+            return credits.acquire(node_list, [&](int dest){
+                if(!shared_header){
+                    shared_header = std::make_shared<std::vector<char> >(header_data);
+                    shared_payload = std::make_shared<std::vector<char> >(payload);
+                }
+                auto my_header = shared_header;
+                auto my_payload = shared_payload;
+                return internal::credit_window::deferred_send([this, dest, my_header, my_payload]{
+                    io.send_message(dest, *my_header, *my_payload);
+                });
+            });
+        }catch(would_block & e){
+            // the calls attached to a deduplicated request fail with it
+            req_stack.get_request_from_id(token).add_exception(e.what());
+            req_stack.pop_request(token);
+            throw;
+        }
+    }
+
+
+    // attach result_handler to an identical request in flight, return false if there is none
+    bool attach_inflight(const std::string & key, int callable_id, std::unique_ptr<internal::result_object> & result_handler){
+        {
+            std::lock_guard<std::mutex> lock(inflight_lock);
+            auto it = inflight_requests.find(key);
+            if(it == inflight_requests.end()){
+                return false;
+            }
+            it->second->attach(std::move(result_handler));
+        }
+
+        metrics.update(callable_id, [&](internal::function_counters & m){
+            m.calls_deduplicated += 1;
+        });
+        return true;
+    }
+
+    // wrap result_handler in a request identical calls can attach to
+    std::unique_ptr<internal::result_object> make_shared_result(const std::string & key, std::unique_ptr<internal::result_object> && result_handler){
+        return std::unique_ptr<internal::result_object>(new shared_result(std::move(result_handler), [this, key](const shared_result* owner){
+            forget_inflight(key, owner);
+        }));
+    }
+
+    // the request is now the one identical calls attach to, if there is none already
+    void publish_inflight(const std::string & key, internal::result_object* request){
+        std::lock_guard<std::mutex> lock(inflight_lock);
+        inflight_requests.emplace(key, static_cast<shared_result*>(request));
+    }
+
+    void forget_inflight(const std::string & key, const shared_result* request){
+        std::lock_guard<std::mutex> lock(inflight_lock);
+        auto it = inflight_requests.find(key);
+        if(it != inflight_requests.end() && it->second == request){
+            inflight_requests.erase(it);
+        }
+    }
+
+
+    // header and data are sent concurrently from t_begin, the header completes at t_header
+    void trace_send(std::uint64_t trace_id, int callable_id, const internal::request_context & context,
+                    std::uint64_t t_begin, std::uint64_t t_header){
+        if(context.serialization_end != 0){
+            traces.record(trace_id, trace_stage::serialize, callable_id, context.serialization_begin, context.serialization_end);
+        }
+        traces.record(trace_id, trace_stage::send_header, callable_id, t_begin, t_header);
+        traces.record(trace_id, trace_stage::send_data, callable_id, t_begin, internal::steady_time_ns());
+    }
+
+    // compress data according to the function or service options,
+    // return the codec used. output is filled only when the payload is compressed
+    std::uint8_t compress_payload(const internal::callable_object* callable, const std::vector<char> & data, std::vector<char> & output){
+        const compression_options* options = (callable != nullptr) ? callable->get_compression() : nullptr;
+        if(options == nullptr){
+            const compression_options defaults = unpack_compression(default_compression.load(std::memory_order_relaxed));
+            return std::uint8_t(internal::compress(defaults, data, output));
+        }
+        return std::uint8_t(internal::compress(*options, data, output));
+    }
+
+    inline internal::callable_object* find_function(int id) const{
+        const dispatch_table* table = dispatch.load(std::memory_order_acquire);
+        return (table != nullptr) ? table->find(id) : nullptr;
+    }
+
+    // to call with map_locker held, once callable is in int_to_function_map
+    void publish_function(int id, internal::callable_object* callable){
+        if(!dispatch_tables.empty() && dispatch_tables.back()->insert(id, callable)){
+            return;
+        }
+
+        std::size_t capacity = 8;
+        while(capacity < int_to_function_map.size() *2){
+            capacity <<= 1;
+        }
+        std::unique_ptr<dispatch_table> table(new dispatch_table(capacity));
+        for(auto & f : int_to_function_map){
+            table->insert(f.first, f.second.get());
+        }
+        dispatch.store(table.get(), std::memory_order_release);
+
+        // previous tables can still be in use by the readers, they are kept until the
+        // service ends. Each one is half the size of the next: at most the size of the last one
+        dispatch_tables.emplace_back(std::move(table));
+    }
+
+    std::mutex map_locker;
+
+    std::atomic<const dispatch_table*> dispatch;
+
+    std::vector<std::unique_ptr<dispatch_table> > dispatch_tables;
+
+    std::unordered_map<int, std::shared_ptr<internal::callable_object> > int_to_function_map;
+
+    std::unordered_map<std::shared_ptr<internal::callable_object>, int > function_to_in_map;
+
+    std::unordered_map<std::string, int> name_to_int_map;
+
+
+    request_stack<internal::result_object> req_stack;
+
+    // see pack_compression
+    std::atomic<std::uint64_t> default_compression;
+
+    internal::metrics_registry metrics;
+
+    internal::trace_buffer traces;
+
+    internal::credit_window credits;
+
+    // task graphs submitted by this node
+    std::atomic<std::uint32_t> graph_counter;
+
+    // remote objects created by this node
+    std::atomic<std::uint64_t> object_counter;
+
+    // remote classes, methods and objects living on this node
+    std::mutex objects_lock;
+    std::unordered_map<int, std::shared_ptr<internal::object_factory> > object_factories;
+    std::unordered_map<int, std::shared_ptr<internal::object_method> > object_methods;
+    std::unordered_map<std::uint64_t, std::shared_ptr<object_slot> > objects;
+    // the last destroyed objects, oldest first in destroyed_order
+    std::unordered_set<std::uint64_t> destroyed_objects;
+    std::deque<std::uint64_t> destroyed_order;
+
+    // calls of task graphs waiting for their inputs or their description
+    std::mutex graph_lock;
+    std::map<graph_call_key, pending_graph_call> graph_calls;
+
+    // deduplicated requests waiting for their answer, by request key
+    std::mutex inflight_lock;
+    std::unordered_map<std::string, shared_result*> inflight_requests;
+
+
+    // null when MPI is managed by the application
+    std::unique_ptr< ::mpi::mpi_scope_env> env;
+    service_io io;
+    std::size_t n;
+
+    // client side load estimation of every node, for the calls to any node
+    internal::load_tracker loads;
+    std::atomic<int> balancing;
+};
+
+
+exec_service_mpi::exec_service_mpi(int* argc, char*** argv, threading_mode mode): d_ptr(new pimpl(argc, argv, mode)) {}
+
+exec_service_mpi::exec_service_mpi(MPI_Comm comm, threading_mode mode): d_ptr(new pimpl(comm, mode)) {}
+
+exec_service_mpi::~exec_service_mpi() {}
+
+
+int exec_service_mpi::register_function_internal(std::shared_ptr<internal::callable_object> callable){
+    std::size_t id = d_ptr->n +1;
+
+    {
+        std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+
+        if(d_ptr->int_to_function_map.insert(std::make_pair(id, callable)).second != true){
+            throw std::runtime_error(std::string("registered function with id '") + std::to_string(id) + "'' already exist" );
+        }
+
+        if(d_ptr->function_to_in_map.insert(std::make_pair(callable, id)).second != true){
+            throw std::runtime_error(std::string("registered function. ptr already registered ") + std::to_string(ptrdiff_t(callable.get())) );
+        }
+
+        d_ptr->n = id;
+        d_ptr->publish_function(int(id), callable.get());
+    }
+
+    d_ptr->io.barrier();
+    return id;
+}
+
+
+int exec_service_mpi::register_function_internal(const std::string & function_name, std::shared_ptr<internal::callable_object> callable){
+    const int id = function_id(function_name);
+
+    std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+
+    if(d_ptr->name_to_int_map.count(function_name) > 0){
+        throw std::runtime_error(std::string("registered function with name '") + function_name + "' already exist" );
+    }
+
+    if(d_ptr->int_to_function_map.count(id) > 0){
+        throw std::runtime_error(std::string("registered function with name '") + function_name
+                                 + "' collides with an other function with id '" + std::to_string(id) + "'" );
+    }
+
+    if(d_ptr->function_to_in_map.insert(std::make_pair(callable, id)).second != true){
+        throw std::runtime_error(std::string("registered function. ptr already registered ") + std::to_string(ptrdiff_t(callable.get())) );
+    }
+
+    d_ptr->int_to_function_map.insert(std::make_pair(id, callable));
+    d_ptr->name_to_int_map.insert(std::make_pair(function_name, id));
+    d_ptr->publish_function(id, callable.get());
+    return id;
+}
+
+
+int exec_service_mpi::resolve_function(const std::string & function_name){
+    std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+
+    auto it = d_ptr->name_to_int_map.find(function_name);
+    if(it == d_ptr->name_to_int_map.end()){
+        throw std::out_of_range(std::string("no function registered with name '") + function_name + "'");
+    }
+    return it->second;
+}
+
+
+std::shared_ptr<internal::callable_object> exec_service_mpi::resolve_function_internal(const std::string & function_name){
+    const int id = resolve_function(function_name);
+
+    std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+    return d_ptr->int_to_function_map[id];
+}
+
+
+void exec_service_mpi::set_compression(const compression_options & options){
+    d_ptr->default_compression.store(pack_compression(options), std::memory_order_relaxed);
+}
+
+
+void exec_service_mpi::set_progress(const progress_options & options){
+    d_ptr->io.set_progress(options);
+}
+
+
+void exec_service_mpi::set_flow_control(const flow_control_options & options){
+    const std::uint64_t local_window = options.window;
+    std::vector<std::uint64_t> all_windows(d_ptr->io.get_size());
+
+    MPI_Comm comm = d_ptr->io.get_raw_comm();
+    d_ptr->io.execute_mpi([&](std::vector<MPI_Request> & requests){
+        requests.emplace_back(MPI_REQUEST_NULL);
+        MPI_Iallgather(&local_window, 1, MPI_UINT64_T, all_windows.data(), 1, MPI_UINT64_T, comm, &requests.back());
+    });
+
+    d_ptr->credits.configure(options, std::vector<std::size_t>(all_windows.begin(), all_windows.end()));
+}
+
+
+int exec_service_mpi::register_object_factory(const std::string & class_name, std::shared_ptr<internal::object_factory> factory){
+    const int id = function_id(class_name);
+
+    std::lock_guard<std::mutex> lock(d_ptr->objects_lock);
+    if(d_ptr->object_factories.insert(std::make_pair(id, factory)).second != true){
+        throw std::runtime_error(std::string("registered remote class with name '") + class_name + "' already exist" );
+    }
+    return id;
+}
+
+
+int exec_service_mpi::register_object_method(const std::string & method_name, std::shared_ptr<internal::object_method> method){
+    const int id = function_id(method_name);
+
+    std::lock_guard<std::mutex> lock(d_ptr->objects_lock);
+    if(d_ptr->object_methods.insert(std::make_pair(id, method)).second != true){
+        throw std::runtime_error(std::string("registered remote method with name '") + method_name + "' already exist" );
+    }
+    return id;
+}
+
+
+std::uint64_t exec_service_mpi::new_object_id(){
+    // 24 bits of rank, 40 bits of sequence
+    return (std::uint64_t(d_ptr->io.get_rank()) << 40) | (d_ptr->object_counter.fetch_add(1) & ((std::uint64_t(1) << 40) -1));
+}
+
+
+void exec_service_mpi::send_object_operation(int rank, std::uint64_t object_id, std::uint64_t sequence, object_operation operation, int id,
+                                             const std::vector<char> & arguments, std::unique_ptr<internal::result_object> && result_handler){
+    if(rank < 0 || rank >= d_ptr->io.get_size()){
+        throw std::invalid_argument(std::string("invalid node ") + std::to_string(rank) + " for a remote object");
+    }
+
+    message_header headers;
+    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler), request_info(id, internal::steady_time_ns()));
+    headers.request_id = id;
+    headers.message_type = message_type_object;
+
+    byte_writer writer;
+    writer.put<std::uint64_t>(object_id);
+    writer.put<std::uint64_t>(sequence);
+    writer.put<std::uint8_t>(std::uint8_t(operation));
+    writer.put_bytes(arguments);
+
+    if(operation == object_operation::call){
+        d_ptr->metrics.update(id, [&](internal::function_counters & m){
+            m.calls_sent += 1;
+            m.bytes_sent += arguments.size();
+        });
+    }
+
+    d_ptr->io.notify_progress();
+    d_ptr->io.send_message(rank, headers.serialize(), writer.buffer);
+}
+
+
+void exec_service_mpi::send_graph(const internal::graph_description & graph, std::vector<std::unique_ptr<internal::result_object> > & outputs){
+    const std::size_t n_calls = graph.nodes.size();
+    if(outputs.size() != n_calls){
+        throw std::logic_error("invalid number of task graph outputs");
+    }
+
+    // the consumers of the result of each call
+    std::vector<std::vector<graph_consumer> > consumers(n_calls);
+    for(std::size_t i = 0; i < n_calls; ++i){
+        const internal::graph_node & node = graph.nodes[i];
+        if(node.rank < 0 || node.rank >= d_ptr->io.get_size()){
+            throw std::invalid_argument(std::string("invalid node ") + std::to_string(node.rank) + " in a task graph");
+        }
+
+        for(std::size_t slot = 0; slot < node.arguments.size(); ++slot){
+            const internal::graph_argument & argument = node.arguments[slot];
+            if(argument.dependency){
+                if(argument.source >= i){
+                    throw std::logic_error("a call of a task graph can only depend on the calls added before it");
+                }
+                consumers[argument.source].push_back(graph_consumer{ node.rank, std::uint32_t(i), std::uint32_t(slot) });
+            }
+        }
+    }
+
+    std::vector<std::int32_t> tokens(n_calls, -1);
+    for(std::size_t i = 0; i < n_calls; ++i){
+        if(outputs[i]){
+            tokens[i] = d_ptr->req_stack.register_req(std::move(outputs[i]), request_info(graph.nodes[i].callable_id, internal::steady_time_ns()));
+        }
+    }
+
+    const std::uint32_t graph_id = d_ptr->graph_counter.fetch_add(1);
+
+    // one message per node with all its calls
+    std::map<int, std::vector<std::size_t> > calls_per_rank;
+    for(std::size_t i = 0; i < n_calls; ++i){
+        calls_per_rank[graph.nodes[i].rank].push_back(i);
+    }
+
+    d_ptr->io.notify_progress();
+
+    for(auto & rank_calls : calls_per_rank){
+        byte_writer writer;
+        writer.put<std::int32_t>(d_ptr->io.get_rank());
+        writer.put<std::uint32_t>(graph_id);
+        writer.put<std::uint32_t>(std::uint32_t(rank_calls.second.size()));
+
+        for(std::size_t i : rank_calls.second){
+            const internal::graph_node & node = graph.nodes[i];
+            writer.put<std::uint32_t>(std::uint32_t(i));
+            writer.put<std::int32_t>(node.callable_id);
+            writer.put<std::int32_t>(tokens[i]);
+            writer.put<std::uint32_t>(std::uint32_t(node.arguments.size()));
+            for(const internal::graph_argument & argument : node.arguments){
+                writer.put<std::uint8_t>(argument.dependency ? 1 : 0);
+                if(!argument.dependency){
+                    writer.put_bytes(argument.value);
+                }
+            }
+
+            writer.put<std::uint32_t>(std::uint32_t(consumers[i].size()));
+            for(const graph_consumer & consumer : consumers[i]){
+                writer.put<std::int32_t>(consumer.rank);
+                writer.put<std::uint32_t>(consumer.call);
+                writer.put<std::uint32_t>(consumer.slot);
+            }
+
+            d_ptr->metrics.update(node.callable_id, [&](internal::function_counters & m){
+                m.calls_sent += 1;
+            });
+        }
+
+        message_header headers;
+        headers.message_type = message_type_graph_calls;
+        d_ptr->io.send_message(rank_calls.first, headers.serialize(), writer.buffer);
+    }
+}
+
+
+void exec_service_mpi::send_forward(const internal::forward_chain & chain, std::unique_ptr<internal::result_object> && result_handler){
+    if(chain.stages.empty()){
+        throw std::logic_error("empty chain of forwarded calls");
+    }
+    for(const internal::forward_stage & stage : chain.stages){
+        if(stage.rank < 0 || stage.rank >= d_ptr->io.get_size()){
+            throw std::invalid_argument(std::string("invalid node ") + std::to_string(stage.rank) + " in a chain of forwarded calls");
+        }
+    }
+
+    const internal::forward_stage & first = chain.stages.front();
+
+    forward_envelope envelope;
+    envelope.origin = d_ptr->io.get_rank();
+    envelope.stages.assign(chain.stages.begin() +1, chain.stages.end());
+    envelope.arguments = chain.arguments;
+
+    // the answer comes from the last call
+    message_header headers;
+    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler),
+                                                             request_info(chain.stages.back().callable_id, internal::steady_time_ns()));
+    headers.request_id = first.callable_id;
+    headers.message_type = message_type_forward;
+
+    std::vector<char> payload = envelope.serialize();
+    std::vector<char> compressed;
+    headers.codec = d_ptr->compress_payload(d_ptr->find_function(first.callable_id), payload, compressed);
+    if(headers.codec != std::uint8_t(compression_codec::none)){
+        payload.swap(compressed);
+    }
+
+    d_ptr->metrics.update(first.callable_id, [&](internal::function_counters & m){
+        m.calls_sent += 1;
+        m.bytes_sent += payload.size();
+    });
+
+    d_ptr->io.notify_progress();
+    d_ptr->io.send_message(first.rank, headers.serialize(), payload);
+}
+
+
+void exec_service_mpi::set_load_balancing(balancing_policy policy){
+    d_ptr->balancing.store(int(policy));
+}
+
+
+int exec_service_mpi::select_node(const std::vector<int> & candidates){
+    // the local queue is known without message
+    d_ptr->loads.set_queue_depth(d_ptr->io.get_rank(), std::uint32_t(d_ptr->io.queue_depth()));
+    return d_ptr->loads.select(candidates, balancing_policy(d_ptr->balancing.load()));
+}
+
+
+service_metrics exec_service_mpi::get_metrics(){
+    service_metrics res;
+    res.rank = d_ptr->io.get_rank();
+    res.queue_depth = d_ptr->io.queue_depth();
+    res.outstanding_requests = d_ptr->req_stack.outstanding();
+    res.queued_requests = d_ptr->credits.queued();
+    res.functions = d_ptr->metrics.aggregate();
+
+    std::lock_guard<std::mutex> lock(d_ptr->map_locker);
+    for(auto & f : d_ptr->int_to_function_map){
+        if(f.second->is_pure()){
+            const cache_stats stats = f.second->get_cache().stats();
+            function_metrics & m = res.functions[f.first];
+            m.cache_hits = stats.hits;
+            m.cache_misses = stats.misses;
+        }
+    }
+    return res;
+}
+
+
+void exec_service_mpi::dump_metrics(std::ostream & os){
+    get_metrics().to_json(os);
+}
+
+
+void exec_service_mpi::enable_tracing(bool enable){
+    d_ptr->traces.set_enabled(enable);
+}
+
+
+void exec_service_mpi::write_trace(const std::string & filename){
+    MPI_Comm comm = d_ptr->io.get_raw_comm();
+    const int rank = d_ptr->io.get_rank();
+    const int size = d_ptr->io.get_size();
+
+    std::vector<int> all_bytes(size, 0);
+    std::vector<int> displacements(size, 0);
+    std::vector<trace_event> all_events;
+
+    // blocking collectives, run by the progress thread in funneled mode
+    d_ptr->io.execute_mpi([&](std::vector<MPI_Request> &){
+        const std::int64_t offset = estimate_clock_offset(comm, rank, size);
+
+        std::vector<trace_event> events = d_ptr->traces.events();
+        for(auto & e : events){
+            e.begin = std::uint64_t(std::int64_t(e.begin) + offset);
+            e.end = std::uint64_t(std::int64_t(e.end) + offset);
+        }
+
+        int local_bytes = int(events.size() * sizeof(trace_event));
+        MPI_Gather(&local_bytes, 1, MPI_INT, all_bytes.data(), 1, MPI_INT, 0, comm);
+
+        for(int i = 1; i < size; ++i){
+            displacements[i] = displacements[i-1] + all_bytes[i-1];
+        }
+
+        if(rank == 0){
+            all_events.resize((displacements[size-1] + all_bytes[size-1]) / sizeof(trace_event));
+        }
+
+        MPI_Gatherv(events.data(), local_bytes, MPI_BYTE,
+                    all_events.data(), all_bytes.data(), displacements.data(), MPI_BYTE, 0, comm);
+    });
+
+    if(rank != 0){
+        return;
+    }
+
+    std::vector<std::vector<trace_event> > events_per_rank(size);
+    for(int i = 0; i < size; ++i){
+        auto begin = all_events.begin() + displacements[i] / sizeof(trace_event);
+        events_per_rank[i].assign(begin, begin + all_bytes[i] / sizeof(trace_event));
+    }
+
+    std::ofstream output(filename);
+    if(!output){
+        throw std::runtime_error(std::string("arpc: impossible to open trace file ") + filename);
+    }
+    internal::write_chrome_trace(output, events_per_rank);
+}
+
+
+void exec_service_mpi::barrier(){
+    d_ptr->io.barrier();
+}
+
+bool exec_service_mpi::is_funneled() const{
+    return d_ptr->io.is_funneled();
+}
+
+bool exec_service_mpi::is_local(int rank){
+    return d_ptr->io.get_rank() == rank;
+}
+
+int exec_service_mpi::rank() const{
+    return d_ptr->io.get_rank();
+}
+
+int exec_service_mpi::size() const{
+    return d_ptr->io.get_size();
+}
+
+void exec_service_mpi::send_request(int rank, int callable_id, const std::vector<char> & args_serialized,
+                  std::unique_ptr<internal::result_object> && result_handler, const internal::request_context & context){
+
+    // identical calls in flight share the first request
+    const internal::callable_object* callable = d_ptr->find_function(callable_id);
+    std::string request_key;
+    internal::result_object* shared_request = nullptr;
+    if(callable != nullptr && callable->deduplicates() && context.batch == false){
+        request_key = make_request_key(callable_id, rank, args_serialized);
+        if(d_ptr->attach_inflight(request_key, callable_id, result_handler)){
+            return;
+        }
+        result_handler = d_ptr->make_shared_result(request_key, std::move(result_handler));
+        shared_request = result_handler.get();
+    }
+
+    message_header headers;
+    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler), request_info(callable_id, internal::steady_time_ns()));
+    headers.request_id = callable_id;
+    headers.message_type = message_type_request;
+    headers.flags = context.batch ? header_flag_batch : 0;
+    headers.trace_id = d_ptr->traces.enabled() ? d_ptr->traces.new_trace_id(d_ptr->io.get_rank()) : 0;
+
+    std::vector<char> compressed_args;
+    headers.codec = d_ptr->compress_payload(callable, args_serialized, compressed_args);
+    const std::vector<char> & payload = (headers.codec != std::uint8_t(compression_codec::none)) ? compressed_args : args_serialized;
+
+    auto header_data = headers.serialize();
+
+    // before the credits: a queued request can be sent and answered at any time
+    if(shared_request != nullptr){
+        d_ptr->publish_inflight(request_key, shared_request);
+    }
+
+    // without credit the request can be queued, it is then sent by the reception of an answer
+    bool send_now = true;
+    if(d_ptr->credits.enabled()){
+        send_now = (d_ptr->acquire_credits(std::vector<int>(1, rank), headers.identifier_token, header_data, payload).size() > 0);
+    }
+
+    d_ptr->loads.on_send(rank);
+    d_ptr->metrics.update(callable_id, [&](internal::function_counters & m){
+        m.calls_sent += 1;
+        m.bytes_sent += payload.size();
+        m.serialization.add(context.serialization_end - context.serialization_begin);
+    });
+
+    if(!send_now){
+        return;
+    }
+
+    d_ptr->io.notify_progress();
+
+    const std::uint64_t t_begin = internal::steady_time_ns();
+    std::uint64_t t_header = 0;
+    d_ptr->io.send_message(rank, header_data, payload, &t_header);
+
+    if(headers.trace_id != 0){
+        d_ptr->trace_send(headers.trace_id, callable_id, context, t_begin, t_header);
+    }
+}
+
+void exec_service_mpi::send_request(std::vector<int> node_list, int callable_id, const std::vector<char> &args_serialized,
+                  std::unique_ptr<internal::result_object> &&result_handler, const internal::request_context & context){
+    message_header headers;
+    headers.identifier_token = d_ptr->req_stack.register_req(std::move(result_handler),
+                                                             request_info(callable_id, internal::steady_time_ns(), node_list.size()));
+    headers.request_id = callable_id;
+    headers.message_type = message_type_request;
+    headers.trace_id = d_ptr->traces.enabled() ? d_ptr->traces.new_trace_id(d_ptr->io.get_rank()) : 0;
+
+    std::vector<char> compressed_args;
+    headers.codec = d_ptr->compress_payload(d_ptr->find_function(callable_id), args_serialized, compressed_args);
+    const std::vector<char> & payload = (headers.codec != std::uint8_t(compression_codec::none)) ? compressed_args : args_serialized;
+
+    auto header_data = headers.serialize();
+
+    const std::size_t n_dest = node_list.size();
+    if(d_ptr->credits.enabled()){
+        // the queued requests count in the load of their destination
+        std::vector<int> send_now = d_ptr->acquire_credits(node_list, headers.identifier_token, header_data, payload);
+        for(int dest : node_list){
+            d_ptr->loads.on_send(dest);
+        }
+        node_list.swap(send_now);
+    }else{
+        for(int dest : node_list){
+            d_ptr->loads.on_send(dest);
+        }
+    }
+
+    d_ptr->metrics.update(callable_id, [&](internal::function_counters & m){
+        m.calls_sent += n_dest;
+        m.bytes_sent += payload.size() * n_dest;
+        m.serialization.add(context.serialization_end - context.serialization_begin);
+    });
+
+    d_ptr->io.notify_progress();
+
+    const std::uint64_t t_begin = internal::steady_time_ns();
+    std::uint64_t t_header = 0;
+    d_ptr->io.send_message_bulk(node_list, header_data, payload, &t_header);
+
+    if(headers.trace_id != 0){
+        d_ptr->trace_send(headers.trace_id, callable_id, context, t_begin, t_header);
     }
 
 }
@@ -0,0 +1,151 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <arpc/flow_control.hpp>
+
+namespace arpc {
+
+namespace internal{
+
+
+credit_window::credit_window() :
+    _enabled(false),
+    _lock(),
+    _cond(),
+    _options(),
+    _windows(),
+    _in_flight(),
+    _pending(),
+    _n_pending(0) {}
+
+
+void credit_window::configure(const flow_control_options & options, const std::vector<std::size_t> & windows){
+    std::lock_guard<std::mutex> l(_lock);
+
+    bool limited = false;
+    for(auto w : windows){
+        limited = limited || (w > 0);
+    }
+
+    _options = options;
+    _windows = windows;
+    // requests sent before the configuration are not accounted
+    _in_flight.assign(windows.size(), 0);
+    _pending.resize(windows.size());
+    _enabled.store(limited, std::memory_order_release);
+    _cond.notify_all();
+}
+
+
+bool credit_window::has_credit(int destination) const{
+    const std::size_t window = _windows[destination];
+    return (window == 0) || (_in_flight[destination] < window);
+}
+
+
+std::vector<int> credit_window::acquire(const std::vector<int> & node_list, const std::function<deferred_send (int)> & make_deferred){
+    std::unique_lock<std::mutex> l(_lock);
+
+    std::vector<int> ready;
+    ready.reserve(node_list.size());
+
+    switch(_options.policy){
+        case backpressure_policy::block:
+            // all the credits at once: holding some of them while waiting for
+            // the others would starve the other callers of these destinations
+            _cond.wait(l, [&]{
+                if(!enabled()){
+                    return true;
+                }
+                for(int dest : node_list){
+                    if(!has_credit(dest)){
+                        return false;
+                    }
+                }
+                return true;
+            });
+            for(int dest : node_list){
+                _in_flight[dest] += 1;
+                ready.push_back(dest);
+            }
+            break;
+
+        case backpressure_policy::would_block:
+            for(int dest : node_list){
+                if(!has_credit(dest)){
+                    throw would_block(std::string("no credit left for rank ") + std::to_string(dest));
+                }
+            }
+            for(int dest : node_list){
+                _in_flight[dest] += 1;
+                ready.push_back(dest);
+            }
+            break;
+
+        case backpressure_policy::queue:
+            for(int dest : node_list){
+                if(_pending[dest].size() >= _options.max_queued){
+                    throw would_block(std::string("local queue full for rank ") + std::to_string(dest));
+                }
+            }
+            for(int dest : node_list){
+                // a request never overtakes the queued ones
+                if(_pending[dest].empty() && has_credit(dest)){
+                    _in_flight[dest] += 1;
+                    ready.push_back(dest);
+                }else{
+                    _pending[dest].push_back(make_deferred(dest));
+                    _n_pending += 1;
+                }
+            }
+            break;
+    }
+
+    return ready;
+}
+
+
+credit_window::deferred_send credit_window::release(int destination){
+    std::lock_guard<std::mutex> l(_lock);
+
+    if(std::size_t(destination) >= _in_flight.size() || _in_flight[destination] == 0){
+        return deferred_send();
+    }
+
+    if(_pending[destination].size() > 0){
+        deferred_send next = std::move(_pending[destination].front());
+        _pending[destination].pop_front();
+        _n_pending -= 1;
+        return next;
+    }
+
+    _in_flight[destination] -= 1;
+    _cond.notify_all();
+    return deferred_send();
+}
+
+
+std::size_t credit_window::queued(){
+    std::lock_guard<std::mutex> l(_lock);
+    return _n_pending;
+}
+
+
+} // internal
+
+} // arpc
@@ -0,0 +1,101 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <thread>
+
+#include <arpc/future.hpp>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#endif
+
+namespace arpc {
+
+namespace internal{
+
+
+#ifdef __linux__
+
+namespace {
+
+long futex(std::atomic<std::uint32_t> & word, int op, std::uint32_t value, const struct timespec* timeout){
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex on a non lock free atomic");
+    return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op, value, timeout, nullptr, 0);
+}
+
+}
+
+
+void futex_wait(std::atomic<std::uint32_t> & word, std::uint32_t expected){
+    futex(word, FUTEX_WAIT_PRIVATE, expected, nullptr);
+}
+
+
+void futex_wait_for(std::atomic<std::uint32_t> & word, std::uint32_t expected, std::chrono::nanoseconds timeout){
+    if(timeout.count() <= 0){
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = time_t(timeout.count() / 1000000000);
+    ts.tv_nsec = long(timeout.count() % 1000000000);
+    futex(word, FUTEX_WAIT_PRIVATE, expected, &ts);
+}
+
+
+void futex_wake_all(std::atomic<std::uint32_t> & word){
+    futex(word, FUTEX_WAKE_PRIVATE, std::uint32_t(INT32_MAX), nullptr);
+}
+
+#else
+
+// no futex: the waiters poll with short sleeps
+
+namespace {
+
+const std::chrono::microseconds poll_interval(20);
+
+}
+
+
+void futex_wait(std::atomic<std::uint32_t> & word, std::uint32_t expected){
+    if(word.load() == expected){
+        std::this_thread::sleep_for(poll_interval);
+    }
+}
+
+
+void futex_wait_for(std::atomic<std::uint32_t> & word, std::uint32_t expected, std::chrono::nanoseconds timeout){
+    if(word.load() == expected && timeout.count() > 0){
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, poll_interval));
+    }
+}
+
+
+void futex_wake_all(std::atomic<std::uint32_t> &){}
+
+#endif
+
+
+} // internal
+
+} // arpc
@@ -0,0 +1,101 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <arpc/load_balancing.hpp>
+
+namespace arpc {
+
+namespace internal{
+
+
+namespace {
+
+std::minstd_rand & local_generator(){
+    thread_local std::minstd_rand generator(std::random_device{}());
+    return generator;
+}
+
+std::size_t random_index(std::size_t n){
+    return std::uniform_int_distribution<std::size_t>(0, n -1)(local_generator());
+}
+
+}
+
+
+load_tracker::load_tracker(std::size_t n_nodes) :
+    _nodes(new load_state[n_nodes]),
+    _n_nodes(n_nodes) {}
+
+
+std::uint64_t load_tracker::load(int node) const{
+    const load_state & state = _nodes[std::size_t(node)];
+    // an answer can be counted before its send on an other thread
+    const std::int64_t outstanding = std::max<std::int64_t>(0, state.outstanding.load(std::memory_order_relaxed));
+    return std::uint64_t(outstanding) + state.queue_depth.load(std::memory_order_relaxed);
+}
+
+
+int load_tracker::select(const std::vector<int> & candidates, balancing_policy policy) const{
+    if(candidates.empty()){
+        throw std::invalid_argument("no candidate node for the call");
+    }
+
+    for(int node : candidates){
+        if(node < 0 || std::size_t(node) >= _n_nodes){
+            throw std::invalid_argument(std::string("invalid candidate node ") + std::to_string(node));
+        }
+    }
+
+    if(candidates.size() == 1){
+        return candidates.front();
+    }
+
+    if(policy == balancing_policy::power_of_two){
+        const std::size_t first = random_index(candidates.size());
+        std::size_t second = random_index(candidates.size() -1);
+        if(second >= first){
+            second += 1;
+        }
+        const int a = candidates[first], b = candidates[second];
+        return (load(b) < load(a)) ? b : a;
+    }
+
+    // least loaded, start at a random position to spread the ties
+    const std::size_t start = random_index(candidates.size());
+    int best = candidates[start];
+    std::uint64_t best_load = load(best);
+    for(std::size_t i = 1; i < candidates.size() && best_load > 0; ++i){
+        const int node = candidates[(start + i) % candidates.size()];
+        const std::uint64_t node_load = load(node);
+        if(node_load < best_load){
+            best = node;
+            best_load = node_load;
+        }
+    }
+    return best;
+}
+
+
+} // internal
+
+} // arpc
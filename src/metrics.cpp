@@ -0,0 +1,307 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <atomic>
+#include <algorithm>
+#include <utility>
+
+#include <arpc/metrics.hpp>
+
+namespace arpc {
+
+
+namespace {
+
+std::atomic<std::uint64_t> registry_counter(0);
+
+void histogram_to_json(std::ostream & os, const latency_histogram & h){
+    os << "{ \"count\": " << h.count
+       << ", \"mean_ns\": " << h.mean()
+       << ", \"p50_ns\": " << h.percentile(0.50)
+       << ", \"p99_ns\": " << h.percentile(0.99)
+       << ", \"p999_ns\": " << h.percentile(0.999)
+       << ", \"max_ns\": " << h.max
+       << ", \"buckets\": [";
+
+    // trailing empty buckets are skipped
+    std::size_t last = h.n_buckets;
+    while(last > 0 && h.buckets[last-1] == 0){
+        --last;
+    }
+    for(std::size_t i =0; i < last; ++i){
+        os << ((i == 0) ? "" : ", ") << h.buckets[i];
+    }
+    os << "] }";
+}
+
+}
+
+
+latency_histogram::latency_histogram() :
+    buckets(),
+    count(0),
+    sum(0),
+    max(0){
+    buckets.fill(0);
+}
+
+
+void latency_histogram::add(std::uint64_t value_ns){
+    buckets[internal::latency_bucket(value_ns)] += 1;
+    count += 1;
+    sum += value_ns;
+    max = std::max(max, value_ns);
+}
+
+
+void latency_histogram::merge(const latency_histogram & other){
+    for(std::size_t i =0; i < n_buckets; ++i){
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+
+double latency_histogram::mean() const{
+    return (count == 0) ? 0.0 : double(sum) / double(count);
+}
+
+
+std::uint64_t latency_histogram::percentile(double q) const{
+    if(count == 0){
+        return 0;
+    }
+
+    const std::uint64_t target = std::max<std::uint64_t>(1, std::uint64_t(q * double(count) + 0.5));
+    std::uint64_t accumulated = 0;
+    for(std::size_t i =0; i < n_buckets; ++i){
+        accumulated += buckets[i];
+        if(accumulated >= target){
+            return std::min(max, (std::uint64_t(1) << (i+1)) -1);
+        }
+    }
+    return max;
+}
+
+
+function_metrics::function_metrics() :
+    calls_sent(0),
+    calls_deduplicated(0),
+    calls_received(0),
+    errors(0),
+    bytes_sent(0),
+    bytes_received(0),
+    cache_hits(0),
+    cache_misses(0),
+    serialization(),
+    queue_wait(),
+    execution(),
+    latency() {}
+
+
+void function_metrics::merge(const function_metrics & other){
+    calls_sent += other.calls_sent;
+    calls_deduplicated += other.calls_deduplicated;
+    calls_received += other.calls_received;
+    errors += other.errors;
+    bytes_sent += other.bytes_sent;
+    bytes_received += other.bytes_received;
+    cache_hits += other.cache_hits;
+    cache_misses += other.cache_misses;
+    serialization.merge(other.serialization);
+    queue_wait.merge(other.queue_wait);
+    execution.merge(other.execution);
+    latency.merge(other.latency);
+}
+
+
+service_metrics::service_metrics() :
+    rank(-1),
+    queue_depth(0),
+    outstanding_requests(0),
+    queued_requests(0),
+    functions() {}
+
+
+void service_metrics::to_json(std::ostream & os) const{
+    os << "{\n"
+       << "  \"rank\": " << rank << ",\n"
+       << "  \"queue_depth\": " << queue_depth << ",\n"
+       << "  \"outstanding_requests\": " << outstanding_requests << ",\n"
+       << "  \"queued_requests\": " << queued_requests << ",\n"
+       << "  \"functions\": [";
+
+    bool first = true;
+    for(auto & f : functions){
+        const function_metrics & m = f.second;
+        os << (first ? "\n" : ",\n")
+           << "    { \"id\": " << f.first
+           << ", \"calls_sent\": " << m.calls_sent
+           << ", \"calls_deduplicated\": " << m.calls_deduplicated
+           << ", \"calls_received\": " << m.calls_received
+           << ", \"errors\": " << m.errors
+           << ", \"bytes_sent\": " << m.bytes_sent
+           << ", \"bytes_received\": " << m.bytes_received
+           << ", \"cache_hits\": " << m.cache_hits
+           << ", \"cache_misses\": " << m.cache_misses
+           << ",\n      \"serialization\": ";
+        histogram_to_json(os, m.serialization);
+        os << ",\n      \"queue_wait\": ";
+        histogram_to_json(os, m.queue_wait);
+        os << ",\n      \"execution\": ";
+        histogram_to_json(os, m.execution);
+        os << ",\n      \"latency\": ";
+        histogram_to_json(os, m.latency);
+        os << " }";
+        first = false;
+    }
+    os << "\n  ]\n}\n";
+}
+
+
+
+namespace internal{
+
+
+std::size_t latency_bucket(std::uint64_t value_ns){
+    std::size_t bucket = 0;
+    std::uint64_t v = value_ns;
+    while(v > 1 && bucket < latency_histogram::n_buckets -1){
+        v >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+
+void histogram_counters::add(std::uint64_t value_ns){
+    buckets[latency_bucket(value_ns)] += 1;
+    count += 1;
+    sum += value_ns;
+    max.store_max(value_ns);
+}
+
+
+void histogram_counters::merge_into(latency_histogram & res) const{
+    for(std::size_t i =0; i < latency_histogram::n_buckets; ++i){
+        res.buckets[i] += buckets[i].load();
+    }
+    res.count += count.load();
+    res.sum += sum.load();
+    res.max = std::max(res.max, max.load());
+}
+
+
+void function_counters::merge_into(function_metrics & res) const{
+    res.calls_sent += calls_sent.load();
+    res.calls_deduplicated += calls_deduplicated.load();
+    res.calls_received += calls_received.load();
+    res.errors += errors.load();
+    res.bytes_sent += bytes_sent.load();
+    res.bytes_received += bytes_received.load();
+    serialization.merge_into(res.serialization);
+    queue_wait.merge_into(res.queue_wait);
+    execution.merge_into(res.execution);
+    latency.merge_into(res.latency);
+}
+
+
+function_counters & metrics_registry::thread_block::counters(int function_id){
+    // only the owner thread modifies the map: it can look up without the lock
+    auto it = functions.find(function_id);
+    if(it != functions.end()){
+        return it->second;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    return functions[function_id];
+}
+
+
+metrics_registry::metrics_registry() :
+    uid(registry_counter.fetch_add(1) +1),
+    blocks_lock(),
+    blocks() {}
+
+metrics_registry::~metrics_registry() {}
+
+
+metrics_registry::thread_block & metrics_registry::local(){
+    // a block lives as long as its registry, which owns it in blocks, and the
+    // uids are never reused: the block of a matching uid is alive
+    struct cache_entry{
+        std::uint64_t uid;
+        thread_block* block;
+        // only to drop the entries of the dead registries
+        std::weak_ptr<thread_block> owner;
+    };
+
+    // last registry used by this thread
+    thread_local std::uint64_t last_uid = 0;
+    thread_local thread_block* last_block = nullptr;
+    // every registry used by this thread
+    thread_local std::vector<cache_entry> cache;
+
+    if(last_uid == uid){
+        return *last_block;
+    }
+
+    for(auto & entry : cache){
+        if(entry.uid == uid){
+            last_uid = uid;
+            last_block = entry.block;
+            return *entry.block;
+        }
+    }
+
+    // slow path, first use by this thread: drop the blocks of dead registries
+    cache.erase(std::remove_if(cache.begin(), cache.end(), [](const cache_entry & entry){
+        return entry.owner.expired();
+    }), cache.end());
+
+    std::shared_ptr<thread_block> block = std::make_shared<thread_block>();
+    {
+        std::lock_guard<std::mutex> l(blocks_lock);
+        blocks.push_back(block);
+    }
+    cache.push_back(cache_entry{uid, block.get(), block});
+    last_uid = uid;
+    last_block = block.get();
+    return *block;
+}
+
+
+std::map<int, function_metrics> metrics_registry::aggregate(){
+    std::map<int, function_metrics> res;
+
+    std::lock_guard<std::mutex> l(blocks_lock);
+    for(auto & block : blocks){
+        std::lock_guard<std::mutex> lb(block->lock);
+        for(auto & f : block->functions){
+            f.second.merge_into(res[f.first]);
+        }
+    }
+    return res;
+}
+
+
+} // internal
+
+} // arpc
@@ -0,0 +1,155 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <thread>
+
+#include <arpc/progress.hpp>
+
+namespace arpc {
+
+constexpr std::chrono::microseconds::rep progress_options::default_park_us;
+constexpr std::chrono::microseconds::rep progress_options::max_park_us;
+
+namespace internal{
+
+
+namespace {
+
+std::uint64_t now_ns(){
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// shortest park of the adaptive mode
+const std::uint64_t min_park_ns = 1000;
+
+// an idle period longer than hot_factor times the mean interval between messages ends the spin
+const std::uint64_t hot_factor = 4;
+
+// adaptive mode: real spin at the beginning of the hot phase, then yield
+const std::uint64_t hot_spin_ns = 10000;
+
+inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+}
+
+
+progress_waiter::progress_waiter() :
+    _mode(int(progress_mode::busy_spin)),
+    _spin_budget(progress_options::default_spin_budget),
+    _park_ns(std::uint64_t(progress_options::default_park_us) * 1000),
+    _activity(false),
+    _parked(false),
+    _lock(),
+    _cond(),
+    _idle_rounds(0),
+    _idle_since(0),
+    _last_message(0),
+    _mean_interval(0) {}
+
+
+void progress_waiter::set_options(const progress_options & options){
+    _spin_budget.store(options.spin_budget);
+    const std::uint64_t park_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options.park_time).count();
+    _park_ns.store(std::min<std::uint64_t>(std::max<std::uint64_t>(1, park_ns), std::uint64_t(progress_options::max_park_us) * 1000));
+    _mode.store(int(options.mode));
+    notify();
+}
+
+
+void progress_waiter::on_message(){
+    const std::uint64_t now = now_ns();
+    if(_last_message != 0){
+        // exponential moving average, weight 1/8 to the last interval
+        const std::uint64_t interval = now - _last_message;
+        _mean_interval = (_mean_interval == 0) ? interval : _mean_interval - _mean_interval / 8 + interval / 8;
+    }
+    _last_message = now;
+    _idle_rounds = 0;
+    _idle_since = 0;
+}
+
+
+void progress_waiter::on_idle(){
+    if(_activity.exchange(false)){
+        _idle_rounds = 0;
+        _idle_since = 0;
+    }
+
+    _idle_rounds += 1;
+    if(_idle_rounds <= _spin_budget.load(std::memory_order_relaxed)){
+        return;
+    }
+
+    switch(mode()){
+        case progress_mode::busy_spin:
+        case progress_mode::blocking:
+            return;
+
+        case progress_mode::spin_yield:
+            std::this_thread::yield();
+            return;
+
+        case progress_mode::spin_park:
+            park(_park_ns.load(std::memory_order_relaxed));
+            return;
+
+        case progress_mode::adaptive:{
+            const std::uint64_t now = now_ns();
+            if(_idle_since == 0){
+                _idle_since = now;
+            }
+            const std::uint64_t idle = now - _idle_since;
+
+            // messages arrive at a sustained rate: the next one is expected soon
+            if(_mean_interval != 0 && idle < hot_factor * _mean_interval){
+                if(idle < hot_spin_ns){
+                    cpu_relax();
+                }else{
+                    std::this_thread::yield();
+                }
+                return;
+            }
+
+            park(std::min(_park_ns.load(std::memory_order_relaxed), std::max(min_park_ns, idle / 16)));
+            return;
+        }
+    }
+}
+
+
+void progress_waiter::park(std::uint64_t duration_ns){
+    std::unique_lock<std::mutex> l(_lock);
+    _parked.store(true);
+    _cond.wait_for(l, std::chrono::nanoseconds(duration_ns), [this]{
+        return _activity.load();
+    });
+    _parked.store(false);
+}
+
+
+} // internal
+
+} // arpc
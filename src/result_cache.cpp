@@ -0,0 +1,132 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <iterator>
+
+#include <arpc/result_cache.hpp>
+
+namespace arpc {
+
+namespace internal{
+
+
+namespace {
+
+// FNV-1a, 64 bits
+std::uint64_t hash_bytes(const std::vector<char> & data){
+    std::uint64_t value = 14695981039346656037ull;
+    for(char c : data){
+        value = (value ^ std::uint64_t(static_cast<unsigned char>(c))) * 1099511628211ull;
+    }
+    return value;
+}
+
+}
+
+
+result_cache::result_cache() :
+    _enabled(false),
+    _lock(),
+    _options(),
+    _entries(),
+    _index(),
+    _stats() {}
+
+
+void result_cache::configure(const cache_options & options){
+    std::lock_guard<std::mutex> l(_lock);
+    _options = options;
+    _entries.clear();
+    _index.clear();
+    _stats = cache_stats();
+    _enabled.store(options.capacity > 0, std::memory_order_release);
+}
+
+
+bool result_cache::find(const std::vector<char> & arguments, std::vector<char> & result){
+    const std::uint64_t hash = hash_bytes(arguments);
+
+    std::lock_guard<std::mutex> l(_lock);
+    auto it = _index.find(hash);
+    if(it == _index.end() || it->second->arguments != arguments){
+        _stats.misses += 1;
+        return false;
+    }
+
+    if(_options.ttl.count() > 0 && clock::now() >= it->second->expiry){
+        erase(it->second);
+        _stats.evictions += 1;
+        _stats.misses += 1;
+        return false;
+    }
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    result = _entries.front().result;
+    _stats.hits += 1;
+    return true;
+}
+
+
+void result_cache::insert(const std::vector<char> & arguments, const std::vector<char> & result){
+    const std::uint64_t hash = hash_bytes(arguments);
+
+    std::lock_guard<std::mutex> l(_lock);
+    if(_options.capacity == 0){
+        return;
+    }
+
+    // same arguments or hash collision: the newest result replaces the entry
+    auto it = _index.find(hash);
+    if(it != _index.end()){
+        erase(it->second);
+    }
+
+    while(_entries.size() >= _options.capacity){
+        erase(std::prev(_entries.end()));
+        _stats.evictions += 1;
+    }
+
+    _entries.push_front(entry{ hash, arguments, result, clock::now() + _options.ttl });
+    _index[hash] = _entries.begin();
+}
+
+
+void result_cache::clear(){
+    std::lock_guard<std::mutex> l(_lock);
+    _entries.clear();
+    _index.clear();
+}
+
+
+cache_stats result_cache::stats(){
+    std::lock_guard<std::mutex> l(_lock);
+    cache_stats res = _stats;
+    res.size = _entries.size();
+    return res;
+}
+
+
+void result_cache::erase(entry_list::iterator it){
+    _index.erase(it->hash);
+    _entries.erase(it);
+}
+
+
+} // internal
+
+} // arpc
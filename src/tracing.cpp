@@ -0,0 +1,169 @@
+/**
+    Copyright (C) 2016, Adrien Devress <adev@adev.name>
+
+        This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation, either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <limits>
+
+#include <arpc/tracing.hpp>
+
+namespace arpc {
+
+
+namespace {
+
+std::int32_t local_thread_id(){
+    return std::int32_t(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+}
+
+void write_event(std::ostream & os, int rank, const trace_event & e){
+    os << "{ \"name\": \"" << trace_stage_name(trace_stage(e.stage)) << "\""
+       << ", \"cat\": \"arpc\", \"ph\": \"X\""
+       << ", \"ts\": " << double(e.begin) / 1000.0
+       << ", \"dur\": " << double(e.end - e.begin) / 1000.0
+       << ", \"pid\": " << rank
+       << ", \"tid\": " << e.thread
+       << ", \"args\": { \"trace_id\": " << e.trace_id << ", \"function\": " << e.callable_id << " } }";
+}
+
+// flow arrows from the client send to the server probe, and from the server reply to the client
+void write_flow(std::ostream & os, int rank, const trace_event & e, bool start){
+    os << "{ \"name\": \"request\", \"cat\": \"arpc\", \"ph\": \"" << (start ? "s" : "f") << "\""
+       << ", \"bp\": \"e\""
+       << ", \"id\": " << e.trace_id
+       << ", \"ts\": " << double(start ? e.end : e.begin) / 1000.0
+       << ", \"pid\": " << rank
+       << ", \"tid\": " << e.thread << " }";
+}
+
+}
+
+
+const char* trace_stage_name(trace_stage stage){
+    switch(stage){
+        case trace_stage::serialize: return "serialize";
+        case trace_stage::send_header: return "send_header";
+        case trace_stage::send_data: return "send_data";
+        case trace_stage::probe: return "probe";
+        case trace_stage::queue: return "queue";
+        case trace_stage::recv_data: return "recv_data";
+        case trace_stage::deserialize: return "deserialize";
+        case trace_stage::execute: return "execute";
+        case trace_stage::reply: return "reply";
+        case trace_stage::fulfil: return "fulfil";
+        default: return "unknown";
+    }
+}
+
+
+namespace internal{
+
+
+trace_buffer::trace_buffer() :
+    _enabled(false),
+    _counter(0),
+    _lock(),
+    _events(),
+    _dropped(0) {}
+
+
+void trace_buffer::set_enabled(bool value){
+    _enabled.store(value);
+}
+
+
+std::uint64_t trace_buffer::new_trace_id(int rank){
+    // 24 bits of rank, 40 bits of sequence
+    return (std::uint64_t(rank +1) << 40) | ((_counter.fetch_add(1) +1) & ((std::uint64_t(1) << 40) -1));
+}
+
+
+void trace_buffer::record(std::uint64_t trace_id, trace_stage stage, int callable_id, std::uint64_t begin, std::uint64_t end){
+    trace_event e;
+    e.trace_id = trace_id;
+    e.begin = begin;
+    e.end = std::max(begin, end);
+    e.callable_id = callable_id;
+    e.thread = local_thread_id();
+    e.stage = std::uint8_t(stage);
+
+    std::lock_guard<std::mutex> l(_lock);
+    if(_events.size() >= default_max_events){
+        _dropped += 1;
+        return;
+    }
+    _events.push_back(e);
+}
+
+
+std::vector<trace_event> trace_buffer::events(){
+    std::lock_guard<std::mutex> l(_lock);
+    return _events;
+}
+
+
+std::size_t trace_buffer::dropped(){
+    std::lock_guard<std::mutex> l(_lock);
+    return _dropped;
+}
+
+
+void write_chrome_trace(std::ostream & os, const std::vector<std::vector<trace_event> > & events_per_rank){
+    // shift all timestamps to start at zero, more readable in the viewers
+    std::uint64_t origin = std::numeric_limits<std::uint64_t>::max();
+    for(auto & events : events_per_rank){
+        for(auto & e : events){
+            origin = std::min(origin, e.begin);
+        }
+    }
+
+    os << "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+
+    bool first = true;
+    for(std::size_t rank = 0; rank < events_per_rank.size(); ++rank){
+        os << (first ? "" : ",\n")
+           << "{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << rank
+           << ", \"args\": { \"name\": \"rank " << rank << "\" } }";
+        first = false;
+
+        for(trace_event e : events_per_rank[rank]){
+            e.begin -= origin;
+            e.end -= origin;
+
+            os << ",\n";
+            write_event(os, int(rank), e);
+
+            const trace_stage stage = trace_stage(e.stage);
+            if(stage == trace_stage::send_data || stage == trace_stage::reply){
+                os << ",\n";
+                write_flow(os, int(rank), e, true);
+            }else if(stage == trace_stage::probe || stage == trace_stage::fulfil){
+                os << ",\n";
+                write_flow(os, int(rank), e, false);
+            }
+        }
+    }
+
+    os << "\n] }\n";
+}
+
+
+} // internal
+
+} // arpc
@@ -0,0 +1,519 @@
+#include "benchmark.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <tuple>
+#include <stdexcept>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+
+namespace {
+
+// number of heap allocations done by the process, all threads included
+std::atomic<std::uint64_t> allocation_counter(0);
+
+}
+
+
+void* operator new(std::size_t size){
+    allocation_counter.fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size == 0 ? 1 : size)){
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* ptr) noexcept{
+    std::free(ptr);
+}
+
+
+namespace arpc_bench {
+
+
+std::vector<scenario_info> & scenario_registry(){
+    static std::vector<scenario_info> registry;
+    return registry;
+}
+
+
+namespace {
+
+
+struct driver_options{
+    driver_options() :
+        list(false),
+        filter(),
+        sizes(),
+        config(),
+        format("table"),
+        output(),
+        baseline(),
+        tolerance(10.0),
+        explicit_sizes(false),
+        explicit_iterations(false) {
+        // 1 B to 64 MiB, capped by the scenarios
+        for(std::size_t s = 1; s <= (std::size_t(64) << 20); s <<= 2){
+            sizes.push_back(s);
+        }
+    }
+
+    bool list;
+    std::string filter;
+    std::vector<std::size_t> sizes;
+    bench_config config;
+    std::string format;
+    std::string output;
+    std::string baseline;
+    double tolerance;
+    bool explicit_sizes;
+    bool explicit_iterations;
+};
+
+
+// the default iteration counts are reduced for the large payloads,
+// a run processes about this amount of data at most
+constexpr std::size_t iteration_byte_budget = std::size_t(256) << 20;
+constexpr std::size_t min_scaled_iterations = 10;
+
+
+struct bench_result{
+    std::string scenario;
+    std::size_t payload_size;
+    std::size_t n_parallel;
+    std::size_t samples;
+    double mean_us;
+    double min_us;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+    double ops_per_sec;
+    double mbytes_per_sec;
+    double cpu_us_per_op;
+    double allocs_per_op;
+};
+
+
+void print_usage(){
+    std::cout << "usage: arpc_bench [options]\n"
+              << "  --list                  list the scenarios\n"
+              << "  --filter <str>          run the scenarios whose name contains str\n"
+              << "  --sizes <s1,s2,...>     payload sizes in bytes for the sweeping scenarios\n"
+              << "                          (default powers of 4 from 1 B up to 64 MiB, each scenario\n"
+              << "                          stops at its own maximum, 64 KiB for the transport ones)\n"
+              << "  --parallel <n>          outstanding operations per iteration (default 1)\n"
+              << "  --window <n>            outstanding calls per destination of the windowed\n"
+              << "                          scenarios (default 0: 64 as the OSU benchmarks)\n"
+              << "  --iterations <n>        measured iterations per repetition (default 1000, fewer\n"
+              << "                          for the payloads over 256 KiB: about 256 MiB per repetition)\n"
+              << "  --warmup <n>            unmeasured iterations before the measure (default 100, scaled as well)\n"
+              << "  --repetitions <n>       number of repetitions (default 3)\n"
+              << "  --progress <busy_spin|spin_yield|spin_park|blocking|adaptive>\n"
+              << "                          progress mode of the service (default busy_spin)\n"
+              << "  --threading <automatic|multiple|funneled>\n"
+              << "                          use of MPI by the service (default automatic)\n"
+              << "  --format <table|csv|json>\n"
+              << "  --output <file>         write the results in file instead of stdout\n"
+              << "  --baseline <file.csv>   compare the results with a previous csv output\n"
+              << "  --tolerance <percent>   accepted regression against the baseline (default 10)\n";
+}
+
+
+arpc::progress_mode parse_progress_mode(const std::string & str){
+    if(str == "busy_spin"){
+        return arpc::progress_mode::busy_spin;
+    }else if(str == "spin_yield"){
+        return arpc::progress_mode::spin_yield;
+    }else if(str == "spin_park"){
+        return arpc::progress_mode::spin_park;
+    }else if(str == "blocking"){
+        return arpc::progress_mode::blocking;
+    }else if(str == "adaptive"){
+        return arpc::progress_mode::adaptive;
+    }
+    throw std::invalid_argument(std::string("unknown progress mode ") + str);
+}
+
+
+arpc::threading_mode parse_threading_mode(const std::string & str){
+    if(str == "automatic"){
+        return arpc::threading_mode::automatic;
+    }else if(str == "multiple"){
+        return arpc::threading_mode::multiple;
+    }else if(str == "funneled"){
+        return arpc::threading_mode::funneled;
+    }
+    throw std::invalid_argument(std::string("unknown threading mode ") + str);
+}
+
+
+std::vector<std::size_t> parse_sizes(const std::string & str){
+    std::vector<std::size_t> res;
+    std::istringstream ss(str);
+    std::string token;
+    while(std::getline(ss, token, ',')){
+        if(token.size() > 0){
+            res.push_back(boost::lexical_cast<std::size_t>(token));
+        }
+    }
+    return res;
+}
+
+
+driver_options parse_options(int argc, char** argv){
+    driver_options opts;
+
+    for(int i = 1; i < argc; ++i){
+        const std::string arg(argv[i]);
+
+        auto value = [&]() -> std::string {
+            if(i + 1 >= argc){
+                throw std::invalid_argument(std::string("missing value for option ") + arg);
+            }
+            return std::string(argv[++i]);
+        };
+
+        if(arg == "--list"){
+            opts.list = true;
+        }else if(arg == "--filter"){
+            opts.filter = value();
+        }else if(arg == "--sizes"){
+            opts.sizes = parse_sizes(value());
+            opts.explicit_sizes = true;
+        }else if(arg == "--parallel"){
+            opts.config.n_parallel = boost::lexical_cast<std::size_t>(value());
+        }else if(arg == "--window"){
+            opts.config.window = boost::lexical_cast<std::size_t>(value());
+        }else if(arg == "--iterations"){
+            opts.config.iterations = boost::lexical_cast<std::size_t>(value());
+            opts.explicit_iterations = true;
+        }else if(arg == "--warmup"){
+            opts.config.warmup = boost::lexical_cast<std::size_t>(value());
+        }else if(arg == "--repetitions"){
+            opts.config.repetitions = boost::lexical_cast<std::size_t>(value());
+        }else if(arg == "--progress"){
+            opts.config.progress.mode = parse_progress_mode(value());
+        }else if(arg == "--threading"){
+            opts.config.threading = parse_threading_mode(value());
+        }else if(arg == "--format"){
+            opts.format = value();
+        }else if(arg == "--output"){
+            opts.output = value();
+        }else if(arg == "--baseline"){
+            opts.baseline = value();
+        }else if(arg == "--tolerance"){
+            opts.tolerance = boost::lexical_cast<double>(value());
+        }else if(arg == "--help" || arg == "-h"){
+            print_usage();
+            std::exit(0);
+        }else{
+            throw std::invalid_argument(std::string("unknown option ") + arg);
+        }
+    }
+
+    if(opts.format != "table" && opts.format != "csv" && opts.format != "json"){
+        throw std::invalid_argument(std::string("unknown format ") + opts.format);
+    }
+    return opts;
+}
+
+
+double cpu_time_us(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6
+            + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+
+double percentile(const std::vector<double> & sorted, double q){
+    if(sorted.empty()){
+        return 0;
+    }
+    const std::size_t pos = std::min(sorted.size() -1, std::size_t(q * double(sorted.size())));
+    return sorted[pos];
+}
+
+
+bench_result run_scenario(const scenario_info & info, const bench_config & config){
+    // a fresh service per run: no state shared between the runs
+    arpc::exec_service_mpi service(MPI_COMM_WORLD, config.threading);
+    service.set_progress(config.progress);
+    bench_env env(service, config);
+
+    std::unique_ptr<scenario> sc = info.factory();
+    sc->setup(env);
+    service.barrier();
+
+    for(std::size_t i = 0; i < config.warmup; ++i){
+        sc->iteration(env);
+    }
+    service.barrier();
+
+    std::vector<double> samples;
+    samples.reserve(config.iterations * config.repetitions);
+
+    const double cpu_begin = cpu_time_us();
+    const std::uint64_t allocs_begin = allocation_counter.load();
+    for(std::size_t r = 0; r < config.repetitions; ++r){
+        for(std::size_t i = 0; i < config.iterations; ++i){
+            auto start = std::chrono::steady_clock::now();
+            sc->iteration(env);
+            auto stop = std::chrono::steady_clock::now();
+            samples.push_back(double(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()) / 1000.0);
+        }
+        service.barrier();
+    }
+    const double cpu_end = cpu_time_us();
+    const std::uint64_t allocs_end = allocation_counter.load();
+
+    sc->teardown(env);
+    service.barrier();
+
+    double total_us = 0;
+    for(auto s : samples){
+        total_us += s;
+    }
+
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    const double total_ops = double(env.ops_per_iteration) * double(samples.size());
+
+    bench_result res;
+    res.scenario = info.name;
+    res.payload_size = config.payload_size;
+    res.n_parallel = env.n_parallel;
+    res.samples = samples.size();
+    res.mean_us = samples.empty() ? 0 : total_us / double(samples.size());
+    res.min_us = sorted.empty() ? 0 : sorted.front();
+    res.p50_us = percentile(sorted, 0.50);
+    res.p99_us = percentile(sorted, 0.99);
+    res.p999_us = percentile(sorted, 0.999);
+    res.max_us = sorted.empty() ? 0 : sorted.back();
+    res.ops_per_sec = (total_us > 0) ? total_ops / (total_us / 1e6) : 0;
+    res.mbytes_per_sec = (total_us > 0) ? (double(env.bytes_per_iteration) * double(samples.size())) / total_us : 0;
+    res.cpu_us_per_op = (total_ops > 0) ? (cpu_end - cpu_begin) / total_ops : 0;
+    res.allocs_per_op = (total_ops > 0) ? double(allocs_end - allocs_begin) / total_ops : 0;
+    return res;
+}
+
+
+const char* csv_header = "scenario,payload_size,parallel,samples,mean_us,min_us,p50_us,p99_us,p999_us,max_us,ops_per_sec,mbytes_per_sec,cpu_us_per_op,allocs_per_op";
+
+
+void write_results(std::ostream & os, const std::string & format, const std::vector<bench_result> & results){
+    if(format == "csv"){
+        os << csv_header << "\n";
+        for(auto & r : results){
+            os << r.scenario << "," << r.payload_size << "," << r.n_parallel << "," << r.samples << ","
+               << r.mean_us << "," << r.min_us << "," << r.p50_us << "," << r.p99_us << "," << r.p999_us << ","
+               << r.max_us << "," << r.ops_per_sec << "," << r.mbytes_per_sec << "," << r.cpu_us_per_op << "," << r.allocs_per_op << "\n";
+        }
+    }else if(format == "json"){
+        os << "[";
+        bool first = true;
+        for(auto & r : results){
+            os << (first ? "\n" : ",\n")
+               << "  { \"scenario\": \"" << r.scenario << "\", \"payload_size\": " << r.payload_size
+               << ", \"parallel\": " << r.n_parallel << ", \"samples\": " << r.samples
+               << ", \"mean_us\": " << r.mean_us << ", \"min_us\": " << r.min_us
+               << ", \"p50_us\": " << r.p50_us << ", \"p99_us\": " << r.p99_us << ", \"p999_us\": " << r.p999_us
+               << ", \"max_us\": " << r.max_us << ", \"ops_per_sec\": " << r.ops_per_sec
+               << ", \"mbytes_per_sec\": " << r.mbytes_per_sec << ", \"cpu_us_per_op\": " << r.cpu_us_per_op
+               << ", \"allocs_per_op\": " << r.allocs_per_op << " }";
+            first = false;
+        }
+        os << "\n]\n";
+    }else{
+        os << std::left << std::setw(36) << "scenario" << std::right
+           << std::setw(10) << "bytes" << std::setw(6) << "par"
+           << std::setw(12) << "p50[us]" << std::setw(12) << "p99[us]" << std::setw(12) << "p999[us]"
+           << std::setw(12) << "max[us]" << std::setw(14) << "ops/s" << std::setw(12) << "MB/s"
+           << std::setw(12) << "cpu[us/op]" << std::setw(12) << "allocs/op" << "\n";
+        for(auto & r : results){
+            os << std::left << std::setw(36) << r.scenario << std::right
+               << std::setw(10) << r.payload_size << std::setw(6) << r.n_parallel
+               << std::setw(12) << r.p50_us << std::setw(12) << r.p99_us << std::setw(12) << r.p999_us
+               << std::setw(12) << r.max_us << std::setw(14) << r.ops_per_sec << std::setw(12) << r.mbytes_per_sec
+               << std::setw(12) << r.cpu_us_per_op << std::setw(12) << r.allocs_per_op << "\n";
+        }
+    }
+}
+
+
+typedef std::tuple<std::string, std::size_t, std::size_t> result_key;
+
+std::map<result_key, bench_result> read_baseline(const std::string & filename){
+    std::ifstream input(filename);
+    if(!input){
+        throw std::runtime_error(std::string("impossible to open baseline ") + filename);
+    }
+
+    std::map<result_key, bench_result> res;
+    std::string line;
+    std::getline(input, line); // header
+    while(std::getline(input, line)){
+        std::istringstream ss(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while(std::getline(ss, field, ',')){
+            fields.push_back(field);
+        }
+        if(fields.size() < 13){
+            continue;
+        }
+
+        bench_result r;
+        r.scenario = fields[0];
+        r.payload_size = boost::lexical_cast<std::size_t>(fields[1]);
+        r.n_parallel = boost::lexical_cast<std::size_t>(fields[2]);
+        r.p50_us = boost::lexical_cast<double>(fields[6]);
+        r.p99_us = boost::lexical_cast<double>(fields[7]);
+        r.ops_per_sec = boost::lexical_cast<double>(fields[10]);
+        res[result_key(r.scenario, r.payload_size, r.n_parallel)] = r;
+    }
+    return res;
+}
+
+
+// return the number of regressions
+std::size_t compare_baseline(std::ostream & os, const std::vector<bench_result> & results,
+                             const std::map<result_key, bench_result> & baseline, double tolerance){
+    std::size_t regressions = 0;
+    const double factor = tolerance / 100.0;
+
+    os << "\ncomparison with baseline, tolerance " << tolerance << "%\n";
+    for(auto & r : results){
+        auto it = baseline.find(result_key(r.scenario, r.payload_size, r.n_parallel));
+        if(it == baseline.end()){
+            os << "  " << r.scenario << " " << r.payload_size << " " << r.n_parallel << ": no baseline\n";
+            continue;
+        }
+
+        const bench_result & b = it->second;
+        const bool slower = r.p50_us > b.p50_us * (1.0 + factor);
+        const bool lower_rate = r.ops_per_sec < b.ops_per_sec * (1.0 - factor);
+
+        os << "  " << (slower || lower_rate ? "REGRESSION " : "ok         ")
+           << r.scenario << " " << r.payload_size << " " << r.n_parallel
+           << ": p50 " << b.p50_us << " -> " << r.p50_us << " us"
+           << ", ops/s " << b.ops_per_sec << " -> " << r.ops_per_sec << "\n";
+
+        if(slower || lower_rate){
+            regressions += 1;
+        }
+    }
+    return regressions;
+}
+
+
+} // anonymous
+
+} // arpc_bench
+
+
+int main(int argc, char** argv){
+    using namespace arpc_bench;
+
+    mpi::mpi_scope_env mpi_env(&argc, &argv);
+    mpi::mpi_comm comm;
+
+    driver_options opts;
+    try{
+        opts = parse_options(argc, argv);
+    }catch(std::exception & e){
+        if(comm.is_master()){
+            std::cerr << "error: " << e.what() << std::endl;
+            print_usage();
+        }
+        return 1;
+    }
+
+    std::vector<scenario_info> scenarios = scenario_registry();
+    std::sort(scenarios.begin(), scenarios.end(), [](const scenario_info & a, const scenario_info & b){
+        return a.name < b.name;
+    });
+
+    if(opts.list){
+        if(comm.is_master()){
+            for(auto & s : scenarios){
+                std::cout << std::left << std::setw(36) << s.name << s.description << "\n";
+            }
+        }
+        return 0;
+    }
+
+    std::vector<bench_result> results;
+
+    for(auto & info : scenarios){
+        if(opts.filter.size() > 0 && info.name.find(opts.filter) == std::string::npos){
+            continue;
+        }
+
+        if(comm.size() < info.min_ranks){
+            if(comm.is_master()){
+                std::cerr << "skip " << info.name << ", requires at least " << info.min_ranks << " ranks" << std::endl;
+            }
+            continue;
+        }
+
+        std::vector<std::size_t> sizes = info.sweep_payload ? opts.sizes : std::vector<std::size_t>(1, 0);
+        for(auto size : sizes){
+            if(!opts.explicit_sizes && size > info.max_payload){
+                continue;
+            }
+
+            bench_config config = opts.config;
+            config.payload_size = size;
+            if(!opts.explicit_iterations && size > 0){
+                const std::size_t scaled = std::max(min_scaled_iterations, iteration_byte_budget / size);
+                config.iterations = std::min(config.iterations, scaled);
+                config.warmup = std::min(config.warmup, std::max<std::size_t>(1, scaled / 10));
+            }
+
+            bench_result r = run_scenario(info, config);
+            if(comm.is_master()){
+                std::cerr << "done " << info.name << " " << size << " p50 " << r.p50_us << "us" << std::endl;
+                results.push_back(r);
+            }
+        }
+    }
+
+    int ret = 0;
+    if(comm.is_master()){
+        std::ofstream file;
+        if(opts.output.size() > 0){
+            file.open(opts.output);
+        }
+        std::ostream & os = (opts.output.size() > 0) ? file : std::cout;
+        write_results(os, opts.format, results);
+
+        if(opts.baseline.size() > 0){
+            try{
+                const std::size_t regressions = compare_baseline(std::cout, results, read_baseline(opts.baseline), opts.tolerance);
+                ret = (regressions > 0) ? 2 : 0;
+            }catch(std::exception & e){
+                std::cerr << "error: " << e.what() << std::endl;
+                ret = 1;
+            }
+        }
+    }
+
+    comm.barrier();
+    return ret;
+}
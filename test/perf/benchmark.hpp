@@ -0,0 +1,174 @@
+#ifndef ARPC_BENCHMARK_HPP
+#define ARPC_BENCHMARK_HPP
+
+#include <mpi-cpp/mpi.hpp>
+#include <arpc/arpc.hpp>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace arpc_bench {
+
+
+///
+/// \brief parameters of one run of a scenario
+///
+struct bench_config{
+    bench_config() :
+        payload_size(0),
+        n_parallel(1),
+        window(0),
+        iterations(1000),
+        warmup(100),
+        repetitions(3),
+        progress(),
+        threading(arpc::threading_mode::automatic) {}
+
+    std::size_t payload_size;
+    /// outstanding operations per iteration, meaning depends on the scenario
+    std::size_t n_parallel;
+    /// outstanding calls per destination of the windowed scenarios, 0 for their default
+    std::size_t window;
+    std::size_t iterations;
+    std::size_t warmup;
+    std::size_t repetitions;
+    /// progress strategy of the service
+    arpc::progress_options progress;
+    arpc::threading_mode threading;
+};
+
+
+///
+/// \brief environment given to the scenarios
+///
+/// a fresh execution service is created for each run
+///
+struct bench_env{
+    bench_env(arpc::exec_service_mpi & my_service, const bench_config & my_config) :
+        service(my_service),
+        config(my_config),
+        n_parallel(my_config.n_parallel),
+        ops_per_iteration(1),
+        bytes_per_iteration(0) {}
+
+    arpc::exec_service_mpi & service;
+    const bench_config & config;
+
+    /// outstanding operations reported with the results, the window for the windowed scenarios
+    std::size_t n_parallel;
+    /// to set by the scenario during setup, used for the throughput
+    std::size_t ops_per_iteration;
+    std::size_t bytes_per_iteration;
+
+    inline int rank() const{
+        return service.rank();
+    }
+
+    inline int size() const{
+        return service.size();
+    }
+};
+
+
+///
+/// \brief a benchmark scenario
+///
+/// setup, iteration and teardown are called on every rank. Each iteration is timed
+/// individually, the statistics reported are the ones of the rank 0
+///
+class scenario{
+public:
+    virtual ~scenario(){}
+
+    /// register the remote functions, allocate the payloads. Collective
+    virtual void setup(bench_env & env){
+        (void) env;
+    }
+
+    /// one measured iteration
+    virtual void iteration(bench_env & env) = 0;
+
+    /// called once all the iterations are done. Collective
+    virtual void teardown(bench_env & env){
+        (void) env;
+    }
+};
+
+
+/// largest size of the default payload sweep of the transport scenarios,
+/// their windows hold several copies of the payload
+constexpr std::size_t default_max_payload = 65536;
+
+
+struct scenario_info{
+    std::string name;
+    std::string description;
+    /// the scenario is run once per payload size
+    bool sweep_payload;
+    /// minimum number of ranks required
+    int min_ranks;
+    std::function<std::unique_ptr<scenario> ()> factory;
+    /// the default sweep skips the larger sizes, not an explicit --sizes
+    std::size_t max_payload;
+};
+
+
+std::vector<scenario_info> & scenario_registry();
+
+
+///
+/// \brief register a scenario at static initialization
+///
+struct scenario_registration{
+    scenario_registration(const std::string & name, const std::string & description,
+                          bool sweep_payload, int min_ranks,
+                          std::function<std::unique_ptr<scenario> ()> factory,
+                          std::size_t max_payload = default_max_payload){
+        scenario_registry().push_back(scenario_info{ name, description, sweep_payload, min_ranks, factory, max_payload });
+    }
+};
+
+
+template<typename Scenario>
+std::unique_ptr<scenario> make_scenario(){
+    return std::unique_ptr<scenario>(new Scenario());
+}
+
+
+/// payload of the given size with a non trivial content
+inline std::vector<char> make_payload(std::size_t size){
+    std::vector<char> res(size);
+    for(std::size_t i = 0; i < size; ++i){
+        res[i] = char(i);
+    }
+    return res;
+}
+
+
+} // arpc_bench
+
+
+#define ARPC_BENCH_CONCAT_IMPL(a, b) a##b
+#define ARPC_BENCH_CONCAT(a, b) ARPC_BENCH_CONCAT_IMPL(a, b)
+
+///
+/// register Scenario class under name
+///
+#define ARPC_BENCHMARK(name, description, sweep_payload, min_ranks, Scenario) \
+    static ::arpc_bench::scenario_registration ARPC_BENCH_CONCAT(arpc_bench_registration_, __LINE__)( \
+        name, description, sweep_payload, min_ranks, &::arpc_bench::make_scenario<Scenario>)
+
+///
+/// same as ARPC_BENCHMARK, the default payload sweep goes up to max_payload bytes
+///
+#define ARPC_BENCHMARK_UP_TO(name, description, sweep_payload, min_ranks, max_payload, Scenario) \
+    static ::arpc_bench::scenario_registration ARPC_BENCH_CONCAT(arpc_bench_registration_, __LINE__)( \
+        name, description, sweep_payload, min_ranks, &::arpc_bench::make_scenario<Scenario>, max_payload)
+
+
+#endif // ARPC_BENCHMARK_HPP
@@ -0,0 +1,199 @@
+#include "benchmark.hpp"
+
+#include <future>
+#include <vector>
+
+
+using namespace arpc;
+using namespace arpc_bench;
+
+
+namespace {
+
+
+typedef std::vector<char> vector_elems;
+
+// default number of outstanding calls per destination, same as the OSU benchmarks
+const std::size_t default_window = 64;
+
+
+std::size_t payload_sink(vector_elems elems){
+    return elems.size();
+}
+
+
+///
+/// base of the windowed scenarios: each sender keeps a window of outstanding calls
+/// per destination and waits for all of them at the end of the iteration
+///
+class windowed_scenario : public scenario{
+public:
+    windowed_scenario() : sink(payload_sink) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::payload_sink", sink);
+        elems = make_payload(env.config.payload_size);
+        window = (env.config.window > 0) ? env.config.window : default_window;
+        env.n_parallel = window;
+    }
+
+protected:
+    void post_window(int dest){
+        for(std::size_t i = 0; i < window; ++i){
+            futures.emplace_back(sink(dest, elems));
+        }
+    }
+
+    void post_window_bulk(const std::vector<int> & node_list){
+        for(std::size_t i = 0; i < window; ++i){
+            bulk_futures.emplace_back(sink(node_list, elems));
+        }
+    }
+
+    void wait_all(){
+        for(auto & f : futures){
+            if(f.get() != elems.size()){
+                throw std::runtime_error("invalid payload size received by the remote");
+            }
+        }
+        futures.clear();
+
+        for(auto & f : bulk_futures){
+            for(auto s : f.get()){
+                if(s != elems.size()){
+                    throw std::runtime_error("invalid payload size received by the remote");
+                }
+            }
+        }
+        bulk_futures.clear();
+    }
+
+    remote_function<std::size_t, vector_elems> sink;
+    vector_elems elems;
+    std::size_t window;
+    std::vector<arpc::future<std::size_t> > futures;
+    std::vector<std::future<std::vector<std::size_t> > > bulk_futures;
+};
+
+
+///
+/// unidirectional message rate and bandwidth, rank 0 to rank 1
+///
+class message_rate : public windowed_scenario{
+public:
+    void setup(bench_env & env) override{
+        windowed_scenario::setup(env);
+        env.ops_per_iteration = window;
+        env.bytes_per_iteration = window * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            post_window(1);
+            wait_all();
+        }
+    }
+};
+
+ARPC_BENCHMARK("message_rate", "window of calls from rank 0 to rank 1", true, 2, message_rate);
+
+
+///
+/// bidirectional bandwidth, rank 0 and 1 send a window to each other at the same time
+///
+class bidirectional_bandwidth : public windowed_scenario{
+public:
+    void setup(bench_env & env) override{
+        windowed_scenario::setup(env);
+        env.ops_per_iteration = 2 * window;
+        env.bytes_per_iteration = 2 * window * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() < 2){
+            post_window(1 - env.rank());
+            wait_all();
+        }
+        env.service.barrier();
+    }
+};
+
+ARPC_BENCHMARK("bidirectional_bw", "window of calls between rank 0 and 1 in both directions", true, 2, bidirectional_bandwidth);
+
+
+///
+/// many to one, every rank but 0 sends a window to rank 0
+///
+class incast : public windowed_scenario{
+public:
+    void setup(bench_env & env) override{
+        windowed_scenario::setup(env);
+        env.ops_per_iteration = std::size_t(env.size() -1) * window;
+        env.bytes_per_iteration = env.ops_per_iteration * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() != 0){
+            post_window(0);
+            wait_all();
+        }
+        env.service.barrier();
+    }
+};
+
+ARPC_BENCHMARK("incast", "window of calls from every rank to rank 0", true, 2, incast);
+
+
+///
+/// one to many, rank 0 sends a window of bulk calls to all the other ranks
+///
+class fan_out : public windowed_scenario{
+public:
+    void setup(bench_env & env) override{
+        windowed_scenario::setup(env);
+        for(int i = 1; i < env.size(); ++i){
+            node_list.push_back(i);
+        }
+        env.ops_per_iteration = node_list.size() * window;
+        env.bytes_per_iteration = env.ops_per_iteration * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            post_window_bulk(node_list);
+            wait_all();
+        }
+    }
+
+private:
+    std::vector<int> node_list;
+};
+
+ARPC_BENCHMARK("fan_out", "window of bulk calls from rank 0 to all the other ranks", true, 2, fan_out);
+
+
+///
+/// all pairs, every rank sends a window to every other rank
+///
+class all_pairs : public windowed_scenario{
+public:
+    void setup(bench_env & env) override{
+        windowed_scenario::setup(env);
+        env.ops_per_iteration = std::size_t(env.size()) * std::size_t(env.size() -1) * window;
+        env.bytes_per_iteration = env.ops_per_iteration * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        // shifted destinations, every rank does not hit the same peer at the same time
+        for(int i = 1; i < env.size(); ++i){
+            post_window((env.rank() + i) % env.size());
+        }
+        wait_all();
+        env.service.barrier();
+    }
+};
+
+ARPC_BENCHMARK("all_pairs", "window of calls from every rank to every other rank", true, 2, all_pairs);
+
+
+} // anonymous
@@ -22,7 +22,7 @@ inline const std::map<std::string, std::string>  fill_map(const std::map<std::st
     res.insert(std::make_pair<std::string,std::string>(std::to_string(comm.rank()),
                                                         std::string(fruits[comm.rank()%fruits.size()])));
 
-    std::cout << "** sending the result to the requester from node " << comm.rank()  << std::endl;
+    std::cout << "** sending the map filled on node " << comm.rank()  << std::endl;
     return res;
 }
 
@@ -34,15 +34,25 @@ int main(int argc, char** argv)
    exec_service_mpi service(&argc, &argv);
 
    remote_function<std::map<std::string, std::string>, std::map<std::string, std::string> > fill_map_function(fill_map);
+   // maps of strings compress well
+   fill_map_function.set_compression(compression_options(compression_codec::best_available));
    service.register_function(fill_map_function);
 
    mpi::mpi_comm comm;
 
    if(comm.rank() ==0){
-        std::map<std::string, std::string> res;
-
-        for(int i=0; i <comm.size(); ++i){
-            res = fill_map_function(i, res).get();
+        typedef std::map<std::string, std::string> fruit_map;
+        fruit_map res;
+
+        if(comm.size() == 1){
+            res = fill_map_function(0, res).get();
+        }else{
+            // each node sends its map directly to the next one, only the final map comes back
+            remote_result<fruit_map> partial = fill_map_function.remote(0, res);
+            for(int i=1; i < comm.size() -1; ++i){
+                partial = fill_map_function.remote(i, partial);
+            }
+            res = fill_map_function(comm.size() -1, partial).get();
         }
 
         for(auto & elem : res){
@@ -34,7 +34,7 @@ int main(int argc, char** argv)
 
    if(comm.rank() ==0){
         std::cout << "** calling an addition on node 1 from node 0" << std::endl;
-        std::future<int> future_result = addition(1, 40, 2);
+        arpc::future<int> future_result = addition(1, 40, 2);
 
         std::cout << "** non-blocking call ! " << std::endl;
         std::cout << "addition result: "  << future_result.get() << std::endl;
@@ -0,0 +1,222 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <future>
+#include <tuple>
+#include <vector>
+
+
+using namespace arpc;
+using namespace arpc_bench;
+
+
+namespace {
+
+
+typedef std::vector<char> vector_elems;
+
+vector_elems just_return(vector_elems elems){
+    return elems;
+}
+
+int dummy_add(const int v1, const int v2){
+    return v1 + v2;
+}
+
+
+///
+/// round trip of a payload between rank 0 and rank 1, one call at a time
+///
+class pingpong : public scenario{
+public:
+    pingpong() : echo(just_return) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::pingpong", echo);
+        elems = make_payload(env.config.payload_size);
+        env.bytes_per_iteration = 2 * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            if(echo(1, elems).get().size() != elems.size()){
+                throw std::runtime_error("pingpong: invalid answer size");
+            }
+        }
+    }
+
+private:
+    remote_function<vector_elems, vector_elems> echo;
+    vector_elems elems;
+};
+
+ARPC_BENCHMARK("pingpong", "payload echo between rank 0 and 1", true, 2, pingpong);
+
+
+///
+/// latency of a small call from rank 0 to rank 1 with n_parallel calls in flight
+///
+class call_latency : public scenario{
+public:
+    call_latency() : addition(dummy_add), v1(0), v2(1) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::add", addition);
+        env.ops_per_iteration = env.config.n_parallel;
+        futures.reserve(env.config.n_parallel);
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            for(std::size_t i = 0; i < env.config.n_parallel; ++i){
+                futures.emplace_back(addition(1, v1, v2));
+            }
+            for(auto & f : futures){
+                if(f.get() != v1 + v2){
+                    throw std::runtime_error("call_latency: invalid result");
+                }
+            }
+            futures.clear();
+            v1 += 10;
+            v2 += 20;
+        }
+    }
+
+private:
+    remote_function<int, int, int> addition;
+    std::vector<arpc::future<int> > futures;
+    int v1, v2;
+};
+
+ARPC_BENCHMARK("call_latency", "small call from rank 0 to rank 1, --parallel calls in flight", false, 2, call_latency);
+
+
+///
+/// the same small calls sent by rank 0 to rank 1 as a single batch of --parallel calls
+///
+class batch_calls : public scenario{
+public:
+    batch_calls() : addition(dummy_add) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::add", addition);
+        env.ops_per_iteration = env.config.n_parallel;
+        for(std::size_t i = 0; i < env.config.n_parallel; ++i){
+            calls.emplace_back(int(i), 1);
+        }
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            if(addition.batch(1, calls).get().size() != calls.size()){
+                throw std::runtime_error("batch_calls: missing results");
+            }
+        }
+    }
+
+private:
+    remote_function<int, int, int> addition;
+    std::vector<std::tuple<int, int> > calls;
+};
+
+ARPC_BENCHMARK("batch_calls", "batch of --parallel small calls from rank 0 to rank 1", false, 2, batch_calls);
+
+
+///
+/// bulk call from rank 0 to every rank
+///
+class multicast : public scenario{
+public:
+    multicast() : addition(dummy_add) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::add", addition);
+        for(int i = 0; i < env.size(); ++i){
+            node_list.push_back(i);
+        }
+        env.ops_per_iteration = node_list.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            if(addition(node_list, 1, 2).get().size() != node_list.size()){
+                throw std::runtime_error("multicast: missing results");
+            }
+        }
+    }
+
+private:
+    remote_function<int, int, int> addition;
+    std::vector<int> node_list;
+};
+
+ARPC_BENCHMARK("multicast", "bulk call from rank 0 to all the ranks", false, 1, multicast);
+
+
+///
+/// rank 0 scatters a payload over every rank in --parallel chunks per rank and gathers the results
+///
+class scatter_gather : public scenario{
+public:
+    scatter_gather() : echo(just_return) {}
+
+    void setup(bench_env & env) override{
+        env.service.register_function("bench::scatter_gather", echo);
+        for(int i = 0; i < env.size(); ++i){
+            node_list.push_back(i);
+        }
+        elems = make_payload(env.config.payload_size);
+        chunk_size = std::max<std::size_t>(1, elems.size() / (node_list.size() * env.config.n_parallel));
+        env.ops_per_iteration = (elems.size() + chunk_size -1) / chunk_size;
+        env.bytes_per_iteration = 2 * elems.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            std::size_t size = 0;
+            for(auto & chunk : echo.map(node_list, elems, chunk_size).get()){
+                size += chunk.size();
+            }
+            if(size != elems.size()){
+                throw std::runtime_error("scatter_gather: invalid answer size");
+            }
+        }
+    }
+
+private:
+    remote_function<vector_elems, vector_elems> echo;
+    std::vector<int> node_list;
+    vector_elems elems;
+    std::size_t chunk_size;
+};
+
+ARPC_BENCHMARK("scatter_gather", "payload split in chunks over all the ranks by rank 0, --parallel chunks per rank", true, 1, scatter_gather);
+
+
+///
+/// reference: the same addition run locally through std::async
+///
+class local_async : public scenario{
+public:
+    void setup(bench_env & env) override{
+        env.ops_per_iteration = env.config.n_parallel;
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            std::vector<std::future<int> > futures;
+            futures.reserve(env.config.n_parallel);
+            for(std::size_t i = 0; i < env.config.n_parallel; ++i){
+                futures.emplace_back(std::async(std::launch::async, [i]{ return dummy_add(int(i), 1); }));
+            }
+            for(auto & f : futures){
+                f.get();
+            }
+        }
+    }
+};
+
+ARPC_BENCHMARK("local_async", "reference, --parallel local std::async calls", false, 1, local_async);
+
+
+} // anonymous
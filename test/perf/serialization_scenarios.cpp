@@ -0,0 +1,343 @@
+#include "benchmark.hpp"
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/archives/portable_binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/types/map.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstring>
+#include <type_traits>
+
+
+using namespace arpc::internal;
+using namespace arpc_bench;
+
+
+namespace {
+
+
+std::size_t size_add(std::size_t v1, std::size_t v2){
+    return v1 + v2;
+}
+
+
+///
+/// full serialization path of a call without transport:
+/// serialize, deserialize_and_call, deserialize_result
+///
+class callable_roundtrip : public scenario{
+public:
+    callable_roundtrip() : callable(size_add), v1(0), v2(1) {}
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            std::vector<char> buffer = callable.serialize(v1, v2);
+            std::vector<char> res_buffer = callable.deserialize_and_call(buffer);
+            if(callable.deserialize_result(res_buffer) != v1 + v2){
+                throw std::runtime_error("callable_roundtrip: incorrect return value");
+            }
+            v1 += 10;
+            v2 += 20;
+        }
+    }
+
+private:
+    remote_callable<std::size_t, std::size_t, std::size_t> callable;
+    std::size_t v1, v2;
+};
+
+ARPC_BENCHMARK("callable_roundtrip", "serialization of a call and its result, no transport", false, 1, callable_roundtrip);
+
+
+
+//
+// serialization matrix: value types x archive modes
+// each iteration serializes then deserializes one value, on rank 0, through the
+// stream buffers of arpc (vector_ostreambuf, memory_istreambuf)
+//
+
+struct point{
+    std::int32_t id;
+    double x, y, z;
+
+    template<typename Archive>
+    void serialize(Archive & ar){
+        ar(id, x, y, z);
+    }
+
+    bool operator==(const point & other) const{
+        return id == other.id && x == other.x && y == other.y && z == other.z;
+    }
+};
+
+
+// value generators, payload_size is used by the sweeping ones
+
+// contiguous data up to 64 MiB. A map has one node per entry: its sweep stops earlier
+constexpr std::size_t max_sweep_payload = std::size_t(64) << 20;
+constexpr std::size_t max_node_sweep_payload = std::size_t(4) << 20;
+
+struct scalar_value{
+    typedef double value_type;
+    static const bool sweep = false;
+    static constexpr std::size_t max_payload = 0;
+
+    static value_type make(std::size_t){
+        return 3.14159;
+    }
+};
+
+struct struct_value{
+    typedef point value_type;
+    static const bool sweep = false;
+    static constexpr std::size_t max_payload = 0;
+
+    static value_type make(std::size_t){
+        return point{ 42, 1.0, 2.0, 3.0 };
+    }
+};
+
+// std::vector of POD, payload_size bytes of structs
+struct struct_vector_value{
+    typedef std::vector<point> value_type;
+    static const bool sweep = true;
+    static constexpr std::size_t max_payload = max_sweep_payload;
+
+    static value_type make(std::size_t payload_size){
+        value_type res(payload_size / sizeof(point));
+        for(std::size_t i = 0; i < res.size(); ++i){
+            res[i] = point{ std::int32_t(i), double(i), double(i) * 0.5, double(i) * 0.25 };
+        }
+        return res;
+    }
+};
+
+struct vector_value{
+    typedef std::vector<char> value_type;
+    static const bool sweep = true;
+    static constexpr std::size_t max_payload = max_sweep_payload;
+
+    static value_type make(std::size_t payload_size){
+        return make_payload(payload_size);
+    }
+};
+
+struct string_value{
+    typedef std::string value_type;
+    static const bool sweep = true;
+    static constexpr std::size_t max_payload = max_sweep_payload;
+
+    static value_type make(std::size_t payload_size){
+        std::string res(payload_size, ' ');
+        for(std::size_t i = 0; i < payload_size; ++i){
+            res[i] = char('a' + i % 26);
+        }
+        return res;
+    }
+};
+
+// about payload_size bytes of entries, a key and a string of 16 characters each
+struct map_value{
+    typedef std::map<int, std::string> value_type;
+    static const bool sweep = true;
+    static constexpr std::size_t max_payload = max_node_sweep_payload;
+
+    static value_type make(std::size_t payload_size){
+        value_type res;
+        const int n_entries = int(std::max<std::size_t>(1, payload_size / 32));
+        for(int i = 0; i < n_entries; ++i){
+            res[i] = string_value::make(16);
+        }
+        return res;
+    }
+};
+
+struct nested_value{
+    typedef std::map<std::string, std::vector<point> > value_type;
+    static const bool sweep = false;
+    static constexpr std::size_t max_payload = 0;
+
+    static value_type make(std::size_t){
+        value_type res;
+        for(int i = 0; i < 16; ++i){
+            std::vector<point> points;
+            for(int j = 0; j < 16; ++j){
+                points.push_back(point{ j, double(i), double(j), double(i * j) });
+            }
+            res[std::string("key_") + std::to_string(i)] = points;
+        }
+        return res;
+    }
+};
+
+
+// archive modes
+
+// the path of the arguments and results of arpc, the portable archive
+struct portable_archive{
+    template<typename T>
+    static void save(const T & value, std::vector<char> & buffer){
+        buffer = serialize_value(value);
+    }
+
+    template<typename T>
+    static void load(const std::vector<char> & buffer, T & value){
+        value = deserialize_value<T>(buffer);
+    }
+};
+
+// same stream buffers, native binary archive
+struct native_archive{
+    template<typename T>
+    static void save(const T & value, std::vector<char> & buffer){
+        std::vector<char> res;
+        vector_ostreambuf output(res);
+        std::ostream os(&output);
+        {
+            cereal::BinaryOutputArchive archiver(os);
+            archiver(value);
+        }
+        buffer.swap(res);
+    }
+
+    template<typename T>
+    static void load(const std::vector<char> & buffer, T & value){
+        memory_istreambuf input(buffer.data(), buffer.size());
+        std::istream is(&input);
+        cereal::BinaryInputArchive archiver(is);
+        archiver(value);
+    }
+};
+
+
+// fast path: memcpy of trivially copyable values and of contiguous containers of them
+struct raw_archive{
+    template<typename T>
+    static void save(const T & value, std::vector<char> & buffer){
+        static_assert(std::is_trivially_copyable<T>::value, "raw archive requires trivially copyable types");
+        buffer.resize(sizeof(T));
+        std::memcpy(&buffer[0], &value, sizeof(T));
+    }
+
+    template<typename T>
+    static void load(const std::vector<char> & buffer, T & value){
+        if(buffer.size() != sizeof(T)){
+            throw std::runtime_error("raw_archive: invalid buffer size");
+        }
+        std::memcpy(&value, buffer.data(), sizeof(T));
+    }
+
+    template<typename Container>
+    static void save_contiguous(const Container & value, std::vector<char> & buffer){
+        const std::uint64_t n = value.size();
+        buffer.resize(sizeof(n) + n * sizeof(typename Container::value_type));
+        std::memcpy(&buffer[0], &n, sizeof(n));
+        if(n > 0){
+            std::memcpy(&buffer[sizeof(n)], &value[0], n * sizeof(typename Container::value_type));
+        }
+    }
+
+    template<typename Container>
+    static void load_contiguous(const std::vector<char> & buffer, Container & value){
+        std::uint64_t n = 0;
+        if(buffer.size() < sizeof(n)){
+            throw std::runtime_error("raw_archive: invalid buffer size");
+        }
+        std::memcpy(&n, buffer.data(), sizeof(n));
+        value.resize(n);
+        if(n > 0){
+            std::memcpy(&value[0], &buffer[sizeof(n)], n * sizeof(typename Container::value_type));
+        }
+    }
+
+    static void save(const std::vector<char> & value, std::vector<char> & buffer){
+        save_contiguous(value, buffer);
+    }
+
+    static void load(const std::vector<char> & buffer, std::vector<char> & value){
+        load_contiguous(buffer, value);
+    }
+
+    static void save(const std::string & value, std::vector<char> & buffer){
+        save_contiguous(value, buffer);
+    }
+
+    static void load(const std::vector<char> & buffer, std::string & value){
+        load_contiguous(buffer, value);
+    }
+
+    static void save(const std::vector<point> & value, std::vector<char> & buffer){
+        save_contiguous(value, buffer);
+    }
+
+    static void load(const std::vector<char> & buffer, std::vector<point> & value){
+        load_contiguous(buffer, value);
+    }
+};
+
+
+template<typename Archive, typename Value>
+class serialization_roundtrip : public scenario{
+public:
+    typedef typename Value::value_type value_type;
+
+    void setup(bench_env & env) override{
+        input = Value::make(env.config.payload_size);
+        Archive::save(input, buffer);
+        env.bytes_per_iteration = buffer.size();
+    }
+
+    void iteration(bench_env & env) override{
+        if(env.rank() == 0){
+            Archive::save(input, buffer);
+            Archive::load(buffer, output);
+        }
+    }
+
+    void teardown(bench_env & env) override{
+        if(env.rank() == 0 && !(input == output)){
+            throw std::runtime_error("serialization_roundtrip: deserialized value differs from the input");
+        }
+    }
+
+private:
+    value_type input, output;
+    std::vector<char> buffer;
+};
+
+
+#define ARPC_SERIALIZATION_BENCHMARK(archive_name, Archive, value_name, Value) \
+    typedef serialization_roundtrip<Archive, Value> ARPC_BENCH_CONCAT(serialization_scenario_, __LINE__); \
+    ARPC_BENCHMARK_UP_TO("serialization/" archive_name "/" value_name, \
+                         "serialize and deserialize a " value_name " with the " archive_name " archive", \
+                         Value::sweep, 1, Value::max_payload, ARPC_BENCH_CONCAT(serialization_scenario_, __LINE__))
+
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "scalar", scalar_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "struct", struct_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "struct_vector", struct_vector_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "vector", vector_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "string", string_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "map", map_value);
+ARPC_SERIALIZATION_BENCHMARK("portable", portable_archive, "nested", nested_value);
+
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "scalar", scalar_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "struct", struct_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "struct_vector", struct_vector_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "vector", vector_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "string", string_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "map", map_value);
+ARPC_SERIALIZATION_BENCHMARK("native", native_archive, "nested", nested_value);
+
+// the raw mode only applies to trivially copyable data
+ARPC_SERIALIZATION_BENCHMARK("raw", raw_archive, "scalar", scalar_value);
+ARPC_SERIALIZATION_BENCHMARK("raw", raw_archive, "struct", struct_value);
+ARPC_SERIALIZATION_BENCHMARK("raw", raw_archive, "struct_vector", struct_vector_value);
+ARPC_SERIALIZATION_BENCHMARK("raw", raw_archive, "vector", vector_value);
+ARPC_SERIALIZATION_BENCHMARK("raw", raw_archive, "string", string_value);
+
+
+} // anonymous
@@ -5,11 +5,20 @@
 
 
 #include <arpc/arpc.hpp>
+#include <arpc/bits/mpsc_queue.hpp>
+#include <arpc/bits/open_hash_table.hpp>
+#include <arpc/bits/object_pool.hpp>
 
 
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
 
 
 int argc = boost::unit_test::framework::master_test_suite().argc;
@@ -82,8 +91,484 @@ BOOST_AUTO_TEST_CASE( remote_callable_lambda )
 
 
 
+// payload counting its copies
+struct counted_payload{
+    counted_payload() : values() {}
+    counted_payload(const counted_payload & other) : values(other.values) { copies += 1; }
+    counted_payload(counted_payload && other) : values(std::move(other.values)) {}
+    counted_payload & operator=(const counted_payload & other){ values = other.values; copies += 1; return *this; }
+    counted_payload & operator=(counted_payload && other){ values = std::move(other.values); return *this; }
+
+    template<typename Archive>
+    void serialize(Archive & ar){
+        ar(values);
+    }
+
+    std::vector<int> values;
+    static int copies;
+};
+
+int counted_payload::copies = 0;
+
+
+BOOST_AUTO_TEST_CASE( remote_callable_no_copy )
+{
+    using namespace arpc::internal;
+
+    remote_callable<counted_payload, counted_payload, int> callable([](counted_payload payload, int value){
+        payload.values.push_back(value);
+        return payload;
+    });
+
+    counted_payload input;
+    input.values.assign(1000, 1);
+    counted_payload::copies = 0;
+
+    // arguments archived in place, moved to the function, result archived in place
+    std::vector<char> buffer = callable.serialize(input, 2);
+    std::vector<char> res = callable.deserialize_and_call(buffer);
+    counted_payload output = callable.deserialize_result(res);
+
+    BOOST_CHECK_EQUAL(counted_payload::copies, 0);
+    BOOST_REQUIRE_EQUAL(output.values.size(), 1001u);
+    BOOST_CHECK_EQUAL(output.values.back(), 2);
+
+    // same format as a tuple of the arguments
+    BOOST_CHECK(buffer == arpc::internal::serialize_value(std::make_tuple(std::vector<int>(1000, 1), 2)));
+}
+
+
 BOOST_AUTO_TEST_CASE(  remote_function_test )
 {
     arpc_unit_tests::call_remote_function_test();
 }
 
+
+
+BOOST_AUTO_TEST_CASE( compression_round_trip )
+{
+    using namespace arpc;
+
+    std::vector<char> data;
+    for(std::size_t i =0; i < 100000; ++i){
+        data.push_back(char('a' + (i/7) % 3));
+    }
+
+    const compression_codec codecs[] = { compression_codec::lz4, compression_codec::zlib, compression_codec::best_available };
+
+    for(auto codec : codecs){
+        std::vector<char> compressed;
+        compression_codec used = internal::compress(compression_options(codec, 1024), data, compressed);
+
+        if(is_codec_available(codec) == false){
+            BOOST_CHECK(used == compression_codec::none);
+            continue;
+        }
+
+        BOOST_CHECK(used != compression_codec::none);
+        BOOST_CHECK(compressed.size() < data.size());
+        BOOST_CHECK(internal::decompress(used, compressed) == data);
+
+        // corrupted size prefix, rejected before any allocation
+        std::vector<char> corrupted(compressed);
+        const std::uint64_t huge_size = std::uint64_t(1) << 62;
+        std::memcpy(corrupted.data(), &huge_size, sizeof(huge_size));
+        BOOST_CHECK_THROW(internal::decompress(used, corrupted), std::runtime_error);
+    }
+
+    // under the threshold, never compressed
+    {
+        std::vector<char> small(data.begin(), data.begin() + 100), compressed;
+        BOOST_CHECK(internal::compress(compression_options(compression_codec::best_available, 1024), small, compressed) == compression_codec::none);
+        BOOST_CHECK(compressed.empty());
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE( metrics_histogram )
+{
+    using namespace arpc;
+
+    latency_histogram h;
+    BOOST_CHECK_EQUAL(h.percentile(0.5), 0);
+
+    for(std::uint64_t i = 1; i <= 1000; ++i){
+        h.add(i * 1000);
+    }
+
+    BOOST_CHECK_EQUAL(h.count, 1000);
+    BOOST_CHECK_EQUAL(h.max, 1000000);
+    BOOST_CHECK_CLOSE(h.mean(), 500500.0, 0.001);
+
+    // power of two buckets: at most a factor two above the real value
+    BOOST_CHECK(h.percentile(0.5) >= 500000 && h.percentile(0.5) < 1000000);
+    BOOST_CHECK(h.percentile(0.999) <= h.max);
+
+    latency_histogram h2;
+    h2.add(5);
+    h2.merge(h);
+    BOOST_CHECK_EQUAL(h2.count, 1001);
+}
+
+
+BOOST_AUTO_TEST_CASE( metrics_registry_threads )
+{
+    using namespace arpc;
+
+    const int n_threads = 4;
+    const std::uint64_t n_updates = 10000;
+
+    auto calls_of = [](internal::metrics_registry & registry){
+        std::uint64_t calls = 0;
+        for(auto & f : registry.aggregate()){
+            calls += f.second.calls_sent;
+        }
+        return calls;
+    };
+
+    // snapshots taken while the threads update their blocks
+    {
+        internal::metrics_registry registry;
+        std::atomic<bool> done(false);
+
+        std::vector<std::thread> threads;
+        for(int t = 0; t < n_threads; ++t){
+            threads.emplace_back([&, t]{
+                for(std::uint64_t i = 1; i <= n_updates; ++i){
+                    registry.update(int(i % 3), [&](internal::function_counters & m){
+                        m.calls_sent += 1;
+                        m.bytes_sent += std::uint64_t(t);
+                        m.latency.add(i);
+                    });
+                }
+            });
+        }
+        std::thread reader([&]{
+            while(!done.load()){
+                BOOST_CHECK(calls_of(registry) <= n_threads * n_updates);
+            }
+        });
+
+        for(auto & th : threads){
+            th.join();
+        }
+        done = true;
+        reader.join();
+
+        std::uint64_t bytes = 0, samples = 0, max = 0;
+        for(auto & f : registry.aggregate()){
+            bytes += f.second.bytes_sent;
+            samples += f.second.latency.count;
+            max = std::max(max, f.second.latency.max);
+        }
+        BOOST_CHECK_EQUAL(calls_of(registry), n_threads * n_updates);
+        BOOST_CHECK_EQUAL(bytes, n_updates * (0 + 1 + 2 + 3));
+        BOOST_CHECK_EQUAL(samples, n_threads * n_updates);
+        BOOST_CHECK_EQUAL(max, n_updates);
+    }
+
+    // one thread alternating between registries, destroyed in any order
+    auto one_call = [](internal::function_counters & m){
+        m.calls_sent += 1;
+    };
+    internal::metrics_registry first;
+    {
+        internal::metrics_registry second;
+        for(int i = 0; i < 10; ++i){
+            first.update(0, one_call);
+            second.update(0, one_call);
+        }
+        BOOST_CHECK_EQUAL(calls_of(first), 10);
+        BOOST_CHECK_EQUAL(calls_of(second), 10);
+    }
+    internal::metrics_registry third;
+    third.update(0, one_call);
+    first.update(0, one_call);
+    BOOST_CHECK_EQUAL(calls_of(first), 11);
+    BOOST_CHECK_EQUAL(calls_of(third), 1);
+}
+
+
+struct queue_item : public arpc::internal::mpsc_node<queue_item>{
+    int producer;
+    int value;
+};
+
+
+BOOST_AUTO_TEST_CASE( mpsc_queue_order )
+{
+    using namespace arpc;
+
+    const int n_producers = 4;
+    const int n_items = 10000;
+
+    std::vector<std::vector<queue_item> > items(n_producers);
+    for(auto & v : items){
+        v = std::vector<queue_item>(n_items);
+    }
+    internal::mpsc_queue<queue_item> queue;
+
+    BOOST_CHECK(queue.pop() == nullptr);
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < n_producers; ++p){
+        producers.emplace_back([&, p]{
+            for(int i = 0; i < n_items; ++i){
+                items[p][i].producer = p;
+                items[p][i].value = i;
+                queue.push(&items[p][i]);
+            }
+        });
+    }
+
+    // items of a producer come out in their push order
+    std::vector<int> next(n_producers, 0);
+    int received = 0;
+    while(received < n_producers * n_items){
+        queue_item* item = queue.pop();
+        if(item == nullptr){
+            std::this_thread::yield();
+            continue;
+        }
+        BOOST_CHECK_EQUAL(item->value, next[item->producer]);
+        next[item->producer] = item->value +1;
+        received += 1;
+    }
+
+    for(auto & t : producers){
+        t.join();
+    }
+    BOOST_CHECK(queue.pop() == nullptr);
+}
+
+
+BOOST_AUTO_TEST_CASE( load_tracker_selection )
+{
+    using namespace arpc;
+
+    internal::load_tracker loads(4);
+
+    // node 0: 3 requests in flight, node 1: 1, node 2: 5 waiting in its queue, node 3: idle
+    for(int i = 0; i < 3; ++i){
+        loads.on_send(0);
+    }
+    loads.on_send(1);
+    loads.set_queue_depth(2, 5);
+
+    BOOST_CHECK_EQUAL(loads.load(0), 3u);
+    BOOST_CHECK_EQUAL(loads.load(2), 5u);
+
+    const std::vector<int> all_nodes = { 0, 1, 2, 3 };
+    for(int i = 0; i < 20; ++i){
+        BOOST_CHECK_EQUAL(loads.select(all_nodes, balancing_policy::least_loaded), 3);
+        // both candidates are compared with two candidates
+        BOOST_CHECK_EQUAL(loads.select({ 0, 1 }, balancing_policy::power_of_two), 1);
+        BOOST_CHECK(loads.select(all_nodes, balancing_policy::power_of_two) != 2);
+    }
+
+    // the answers give the load back and carry the queue depth of the server
+    loads.on_answer(0, 0);
+    loads.on_answer(0, 0);
+    loads.on_answer(0, 0);
+    loads.on_answer(1, 4);
+    BOOST_CHECK_EQUAL(loads.load(0), 0u);
+    BOOST_CHECK_EQUAL(loads.load(1), 4u);
+    BOOST_CHECK_EQUAL(loads.select({ 1, 2, 0 }, balancing_policy::least_loaded), 0);
+
+    BOOST_CHECK_THROW(loads.select({}, balancing_policy::least_loaded), std::invalid_argument);
+    BOOST_CHECK_THROW(loads.select({ 0, 4 }, balancing_policy::power_of_two), std::invalid_argument);
+}
+
+
+BOOST_AUTO_TEST_CASE( open_hash_table_insert_find )
+{
+    using namespace arpc;
+
+    internal::open_hash_table<std::string, int> table;
+    BOOST_CHECK(table.find("absent") == nullptr);
+
+    const int n = 10000;
+    for(int i = 0; i < n; ++i){
+        std::pair<int*, bool> entry = table.insert(std::to_string(i));
+        BOOST_CHECK(entry.second);
+        BOOST_CHECK_EQUAL(*entry.first, 0);
+        *entry.first = i;
+    }
+    BOOST_CHECK_EQUAL(table.size(), std::size_t(n));
+    BOOST_CHECK(table.capacity() * 3 >= table.size() * 4);
+
+    // existing keys are not inserted twice, the values survive the growths
+    for(int i = 0; i < n; ++i){
+        std::pair<int*, bool> entry = table.insert(std::to_string(i));
+        BOOST_CHECK(!entry.second);
+        BOOST_CHECK_EQUAL(*entry.first, i);
+    }
+    BOOST_CHECK_EQUAL(table.size(), std::size_t(n));
+
+    BOOST_CHECK(table.find(std::to_string(n)) == nullptr);
+    BOOST_REQUIRE(table.find("42") != nullptr);
+    BOOST_CHECK_EQUAL(*table.find("42"), 42);
+
+    table.clear();
+    BOOST_CHECK_EQUAL(table.size(), 0u);
+    BOOST_CHECK(table.find("42") == nullptr);
+}
+
+
+BOOST_AUTO_TEST_CASE( arpc_future_promise )
+{
+    using namespace arpc;
+
+    {
+        internal::promise<std::string> prom;
+        future<std::string> fut = prom.get_future();
+        BOOST_CHECK(fut.valid());
+        BOOST_CHECK(fut.ready() == false);
+        BOOST_CHECK_THROW(prom.get_future(), std::future_error);
+
+        prom.set_value("ready");
+        BOOST_CHECK(fut.ready());
+        BOOST_CHECK_EQUAL(fut.get(), "ready");
+        BOOST_CHECK(fut.valid() == false);
+        BOOST_CHECK_THROW(prom.set_value("twice"), std::future_error);
+    }
+
+    // completion from an other thread wakes up the waiter
+    {
+        internal::promise<int> prom;
+        future<int> fut = prom.get_future();
+        BOOST_CHECK(fut.wait_for(std::chrono::milliseconds(1)) == std::future_status::timeout);
+
+        std::thread producer([&prom]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            prom.set_value(42);
+        });
+        BOOST_CHECK_EQUAL(fut.get(), 42);
+        producer.join();
+    }
+
+    {
+        internal::promise<int> prom;
+        future<int> fut = prom.get_future();
+        prom.set_exception(std::make_exception_ptr(remote_error("failed")));
+        BOOST_CHECK_THROW(fut.get(), remote_error);
+    }
+
+    {
+        future<int> fut;
+        {
+            internal::promise<int> prom;
+            fut = prom.get_future();
+        }
+        BOOST_CHECK_THROW(fut.get(), std::future_error);
+    }
+
+    // conversion to std::future before and after the completion
+    {
+        internal::promise<int> prom;
+        std::future<int> fut = prom.get_future();
+        prom.set_value(1);
+        BOOST_CHECK_EQUAL(fut.get(), 1);
+
+        internal::promise<int> later;
+        std::future<int> later_fut = later.get_future();
+        std::thread producer([&later]{
+            later.set_value(2);
+        });
+        BOOST_CHECK_EQUAL(later_fut.get(), 2);
+        producer.join();
+    }
+}
+
+
+struct pooled_block : public arpc::internal::pooled_allocation<pooled_block>{
+    char data[64];
+};
+
+
+BOOST_AUTO_TEST_CASE( pooled_allocation_reuse )
+{
+    pooled_block* first = new pooled_block();
+    delete first;
+
+    // the last block released is the next one given
+    pooled_block* second = new pooled_block();
+    BOOST_CHECK(first == second);
+
+    pooled_block* third = new pooled_block();
+    BOOST_CHECK(third != second);
+
+    delete second;
+    delete third;
+}
+
+
+struct returned_block : public arpc::internal::pooled_allocation<returned_block>{
+    char data[64];
+};
+
+
+BOOST_AUTO_TEST_CASE( pooled_allocation_cross_thread )
+{
+    // allocated here, deleted by an other thread: reused by this thread
+    std::vector<returned_block*> blocks;
+    for(int i = 0; i < 8; ++i){
+        blocks.push_back(new returned_block());
+    }
+
+    std::thread deleter([&blocks](){
+        for(returned_block* b : blocks){
+            delete b;
+        }
+    });
+    deleter.join();
+
+    std::vector<returned_block*> reused;
+    for(int i = 0; i < 8; ++i){
+        reused.push_back(new returned_block());
+        BOOST_CHECK(std::find(blocks.begin(), blocks.end(), reused.back()) != blocks.end());
+    }
+    for(returned_block* b : reused){
+        delete b;
+    }
+
+    // allocated by a thread already exited
+    returned_block* orphan = nullptr;
+    std::thread allocator([&orphan](){
+        orphan = new returned_block();
+    });
+    allocator.join();
+    delete orphan;
+
+    // an allocating thread, the blocks are deleted here concurrently
+    std::mutex lock;
+    std::vector<returned_block*> produced;
+    std::atomic<bool> done(false);
+    std::thread producer([&](){
+        for(int i = 0; i < 20000; ++i){
+            returned_block* b = new returned_block();
+            std::lock_guard<std::mutex> l(lock);
+            produced.push_back(b);
+        }
+        done = true;
+    });
+
+    std::size_t deleted = 0;
+    while(true){
+        const bool last = done.load();
+        std::vector<returned_block*> batch;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            batch.swap(produced);
+        }
+        for(returned_block* b : batch){
+            delete b;
+        }
+        deleted += batch.size();
+        if(last){
+            break;
+        }
+    }
+    producer.join();
+    BOOST_CHECK_EQUAL(deleted, 20000u);
+}
@@ -12,6 +12,11 @@
 #include <vector>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <list>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 
 int argc = boost::unit_test::framework::master_test_suite().argc;
@@ -179,3 +184,1301 @@ BOOST_AUTO_TEST_CASE( remote_function_multi_cast )
 
 
 
+
+
+BOOST_AUTO_TEST_CASE( remote_function_sub_communicator )
+{
+    std::cout << "sub communicator remote function test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    // split the world in two groups, odd and even ranks
+    MPI_Comm sub_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, comm.rank() % 2, comm.rank(), &sub_comm);
+
+    {
+        // two isolated services in the same process
+        exec_service_mpi world_pool(MPI_COMM_WORLD);
+        exec_service_mpi sub_pool(sub_comm);
+
+        int sub_rank, sub_size;
+        MPI_Comm_rank(sub_comm, &sub_rank);
+        MPI_Comm_size(sub_comm, &sub_size);
+
+        BOOST_CHECK_EQUAL(sub_pool.rank(), sub_rank);
+        BOOST_CHECK_EQUAL(sub_pool.size(), sub_size);
+        BOOST_CHECK_EQUAL(world_pool.size(), comm.size());
+
+        remote_function<int, std::string, int> hello_world(hello_rank);
+        world_pool.register_function(hello_world);
+
+        remote_function<int, std::string, int> hello_sub(hello_rank);
+        sub_pool.register_function(hello_sub);
+
+        // ranks are relative to the service communicator
+        const int sub_dest = (sub_pool.rank() +1) % sub_pool.size();
+        const int world_dest = (world_pool.rank() +1) % world_pool.size();
+
+        std::future<int> res_sub = hello_sub(sub_dest, "sub", 0);
+        std::future<int> res_world = hello_world(world_dest, "world", 0);
+
+        BOOST_CHECK_EQUAL(res_world.get(), world_dest);
+
+        // hello_rank answers the world rank of the executing node
+        const int expected_world_rank = (sub_dest * 2) + comm.rank() % 2;
+        BOOST_CHECK_EQUAL(res_sub.get(), expected_world_rank);
+    }
+
+    MPI_Comm_free(&sub_comm);
+    comm.barrier();
+}
+
+
+int add_function(int a, int b){
+    return a + b;
+}
+
+int sub_function(int a, int b){
+    return a - b;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_named_registration )
+{
+    std::cout << "named registration remote function test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int, int> add(add_function);
+    remote_function<int, int, int> sub(sub_function);
+
+    // registration order does not matter with named functions
+    if(comm.rank() % 2 == 0){
+        pool.register_function("test::add", add);
+        pool.register_function("test::sub", sub);
+    }else{
+        pool.register_function("test::sub", sub);
+        pool.register_function("test::add", add);
+    }
+
+    constexpr int add_id = function_id("test::add");
+    BOOST_CHECK_EQUAL(pool.resolve_function("test::add"), add_id);
+    BOOST_CHECK_EQUAL(pool.resolve_function("test::sub"), function_id(std::string("test::sub")));
+    BOOST_CHECK_THROW(pool.resolve_function("test::unknown"), std::out_of_range);
+
+    remote_function<int, int, int> add_again(add_function);
+    BOOST_CHECK_THROW(pool.register_function("test::add", add_again), std::runtime_error);
+
+    // make sure every node registered its functions before the first call
+    comm.barrier();
+
+    const int dest = (comm.rank() +1) % comm.size();
+    BOOST_CHECK_EQUAL(add(dest, 40, 2).get(), 42);
+    BOOST_CHECK_EQUAL(sub(dest, 40, 2).get(), 38);
+
+    comm.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_many_registrations )
+{
+    std::cout << "remote function many registrations test" << std::endl;
+    using namespace arpc;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    // the dispatch table grows several times
+    const int n_functions = 300;
+    std::list<remote_function<int, int, int> > functions;
+    for(int i = 0; i < n_functions; ++i){
+        functions.emplace_back(add_function);
+        pool.register_function("test::many_" + std::to_string(i), functions.back());
+    }
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+    int i = 0;
+    for(auto & f : functions){
+        BOOST_CHECK_EQUAL(f(dest, i, 1).get(), i +1);
+        i += 1;
+    }
+
+    pool.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_future )
+{
+    std::cout << "remote function future test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::future_add", add);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+
+    std::vector<arpc::future<int> > results;
+    for(int i = 0; i < 500; ++i){
+        results.push_back(add(dest, i, 1));
+    }
+    for(int i = 0; i < 500; ++i){
+        BOOST_CHECK(results[i].wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        BOOST_CHECK(results[i].ready());
+        BOOST_CHECK_EQUAL(results[i].get(), i +1);
+    }
+
+    // still usable as a std::future
+    std::future<int> converted = add(dest, 20, 22);
+    BOOST_CHECK_EQUAL(converted.get(), 42);
+
+    arpc::future<int> local = add(pool.rank(), 1, 2);
+    BOOST_CHECK(local.ready());
+    BOOST_CHECK_EQUAL(local.get(), 3);
+    BOOST_CHECK_THROW(local.get(), std::future_error);
+
+    pool.barrier();
+}
+
+
+int throw_function(int value){
+    if(value < 0){
+        throw std::invalid_argument("negative value");
+    }
+    return value;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_errors )
+{
+    std::cout << "remote function error reporting test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int> thrower(throw_function);
+    pool.register_function("test::thrower", thrower);
+
+    // only registered on the local node
+    remote_function<int, int> local_only(throw_function);
+    pool.register_function(std::string("test::local_only_") + std::to_string(comm.rank()), local_only);
+
+    comm.barrier();
+
+    const int dest = (comm.rank() +1) % comm.size();
+
+    BOOST_CHECK_EQUAL(thrower(dest, 1).get(), 1);
+    BOOST_CHECK_THROW(thrower(comm.rank(), -1).get(), std::invalid_argument);
+    if(comm.size() > 1){
+        BOOST_CHECK_THROW(thrower(dest, -1).get(), remote_error);
+    }
+
+    std::vector<int> all_nodes;
+    for(int i =0; i < comm.size(); ++i){
+        all_nodes.push_back(i);
+    }
+    BOOST_CHECK_THROW(thrower(all_nodes, -1).get(), std::exception);
+    BOOST_CHECK_EQUAL(thrower(all_nodes, 2).get().size(), comm.size());
+
+    if(comm.size() > 1){
+        BOOST_CHECK_THROW(local_only(dest, 1).get(), remote_error);
+    }
+
+    comm.barrier();
+}
+
+
+int slow_add_function(int a, int b){
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return a + b;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_flow_control )
+{
+    std::cout << "remote function flow control test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int, int> slow_add(slow_add_function);
+    pool.register_function("test::slow_add", slow_add);
+
+    comm.barrier();
+
+    if(comm.size() < 2){
+        std::cout << "skip this test, requires at least two nodes" << std::endl;
+        return;
+    }
+
+    const int dest = (comm.rank() +1) % comm.size();
+    const std::size_t window = 2;
+
+    // would block: the third request has no credit
+    pool.set_flow_control(flow_control_options(window, backpressure_policy::would_block));
+    {
+        auto f1 = slow_add(dest, 1, 2);
+        auto f2 = slow_add(dest, 3, 4);
+        BOOST_CHECK_THROW(slow_add(dest, 5, 6), would_block);
+
+        BOOST_CHECK_EQUAL(f1.get(), 3);
+        BOOST_CHECK_EQUAL(slow_add(dest, 7, 8).get(), 15);
+        BOOST_CHECK_EQUAL(f2.get(), 7);
+    }
+    comm.barrier();
+
+    // queue: the requests without credit are sent by the answers
+    pool.set_flow_control(flow_control_options(window, backpressure_policy::queue));
+    {
+        std::vector<std::future<int> > futures;
+        for(int i =0; i < 10; ++i){
+            futures.emplace_back(slow_add(dest, i, 1));
+        }
+        BOOST_CHECK(pool.get_metrics().queued_requests > 0);
+
+        for(int i =0; i < 10; ++i){
+            BOOST_CHECK_EQUAL(futures[i].get(), i +1);
+        }
+    }
+    comm.barrier();
+
+    // block: the caller waits for the credits
+    pool.set_flow_control(flow_control_options(window, backpressure_policy::block));
+    {
+        std::vector<int> all_nodes;
+        for(int i =0; i < comm.size(); ++i){
+            all_nodes.push_back(i);
+        }
+
+        std::vector<std::future<int> > futures;
+        std::vector<std::future<std::vector<int> > > bulk_futures;
+        for(int i =0; i < 5; ++i){
+            futures.emplace_back(slow_add(dest, i, 2));
+            bulk_futures.emplace_back(slow_add(all_nodes, i, 3));
+        }
+        for(int i =0; i < 5; ++i){
+            BOOST_CHECK_EQUAL(futures[i].get(), i +2);
+            for(int res : bulk_futures[i].get()){
+                BOOST_CHECK_EQUAL(res, i +3);
+            }
+        }
+    }
+    comm.barrier();
+
+    // no limit
+    pool.set_flow_control(flow_control_options(0));
+    comm.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_progress_modes )
+{
+    std::cout << "remote function progress modes test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::progress_add", add);
+
+    comm.barrier();
+
+    const int dest = (comm.rank() +1) % comm.size();
+    const progress_mode modes[] = { progress_mode::spin_yield, progress_mode::spin_park, progress_mode::blocking,
+                                    progress_mode::adaptive, progress_mode::busy_spin, progress_mode::blocking };
+
+    for(auto mode : modes){
+        // small budget and park time to exercise the parking
+        pool.set_progress(progress_options(mode, 10, std::chrono::microseconds(200)));
+
+        for(int i =0; i < 20; ++i){
+            BOOST_CHECK_EQUAL(add(dest, i, 1).get(), i +1);
+        }
+
+        // idle period, the progress thread parks
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        BOOST_CHECK_EQUAL(add(dest, 1, 1).get(), 2);
+
+        comm.barrier();
+    }
+
+    // the service ends in blocking mode
+}
+
+
+int long_add_function(int a, int b){
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return a + b;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_funneled )
+{
+    std::cout << "remote function funneled mode test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    {
+        exec_service_mpi pool(MPI_COMM_WORLD, threading_mode::funneled);
+        BOOST_CHECK(pool.is_funneled());
+
+        remote_function<int, int, int> add(add_function);
+        pool.register_function("test::funneled_add", add);
+
+        remote_function<int, std::string, int> hello(hello_rank);
+        pool.register_function(hello);
+
+        pool.barrier();
+
+        const int dest = (pool.rank() +1) % pool.size();
+
+        std::vector<int> all_nodes;
+        for(int i =0; i < pool.size(); ++i){
+            all_nodes.push_back(i);
+        }
+
+        // concurrent clients, every send goes through the progress thread
+        std::vector<std::thread> clients;
+        for(int t = 0; t < 4; ++t){
+            clients.emplace_back([&, t]{
+                for(int i =0; i < 50; ++i){
+                    BOOST_CHECK_EQUAL(add(dest, i, t).get(), i + t);
+                }
+                std::vector<int> ranks = hello(all_nodes, "funneled", 0).get();
+                BOOST_CHECK_EQUAL(ranks.size(), all_nodes.size());
+            });
+        }
+        for(auto & c : clients){
+            c.join();
+        }
+
+        pool.set_flow_control(flow_control_options(4, backpressure_policy::queue));
+        for(int i =0; i < 20; ++i){
+            BOOST_CHECK_EQUAL(add(dest, i, i).get(), 2 * i);
+        }
+
+        pool.barrier();
+    }
+
+    // destroyed with a call still running: its answer is sent through the progress thread
+    {
+        remote_function<int, int, int> long_add(long_add_function);
+        exec_service_mpi pool(MPI_COMM_WORLD, threading_mode::funneled);
+        pool.register_function("test::funneled_long_add", long_add);
+        pool.barrier();
+
+        if(pool.rank() == 0 && pool.size() > 1){
+            long_add(1, 1, 2);
+        }
+    }
+
+    comm.barrier();
+}
+
+
+std::atomic<int> square_executions(0);
+
+int pure_square(int value){
+    square_executions += 1;
+    return value * value;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_pure )
+{
+    std::cout << "remote function pure memoization test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int> square(pure_square);
+    square.set_pure(cache_options(4));
+    pool.register_function("test::pure_square", square);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+
+    // at most the first call is sent, the following ones are answered locally.
+    // The cache is shared with the server side: the call of the neighbour can fill it first
+    for(int i =0; i < 10; ++i){
+        BOOST_CHECK_EQUAL(square(dest, 7).get(), 49);
+    }
+
+    cache_stats stats = square.get_cache_stats();
+    BOOST_CHECK(stats.hits >= 9u);
+
+    pool.barrier();
+    BOOST_CHECK(square_executions.load() <= 1);
+    pool.barrier();
+
+    // bulk calls are sent, the servers answer from their cache
+    std::vector<int> all_nodes;
+    for(int i =0; i < pool.size(); ++i){
+        all_nodes.push_back(i);
+    }
+    std::vector<int> squares = square(all_nodes, 7).get();
+    BOOST_CHECK_EQUAL(squares.size(), all_nodes.size());
+    for(int s : squares){
+        BOOST_CHECK_EQUAL(s, 49);
+    }
+
+    pool.barrier();
+    BOOST_CHECK(square_executions.load() <= 1);
+    pool.barrier();
+
+    // least recently used results are evicted beyond the capacity
+    for(int i =0; i < 8; ++i){
+        BOOST_CHECK_EQUAL(square(dest, i).get(), i * i);
+    }
+    BOOST_CHECK_EQUAL(square.get_cache_stats().size, 4u);
+    BOOST_CHECK(square.get_cache_stats().evictions > 0);
+
+    service_metrics metrics = pool.get_metrics();
+    BOOST_CHECK(metrics.functions[function_id("test::pure_square")].cache_hits >= 9u);
+
+    pool.barrier();
+
+    // expired results are executed again, local calls use the cache too
+    square.set_pure(cache_options(4, std::chrono::milliseconds(1)));
+    const int executions = square_executions.load();
+    BOOST_CHECK_EQUAL(square(pool.rank(), 3).get(), 9);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK_EQUAL(square(pool.rank(), 3).get(), 9);
+    BOOST_CHECK_EQUAL(square.get_cache_stats().hits, 0u);
+    BOOST_CHECK_EQUAL(square_executions.load(), executions + 2);
+
+    pool.barrier();
+}
+
+
+std::atomic<int> lookup_executions(0);
+
+int slow_lookup(int key){
+    lookup_executions += 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return key * 10;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_deduplication )
+{
+    std::cout << "remote function in-flight deduplication test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int> lookup(slow_lookup);
+    lookup.set_deduplication();
+    pool.register_function("test::slow_lookup", lookup);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+    const int n_clients = 8;
+
+    // identical calls while the first one executes
+    std::vector<std::future<int> > results(n_clients);
+    std::vector<std::thread> clients;
+    for(int t = 0; t < n_clients; ++t){
+        clients.emplace_back([&, t]{
+            results[t] = lookup(dest, 4);
+        });
+    }
+    for(auto & c : clients){
+        c.join();
+    }
+    for(auto & r : results){
+        BOOST_CHECK_EQUAL(r.get(), 40);
+    }
+
+    // different arguments are not merged, a completed call is sent again
+    BOOST_CHECK_EQUAL(lookup(dest, 5).get(), 50);
+    BOOST_CHECK_EQUAL(lookup(dest, 4).get(), 40);
+
+    if(pool.is_local(dest) == false){
+        const function_metrics m = pool.get_metrics().functions[function_id("test::slow_lookup")];
+        BOOST_CHECK_EQUAL(m.calls_sent + m.calls_deduplicated, std::uint64_t(n_clients + 2));
+        BOOST_CHECK(m.calls_deduplicated > 0);
+    }
+
+    pool.barrier();
+
+    if(pool.is_local(dest) == false){
+        BOOST_CHECK(lookup_executions.load() < n_clients + 2);
+    }
+
+    pool.barrier();
+}
+
+
+int busy_rank(int delay_ms){
+    mpi::mpi_comm comm;
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    return comm.rank();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_call_any )
+{
+    std::cout << "remote function load balanced call test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int> where(busy_rank);
+    pool.register_function("test::busy_rank", where);
+
+    pool.barrier();
+
+    std::vector<int> all_nodes;
+    for(int i =0; i < pool.size(); ++i){
+        all_nodes.push_back(i);
+    }
+
+    BOOST_CHECK_THROW(where.call_any(std::vector<int>(), 0), std::invalid_argument);
+    BOOST_CHECK_THROW(where.call_any(std::vector<int>(1, pool.size()), 0), std::invalid_argument);
+
+    const int dest = (pool.rank() +1) % pool.size();
+    BOOST_CHECK_EQUAL(where.call_any(std::vector<int>(1, dest), 0).get(), dest);
+
+    const balancing_policy policies[] = { balancing_policy::power_of_two, balancing_policy::least_loaded };
+    for(balancing_policy policy : policies){
+        pool.set_load_balancing(policy);
+
+        std::vector<std::future<int> > results;
+        for(int i =0; i < 20; ++i){
+            results.emplace_back(where.call_any(all_nodes, 1));
+        }
+        for(auto & r : results){
+            const int rank = r.get();
+            BOOST_CHECK(rank >= 0 && rank < pool.size());
+        }
+    }
+
+    pool.barrier();
+}
+
+
+std::vector<int> append_rank(const std::vector<int> & path){
+    mpi::mpi_comm comm;
+    std::vector<int> res = path;
+    res.push_back(comm.rank());
+    return res;
+}
+
+int negate(int value){
+    return -value;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_forwarding )
+{
+    std::cout << "remote function result forwarding test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<std::vector<int>, std::vector<int> > visit(append_rank);
+    pool.register_function("test::append_rank", visit);
+
+    remote_function<int, int> neg(negate);
+    pool.register_function("test::negate", neg);
+
+    remote_function<int, int> check_positive(throw_function);
+    pool.register_function("test::forward_throw", check_positive);
+
+    pool.barrier();
+
+    const int next = (pool.rank() +1) % pool.size();
+    const int after = (pool.rank() +2) % pool.size();
+
+    // each call runs on its node and sends its result to the next one
+    std::vector<int> path = visit(after, visit.remote(next, visit.remote(pool.rank(), std::vector<int>(1, -1)))).get();
+    const std::vector<int> expected = { -1, pool.rank(), next, after };
+    BOOST_CHECK_EQUAL_COLLECTIONS(path.begin(), path.end(), expected.begin(), expected.end());
+
+    BOOST_CHECK_EQUAL(neg(pool.rank(), neg.remote(next, 21)).get(), 21);
+
+    // an error in the chain is reported to the caller
+    BOOST_CHECK_THROW(neg(next, check_positive.remote(after, neg.remote(next, 5))).get(), remote_error);
+    BOOST_CHECK_EQUAL(neg(next, check_positive.remote(after, neg.remote(next, -5))).get(), -5);
+
+    BOOST_CHECK_THROW(neg(pool.size(), neg.remote(next, 1)), std::invalid_argument);
+
+    pool.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_task_graph )
+{
+    std::cout << "remote function task graph test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int> neg(negate);
+    pool.register_function("test::graph_negate", neg);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::graph_add", add);
+
+    remote_function<int, int> check_positive(throw_function);
+    pool.register_function("test::graph_throw", check_positive);
+
+    pool.barrier();
+
+    const int next = (pool.rank() +1) % pool.size();
+    const int after = (pool.rank() +2) % pool.size();
+
+    {
+        task_graph graph(pool);
+        task<int> a = graph.add(neg, next, 3);
+        task<int> b = graph.add(neg, after, 4);
+        task<int> c = graph.add(add, pool.rank(), a, b);
+        task<int> d = graph.add(add, next, c, 10);
+
+        std::future<int> result_c = graph.output(c);
+        std::future<int> result_d = graph.output(d);
+        BOOST_CHECK_THROW(graph.output(d), std::logic_error);
+
+        graph.submit();
+        BOOST_CHECK_THROW(graph.submit(), std::logic_error);
+
+        BOOST_CHECK_EQUAL(result_c.get(), -7);
+        BOOST_CHECK_EQUAL(result_d.get(), 3);
+    }
+
+    // reduction tree over all the nodes, only the root comes back
+    {
+        task_graph graph(pool);
+        std::vector<task<int> > level;
+        for(int i = 0; i < 64; ++i){
+            level.push_back(graph.add(neg, i % pool.size(), i));
+        }
+        while(level.size() > 1){
+            std::vector<task<int> > upper;
+            for(std::size_t i = 0; i < level.size(); i += 2){
+                upper.push_back(graph.add(add, int(i / 2) % pool.size(), level[i], level[i+1]));
+            }
+            level.swap(upper);
+        }
+
+        std::future<int> root = graph.output(level.front());
+        graph.submit();
+        BOOST_CHECK_EQUAL(root.get(), -2016);
+        BOOST_CHECK_EQUAL(graph.size(), 127u);
+    }
+
+    // an error is propagated to the calls depending on the failed one
+    {
+        task_graph graph(pool);
+        task<int> a = graph.add(check_positive, next, -1);
+        task<int> b = graph.add(neg, after, a);
+        task<int> c = graph.add(neg, pool.rank(), 5);
+        std::future<int> result_b = graph.output(b);
+        std::future<int> result_c = graph.output(c);
+        graph.submit();
+
+        BOOST_CHECK_THROW(result_b.get(), remote_error);
+        BOOST_CHECK_EQUAL(result_c.get(), -5);
+    }
+
+    pool.barrier();
+}
+
+
+class counter{
+public:
+    explicit counter(int initial) : value(initial) {
+        if(initial < 0){
+            throw std::invalid_argument("negative counter");
+        }
+    }
+
+    int add(int increment){
+        value += increment;
+        return value;
+    }
+
+    int get() const{
+        return value;
+    }
+
+    void reset(){
+        value = 0;
+    }
+
+private:
+    int value;
+};
+
+
+BOOST_AUTO_TEST_CASE( remote_function_remote_object )
+{
+    std::cout << "remote object test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_class<counter, int> counter_class(pool, "test::counter");
+    auto add = counter_class.method("add", &counter::add);
+    auto get = counter_class.method("get", &counter::get);
+    auto reset = counter_class.method("reset", &counter::reset);
+
+    BOOST_CHECK_THROW(counter_class.method("add", &counter::add), std::runtime_error);
+
+    pool.barrier();
+
+    const int next = (pool.rank() +1) % pool.size();
+
+    remote_object<counter> c = counter_class.create(next, 10);
+    BOOST_CHECK_EQUAL(c.rank(), next);
+
+    // the calls are not waited for, they still run in order
+    const int n_calls = 200;
+    std::vector<std::future<int> > values;
+    for(int i = 0; i < n_calls; ++i){
+        values.push_back(c.call(add, 1));
+    }
+    c.created().get();
+    for(int i = 0; i < n_calls; ++i){
+        BOOST_CHECK_EQUAL(values[i].get(), 11 + i);
+    }
+
+    BOOST_CHECK_EQUAL(c.call(get).get(), 10 + n_calls);
+    c.call(reset).get();
+    BOOST_CHECK_EQUAL(c.call(get).get(), 0);
+
+    // an object per node, independent states
+    remote_object<counter> local = counter_class.create(pool.rank(), 100);
+    BOOST_CHECK_EQUAL(local.call(add, 5).get(), 105);
+    BOOST_CHECK_EQUAL(c.call(add, 5).get(), 5);
+
+    // the copies of a handle share its destruction
+    remote_object<counter> copy = c;
+    c.destroy().get();
+    BOOST_CHECK_THROW(c.call(get), std::logic_error);
+    BOOST_CHECK_THROW(copy.call(get), std::logic_error);
+    BOOST_CHECK_THROW(copy.destroy(), std::logic_error);
+    BOOST_CHECK_THROW(remote_object<counter>().call(get), std::logic_error);
+
+    // errors of the construction are reported by created() and by the calls
+    remote_object<counter> invalid = counter_class.create(next, -1);
+    std::future<int> value = invalid.call(get);
+    BOOST_CHECK_THROW(invalid.created().get(), remote_error);
+    BOOST_CHECK_THROW(value.get(), remote_error);
+
+    // only registered on the local node, the calls give the reason of the failure
+    if(pool.size() > 1){
+        remote_class<counter, int> local_class(pool, "test::local_counter_" + std::to_string(pool.rank()));
+        auto local_get = local_class.method("get", &counter::get);
+        pool.barrier();
+
+        remote_object<counter> unknown = local_class.create(next, 1);
+        try{
+            unknown.call(local_get).get();
+            BOOST_ERROR("call on an object never constructed");
+        }catch(remote_error & e){
+            BOOST_CHECK(std::string(e.what()).find("no remote class registered") != std::string::npos);
+        }
+        unknown.destroy().get();
+    }
+
+    // more objects than the destroyed ids remembered by a node
+    std::vector<std::future<void> > destructions;
+    for(int i = 0; i < 1500; ++i){
+        remote_object<counter> temporary = counter_class.create(next, i);
+        destructions.push_back(temporary.destroy());
+    }
+    for(auto & d : destructions){
+        d.get();
+    }
+
+    local.destroy().get();
+    invalid.destroy().get();
+
+    pool.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_distributed_map )
+{
+    std::cout << "distributed map test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    distributed_map<std::string, int> counts(pool, "test::counts");
+    distributed_map<int, std::string> names(pool, "test::names", [](std::string & value, const std::string & delta){
+        value = std::max(value, delta);
+    });
+
+    pool.barrier();
+
+    // every node counts the same words
+    const int n_words = 1000;
+    std::vector<std::string> words;
+    for(int i = 0; i < n_words; ++i){
+        words.push_back("word_" + std::to_string(i % (n_words / 2)));
+    }
+
+    counts.update(words, std::vector<int>(words.size(), 1)).get();
+    pool.barrier();
+
+    std::vector<int> values = counts.get(words, -1).get();
+    BOOST_REQUIRE_EQUAL(values.size(), words.size());
+    for(std::size_t i = 0; i < values.size(); ++i){
+        BOOST_CHECK_EQUAL(values[i], 2 * pool.size());
+    }
+
+    const std::vector<std::string> absent = { "absent", words.front() };
+    std::vector<int> absent_values = counts.get(absent, -1).get();
+    BOOST_CHECK_EQUAL(absent_values[0], -1);
+    BOOST_CHECK_EQUAL(absent_values[1], 2 * pool.size());
+
+    // each node stores the keys it owns
+    std::size_t owned = 0;
+    for(int i = 0; i < n_words / 2; ++i){
+        owned += (counts.owner(words[i]) == pool.rank()) ? 1 : 0;
+    }
+    BOOST_CHECK_EQUAL(counts.local_size(), owned);
+    if(pool.size() > 1){
+        BOOST_CHECK(owned < std::size_t(n_words / 2));
+    }
+
+    pool.barrier();
+
+    // each node writes its own keys, then read the ones of the others
+    std::vector<int> keys;
+    std::vector<std::string> texts;
+    for(int i = 0; i < 100; ++i){
+        keys.push_back(pool.rank() * 100 + i);
+        texts.push_back(std::to_string(pool.rank()));
+    }
+    BOOST_CHECK_EQUAL(names.put(keys, texts).get(), keys.size());
+    BOOST_CHECK_EQUAL(names.put(keys, texts).get(), 0u);
+    pool.barrier();
+
+    const int other = (pool.rank() +1) % pool.size();
+    for(int & key : keys){
+        key = other * 100 + (key % 100);
+    }
+    std::vector<std::string> read = names.get(keys).get();
+    for(const std::string & text : read){
+        BOOST_CHECK_EQUAL(text, std::to_string(other));
+    }
+
+    BOOST_CHECK_EQUAL(names.get(std::vector<int>()).get().size(), 0u);
+    BOOST_CHECK_THROW(names.put(keys, std::vector<std::string>()), std::invalid_argument);
+
+    pool.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_batch )
+{
+    std::cout << "remote function batch test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::batch_add", add);
+
+    remote_function<int, int> check_positive(throw_function);
+    pool.register_function("test::batch_throw", check_positive);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+
+    std::vector<std::tuple<int, int> > calls;
+    for(int i = 0; i < 10000; ++i){
+        calls.emplace_back(i, 2 * i);
+    }
+
+    // one message, then one message per executor, then local
+    const std::size_t parts[] = { 1, 4, 3 };
+    const int nodes[] = { dest, dest, pool.rank() };
+    for(int k = 0; k < 3; ++k){
+        std::vector<int> results = add.batch(nodes[k], calls, parts[k]).get();
+        BOOST_REQUIRE_EQUAL(results.size(), calls.size());
+        for(int i = 0; i < int(results.size()); ++i){
+            BOOST_CHECK_EQUAL(results[i], 3 * i);
+        }
+    }
+
+    BOOST_CHECK_EQUAL(add.batch(dest, std::vector<std::tuple<int, int> >(), 2).get().size(), 0u);
+    BOOST_CHECK_EQUAL(add.batch(dest, { std::make_tuple(1, 1) }, 8).get().front(), 2);
+    BOOST_CHECK_THROW(add.batch(dest, calls, 0), std::invalid_argument);
+
+    std::vector<std::tuple<int> > values = { std::make_tuple(1), std::make_tuple(-1), std::make_tuple(2) };
+    BOOST_CHECK_THROW(check_positive.batch(dest, values).get(), remote_error);
+    values[1] = std::make_tuple(3);
+    const std::vector<int> checked = check_positive.batch(dest, values).get();
+    BOOST_CHECK_EQUAL(checked[2], 2);
+
+    pool.barrier();
+}
+
+
+std::vector<int> make_sequence(int n){
+    std::vector<int> res(std::size_t(std::max(n, 0)));
+    for(int i = 0; i < n; ++i){
+        res[std::size_t(i)] = i;
+    }
+    return res;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_deferred )
+{
+    std::cout << "remote function deferred deserialization test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<std::vector<int>, int> sequence(make_sequence);
+    sequence.set_deferred_deserialization();
+    pool.register_function("test::deferred_sequence", sequence);
+
+    remote_function<std::vector<int>, int> pure_sequence(make_sequence);
+    pure_sequence.set_deferred_deserialization();
+    pure_sequence.set_pure();
+    pool.register_function("test::deferred_pure_sequence", pure_sequence);
+
+    remote_function<int, int> check_positive(throw_function);
+    check_positive.set_deferred_deserialization();
+    pool.register_function("test::deferred_throw", check_positive);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::deferred_add", add);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+    const int size = 100000;
+
+    std::vector<arpc::future<std::vector<int> > > results;
+    for(int i = 0; i < 20; ++i){
+        results.push_back(sequence(dest, size + i));
+    }
+    for(int i = 0; i < 20; ++i){
+        const std::vector<int> res = results[std::size_t(i)].get();
+        BOOST_REQUIRE_EQUAL(res.size(), std::size_t(size + i));
+        BOOST_CHECK_EQUAL(res.back(), size + i -1);
+    }
+
+    // the raw answer, remote and local
+    const std::vector<char> expected = internal::serialize_value(make_sequence(size));
+    const int nodes[] = { dest, pool.rank() };
+    for(int node : nodes){
+        std::vector<char> raw = sequence(node, size).get_raw();
+        BOOST_CHECK(raw == expected);
+    }
+
+    // the cache keeps its copy of the answer
+    BOOST_CHECK_EQUAL(pure_sequence(dest, 10).get().size(), 10u);
+    BOOST_CHECK(pure_sequence(dest, 10).get_raw() == internal::serialize_value(make_sequence(10)));
+    BOOST_CHECK(pure_sequence.get_cache_stats().hits >= 1u);
+
+    std::future<std::vector<int> > converted = sequence(dest, 3);
+    BOOST_CHECK_EQUAL(converted.get().size(), 3u);
+
+    if(pool.size() > 1){
+        BOOST_CHECK_THROW(check_positive(dest, -1).get(), remote_error);
+        BOOST_CHECK_THROW(check_positive(dest, -1).get_raw(), remote_error);
+    }
+    BOOST_CHECK_THROW(check_positive(pool.rank(), -1).get_raw(), std::invalid_argument);
+    BOOST_CHECK_EQUAL(check_positive(dest, 4).get(), 4);
+
+    // decoded at reception, no raw answer
+    BOOST_CHECK_THROW(add(dest, 1, 1).get_raw(), std::logic_error);
+
+    pool.barrier();
+}
+
+
+std::vector<int> square_chunk(std::vector<int> chunk){
+    for(int & value : chunk){
+        if(value < 0){
+            throw std::invalid_argument("negative value");
+        }
+        value *= value;
+    }
+    return chunk;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_map )
+{
+    std::cout << "remote function map test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<std::vector<int>, std::vector<int> > square(square_chunk);
+    pool.register_function("test::square_chunk", square);
+
+    pool.barrier();
+
+    std::vector<int> all_nodes;
+    for(int i = 0; i < pool.size(); ++i){
+        all_nodes.push_back(i);
+    }
+
+    std::vector<int> input(1003);
+    for(std::size_t i = 0; i < input.size(); ++i){
+        input[i] = int(i);
+    }
+
+    // several chunks per node, the last one incomplete
+    std::vector<std::vector<int> > chunks = square.map(all_nodes, input, 10).get();
+    BOOST_REQUIRE_EQUAL(chunks.size(), 101u);
+    BOOST_CHECK_EQUAL(chunks.back().size(), 3u);
+
+    std::vector<int> output;
+    for(auto & chunk : chunks){
+        output.insert(output.end(), chunk.begin(), chunk.end());
+    }
+    BOOST_REQUIRE_EQUAL(output.size(), input.size());
+    for(std::size_t i = 0; i < input.size(); ++i){
+        BOOST_CHECK_EQUAL(output[i], input[i] * input[i]);
+    }
+
+    // any range of elements convertible to the argument
+    const std::list<int> small = { 1, 2, 3 };
+    chunks = square.map({ (pool.rank() +1) % pool.size() }, small, 2).get();
+    BOOST_REQUIRE_EQUAL(chunks.size(), 2u);
+    BOOST_CHECK_EQUAL(chunks[1].front(), 9);
+
+    BOOST_CHECK_EQUAL(square.map(all_nodes, std::vector<int>(), 4).get().size(), 0u);
+    BOOST_CHECK_THROW(square.map(all_nodes, input, 0), std::invalid_argument);
+    BOOST_CHECK_THROW(square.map(std::vector<int>(), input, 4), std::invalid_argument);
+
+    // an error in a chunk is reported once all the chunks are done
+    input[500] = -1;
+    BOOST_CHECK_THROW(square.map(all_nodes, input, 7).get(), remote_error);
+
+    pool.barrier();
+}
+
+
+std::size_t string_size(const std::string & str){
+    return str.size();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_eager_and_large )
+{
+    std::cout << "remote function eager and large messages test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+
+    exec_service_mpi pool(MPI_COMM_WORLD);
+
+    remote_function<std::size_t, std::string> size_of(string_size);
+    pool.register_function("test::string_size", size_of);
+
+    pool.barrier();
+
+    const int dest = (pool.rank() +1) % pool.size();
+
+    // inline and separate data messages interleaved to the same node, from several threads
+    std::vector<std::thread> clients;
+    for(int t = 0; t < 4; ++t){
+        clients.emplace_back([&, t]{
+            for(int i =0; i < 30; ++i){
+                const std::size_t size = ((i + t) % 3 == 0) ? std::size_t(100000 + i) : std::size_t(i);
+                BOOST_CHECK_EQUAL(size_of(dest, std::string(size, 'x')).get(), size);
+            }
+        });
+    }
+    for(auto & c : clients){
+        c.join();
+    }
+
+    // more requests in flight than pre-posted receives
+    std::vector<std::future<std::size_t> > results;
+    for(std::size_t i =0; i < 200; ++i){
+        results.emplace_back(size_of(dest, std::string(i, 'y')));
+    }
+    for(std::size_t i =0; i < results.size(); ++i){
+        BOOST_CHECK_EQUAL(results[i].get(), i);
+    }
+
+    pool.barrier();
+}
+
+
+std::map<std::string, std::string> repeat_map(const std::map<std::string, std::string> & in, int n){
+    std::map<std::string, std::string> res(in);
+    for(int i =0; i < n; ++i){
+        res.insert(std::make_pair(std::string("key_") + std::to_string(i), std::string(64, 'x')));
+    }
+    return res;
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_compression )
+{
+    std::cout << "compressed remote function test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+    pool.set_compression(compression_options(compression_codec::best_available, 128));
+
+    remote_function<std::map<std::string, std::string>, std::map<std::string, std::string>, int> fill(repeat_map);
+    pool.register_function("test::repeat_map", fill);
+
+    remote_function<std::map<std::string, std::string>, std::map<std::string, std::string>, int> fill_zlib(repeat_map);
+    fill_zlib.set_compression(compression_options(compression_codec::zlib, 0));
+    pool.register_function("test::repeat_map_zlib", fill_zlib);
+
+    comm.barrier();
+
+    const int dest = (comm.rank() +1) % comm.size();
+
+    std::map<std::string, std::string> input;
+    input["hello"] = std::string(1000, 'a');
+
+    auto res = fill(dest, input, 1000).get();
+    BOOST_CHECK_EQUAL(res.size(), 1001);
+    BOOST_CHECK_EQUAL(res["hello"], input["hello"]);
+    BOOST_CHECK_EQUAL(res["key_999"], std::string(64, 'x'));
+
+    auto res_zlib = fill_zlib(dest, res, 10).get();
+    BOOST_CHECK(res_zlib == res);
+
+    comm.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_metrics )
+{
+    std::cout << "remote function metrics test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::metrics_add", add);
+
+    comm.barrier();
+
+    if(comm.size() < 2){
+        std::cout << "skip this test, requires at least two nodes" << std::endl;
+        return;
+    }
+
+    const int dest = (comm.rank() +1) % comm.size();
+    const std::size_t n_calls = 10;
+    for(std::size_t i =0; i < n_calls; ++i){
+        BOOST_CHECK_EQUAL(add(dest, int(i), 1).get(), int(i) +1);
+        // a request is not outstanding anymore once its future is ready
+        BOOST_CHECK_EQUAL(pool.get_metrics().outstanding_requests, 0);
+    }
+
+    comm.barrier();
+
+    service_metrics metrics = pool.get_metrics();
+    BOOST_CHECK_EQUAL(metrics.rank, comm.rank());
+    BOOST_CHECK_EQUAL(metrics.outstanding_requests, 0);
+
+    const function_metrics & m = metrics.functions[function_id("test::metrics_add")];
+    BOOST_CHECK_EQUAL(m.calls_sent, n_calls);
+    BOOST_CHECK_EQUAL(m.calls_received, n_calls);
+    BOOST_CHECK_EQUAL(m.latency.count, n_calls);
+    BOOST_CHECK_EQUAL(m.execution.count, n_calls);
+    BOOST_CHECK(m.bytes_sent > 0);
+    BOOST_CHECK(m.latency.percentile(0.5) > 0);
+
+    std::ostringstream ss;
+    pool.dump_metrics(ss);
+    BOOST_CHECK(ss.str().find("\"calls_sent\": 10") != std::string::npos);
+
+    comm.barrier();
+}
+
+
+BOOST_AUTO_TEST_CASE( remote_function_tracing )
+{
+    std::cout << "remote function tracing test" << std::endl;
+    using namespace arpc;
+
+    mpi::mpi_comm comm;
+    exec_service_mpi pool(&argc, &argv);
+
+    remote_function<int, int, int> add(add_function);
+    pool.register_function("test::traced_add", add);
+
+    comm.barrier();
+
+    const int dest = (comm.rank() +1) % comm.size();
+
+    // not traced
+    BOOST_CHECK_EQUAL(add(dest, 1, 1).get(), 2);
+
+    pool.enable_tracing(true);
+    for(int i =0; i < 5; ++i){
+        BOOST_CHECK_EQUAL(add(dest, i, 1).get(), i +1);
+    }
+    pool.enable_tracing(false);
+
+    comm.barrier();
+
+    const std::string trace_file = "arpc_trace_test.json";
+    pool.write_trace(trace_file);
+
+    if(comm.is_master()){
+        std::ifstream input(trace_file);
+        std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        BOOST_CHECK(content.find("traceEvents") != std::string::npos);
+        if(comm.size() > 1){
+            const char* stages[] = { "serialize", "send_data", "probe", "queue", "execute", "reply", "fulfil" };
+            for(auto stage : stages){
+                BOOST_CHECK_MESSAGE(content.find(std::string("\"") + stage + "\"") != std::string::npos, stage);
+            }
+        }
+    }
+
+    comm.barrier();
+}